@@ -0,0 +1,46 @@
+// how fast the Tokenizer alone gets through the same kind of data file bench/tokenize.mal
+// reads, in MB/s: no forms are built, so this is the number to look at when changing
+// nextToken. bench/tokenize.sh builds it with and without -DMAL_NO_SIMD to put the
+// SSE2 path and the scalar one side by side.
+// usage: tokenize [records] [rounds]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "reader.hpp"
+
+// a record like bench/tokenize.mal's: long symbols, strings, whitespace runs and a comment
+static string record(long i) {
+    auto n = std::to_string(i);
+    return "  {:identifier " + n + " :description \"a fairly long description of record " + n + "\"\n"
+           "   :category-name some-reasonably-long-symbol-name   ; a comment about it\n"
+           "   :values [" + n + " " + std::to_string(i * 2) + " " + std::to_string(i * 3) + "]}\n";
+}
+
+int main(int argc, char *argv[]) {
+    long records = argc > 1 ? atol(argv[1]) : 20000;
+    long rounds = argc > 2 ? atol(argv[2]) : 20;
+
+    string src = "[";
+    for (long i = 0; i < records; ++i)
+        src += record(i);
+    src += "]";
+
+    // the tokens' lengths add up to something the loop can't be optimized away without
+    size_t tokens = 0, chars = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long r = 0; r < rounds; ++r) {
+        Tokenizer tokenizer(src);
+        while (auto token = tokenizer.nextToken()) {
+            ++tokens;
+            chars += token->size();
+        }
+    }
+    std::chrono::duration < double > took = std::chrono::steady_clock::now() - start;
+
+    printf("bytes: %zu\n", src.size());
+    printf("tokens per read: %zu (%zu chars)\n", tokens / rounds, chars / rounds);
+    printf("ms per read: %.2f\n", took.count() * 1000 / rounds);
+    printf("MB/s: %.0f\n", src.size() * rounds / took.count() / 1e6);
+}
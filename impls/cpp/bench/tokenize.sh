@@ -0,0 +1,43 @@
+#!/bin/bash
+
+#
+# Usage: tokenize.sh [records] [rounds] [revision]
+#
+# Builds bench/tokenize.cpp twice, with the Tokenizer's SSE2 path and with only
+# its scalar one (-DMAL_NO_SIMD), and runs them one after the other on the same
+# input. Given a git revision, also builds it with the reader.hpp from that
+# revision, e.g. the one from before the table and block scanning.
+# Set CXX and CXXFLAGS to build with something other than c++ -O2.
+#
+
+root="$(cd "$(dirname $0)/.." && pwd)"
+records="${1:-20000}"
+rounds="${2:-20}"
+revision="$3"
+cxx="${CXX:-c++}"
+flags="${CXXFLAGS:--O2}"
+
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+
+build() {
+  name=$1
+  shift
+  $cxx -std=c++20 $flags "$@" -o "$dir/$name" "$root/bench/tokenize.cpp" || exit 1
+}
+
+build sse2 -I "$root"
+build scalar -DMAL_NO_SIMD -I "$root"
+names="sse2 scalar"
+if [ -n "$revision" ] ; then
+  # its reader.hpp on its own, finding the rest of the headers in this tree
+  mkdir "$dir/include"
+  git -C "$root" show "$revision:./reader.hpp" > "$dir/include/reader.hpp" || exit 1
+  build old -I "$dir/include" -I "$root"
+  names="$names old"
+fi
+
+for name in $names ; do
+  echo "$name:"
+  "$dir/$name" "$records" "$rounds" | sed 's/^/  /'
+done
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "mal_types.hpp"
+#include "env.hpp"
+#include "core.hpp"
+#include "resolver.hpp"
+
+using namespace std;
+
+// turns a (resolved) function body into a tree of MalNodes, once, when the function gets created.
+// every special form gets checked when it is compiled, and gets a node holding its parts:
+// (if (< n 2) n (+ n 1)) => IfNode { cond: CallNode { < n 2 }, then: n, otherwise: CallNode { + n 1 } }
+// so calling the function again doesn't copy the forms out of their lists and go through
+// EVAL's special form checks every time.
+// variables and self evaluating values (numbers, strings, keywords...) are left as they are.
+// the forms we don't compile (def! with multiple bindings, if-let, match, try*,
+// quasiquote...) and the ones that are malformed become a FormNode, which just hands the
+// form back to EVAL. that way errors still show up when (and only if) the form runs.
+// a macro call becomes a MacroNode, which holds on to its compiled expansion
+namespace Compiler {
+    class ConstNode : public MalNode {
+    public:
+        ConstNode(MalType* form, MalType* v) : MalNode(ConstKind, form), value {v} { }
+
+        GCObject* relocate() {
+            return new ConstNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            GC::visit(value);
+        }
+
+        MalType* value;
+    };
+
+    class IfNode : public MalNode {
+    public:
+        IfNode(MalType* form, MalType* c, MalType* t, MalType* o)
+        : MalNode(IfKind, form), cond {c}, then {t}, otherwise {o} { }
+
+        GCObject* relocate() {
+            return new IfNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            GC::visit(cond);
+            GC::visit(then);
+            GC::visit(otherwise);
+        }
+
+        MalType* cond;
+        MalType* then;
+        MalType* otherwise;
+    };
+
+    // do, and the parts of a call
+    class ListNode : public MalNode {
+    public:
+        ListNode(Kind kind, MalType* form, vector < MalType * > i)
+        : MalNode(kind, form), items {i} { }
+
+        GCObject* relocate() {
+            return new ListNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            for (auto& item : items)
+                GC::visit(item);
+        }
+
+        vector < MalType * > items;
+    };
+
+    class LetNode : public MalNode {
+    public:
+        LetNode(MalType* form, vector < MalType * > k, vector < MalType * > v, MalType* b)
+        : MalNode(LetKind, form), keys {k}, values {v}, body {b} { }
+
+        GCObject* relocate() {
+            return new LetNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            for (auto& key : keys)
+                GC::visit(key);
+            for (auto& value : values)
+                GC::visit(value);
+            GC::visit(body);
+        }
+
+        vector < MalType * > keys;
+        vector < MalType * > values;
+        MalType* body;
+    };
+
+    class CondNode : public MalNode {
+    public:
+        CondNode(MalType* form, vector < MalType * > c, vector < MalType * > b)
+        : MalNode(CondKind, form), conds {c}, bodies {b} { }
+
+        GCObject* relocate() {
+            return new CondNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            for (auto& cond : conds)
+                GC::visit(cond);
+            for (auto& body : bodies)
+                GC::visit(body);
+        }
+
+        vector < MalType * > conds;
+        vector < MalType * > bodies;
+    };
+
+    class FnNode : public MalNode {
+    public:
+        FnNode(MalType* form, vector < MalType * > p, bool v, MalType* b, MalType* c)
+        : MalNode(FnKind, form), params {p}, variadic {v}, body {b}, captures {c} { }
+
+        GCObject* relocate() {
+            return new FnNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            for (auto& param : params)
+                GC::visit(param);
+            GC::visit(body);
+            GC::visit(captures);
+        }
+
+        // without the &, like MalTCOptFunc wants them
+        vector < MalType * > params;
+        bool variadic;
+        MalType* body;
+        // the list of MalLocals a flat closure captures (see resolver.hpp), or NULL
+        MalType* captures;
+    };
+
+    class DefNode : public MalNode {
+    public:
+        DefNode(MalType* form, MalType* k, MalType* v, bool m)
+        : MalNode(DefKind, form), key {k}, value {v}, isMacro {m} { }
+
+        GCObject* relocate() {
+            return new DefNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            GC::visit(key);
+            GC::visit(value);
+        }
+
+        MalType* key;
+        MalType* value;
+        bool isMacro;
+    };
+
+    class MapNode : public MalNode {
+    public:
+        MapNode(MalType* form, vector < MalType * > k, vector < MalType * > v)
+        : MalNode(MapKind, form), keys {k}, values {v} { }
+
+        GCObject* relocate() {
+            return new MapNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            for (auto& key : keys)
+                GC::visit(key);
+            for (auto& value : values)
+                GC::visit(value);
+        }
+
+        vector < MalType * > keys;
+        vector < MalType * > values;
+    };
+
+    // a call with a keyword at its head, (:k m) or (:k m default).
+    // slot caches where the keyword was in the last map it looked in (see Core::keywordGet)
+    class KeyNode : public MalNode {
+    public:
+        KeyNode(MalType* form, MalType* k, vector < MalType * > a)
+        : MalNode(KeyKind, form), key {k}, args {a} { }
+
+        GCObject* relocate() {
+            return new KeyNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            for (auto& arg : args)
+                GC::visit(arg);
+        }
+
+        // interned, so it never moves and needs no tracing
+        MalType* key;
+        vector < MalType * > args;
+        size_t slot { 0 };
+    };
+
+    // a macro call. it gets expanded (and the expansion compiled) the first time it runs,
+    // and again only once a macro has been defined or redefined since (see Core::macroEpoch).
+    // only for calls whose arguments are literals (see Core::isLiteral): the others go
+    // to EVAL, which expands them every time
+    class MacroNode : public MalNode {
+    public:
+        MacroNode(MalType* form) : MalNode(MacroKind, form) { }
+
+        GCObject* relocate() {
+            return new MacroNode(std::move(*this));
+        }
+
+        void trace() {
+            MalNode::trace();
+            GC::visit(expansion);
+        }
+
+        void remember(MalType* e, size_t at) {
+            GC::writeBarrier(this, e);
+            expansion = e;
+            epoch = at;
+        }
+
+        MalType* expansion { NULL };
+        size_t epoch { 0 };
+    };
+
+    class FormNode : public MalNode {
+    public:
+        FormNode(MalType* form) : MalNode(FormKind, form) { }
+
+        GCObject* relocate() {
+            return new FormNode(std::move(*this));
+        }
+    };
+
+    MalType* compile(MalType* form);
+
+    vector < MalType * > compileAll(vector < MalType * >& items, size_t from) {
+        vector < MalType * > res;
+        res.reserve(items.size() - from);
+        for (size_t i = from; items.size() > i; ++i)
+            res.push_back(compile(items[i]));
+        return res;
+    }
+
+    // (let* bindings body)
+    MalType* compileLet(MalType* form, vector < MalType * >& items) {
+        if (items.size() != 3 || !Core::typeChecksOneOf(typeOf(items[1]), List, Vector))
+            return new FormNode(form);
+        auto bindings = items[1]->as_sequence()->items();
+        if (bindings.size() % 2 != 0)
+            return new FormNode(form);
+
+        vector < MalType * > keys;
+        vector < MalType * > values;
+        for (size_t i = 0; bindings.size() > i; i += 2) {
+            if (typeOf(bindings[i]) != Symbol)
+                return new FormNode(form);
+            keys.push_back(bindings[i]);
+            values.push_back(compile(bindings[i+1]));
+        }
+        return new LetNode(form, keys, values, compile(items[2]));
+    }
+
+    // (cond [cond body]...)
+    MalType* compileCond(MalType* form, vector < MalType * >& items) {
+        if (items.size() < 2)
+            return new FormNode(form);
+
+        vector < MalType * > conds;
+        vector < MalType * > bodies;
+        for (size_t i = 1; items.size() > i; ++i) {
+            if (!Core::typeChecksOneOf(typeOf(items[i]), List, Vector))
+                return new FormNode(form);
+            auto seq = items[i]->as_sequence()->items();
+            if (seq.size() != 2)
+                return new FormNode(form);
+            conds.push_back(compile(seq[0]));
+            bodies.push_back(compile(seq[1]));
+        }
+        return new CondNode(form, conds, bodies);
+    }
+
+    // (fn* params body), or what the resolver turned it into
+    MalType* compileFn(MalType* form, vector < MalType * >& items) {
+        // an fn* the resolver didn't get to has nothing resolved in it yet
+        bool flat = items.size() == 4;
+        if (items[0] != Resolver::RESOLVED_FN || (items.size() != 3 && !flat)
+            || !Core::typeChecksOneOf(typeOf(items[1]), List, Vector))
+            return new FormNode(form);
+
+        auto fn_params = items[1]->as_sequence()->items();
+        vector < MalType * > params;
+        bool variadic = false;
+        for (size_t i = 0; fn_params.size() > i; ++i) {
+            auto item = fn_params[i];
+            if (typeOf(item) != Symbol)
+                return new FormNode(form);
+            if (inspectOf(item) == "&") {
+                if (i + 2 != fn_params.size())
+                    return new FormNode(form);
+                variadic = true;
+                continue;
+            }
+            if (find(params.begin(), params.end(), item) != params.end())
+                return new FormNode(form);
+            params.push_back(item);
+        }
+        return new FnNode(form, params, variadic, compile(items[2]), flat ? items[3] : NULL);
+    }
+
+    MalType* compileList(MalList* form) {
+        auto items = form->items();
+        if (items.empty())
+            return new ConstNode(form, form);
+
+        auto head = items[0];
+        if (typeOf(head) == Symbol) {
+            if (head == QUOTE) {
+                if (items.size() != 2)
+                    return new FormNode(form);
+                return new ConstNode(form, items[1]);
+            } else if (head == IF) {
+                if (items.size() < 3 || items.size() > 4)
+                    return new FormNode(form);
+                auto otherwise = items.size() == 4 ? compile(items[3]) : MAL_NIL;
+                return new IfNode(form, compile(items[1]), compile(items[2]), otherwise);
+            } else if (head == DO) {
+                if (items.size() < 2)
+                    return new FormNode(form);
+                return new ListNode(MalNode::DoKind, form, compileAll(items, 1));
+            } else if (head == LET) {
+                return compileLet(form, items);
+            } else if (head == COND) {
+                return compileCond(form, items);
+            } else if (head == FN_STAR || head == Resolver::RESOLVED_FN) {
+                return compileFn(form, items);
+            } else if (head == DEF || head == DEFMACRO) {
+                // def! with multiple bindings stays with EVAL
+                if (items.size() != 3 || typeOf(items[1]) != Symbol)
+                    return new FormNode(form);
+                return new DefNode(form, items[1], compile(items[2]), head == DEFMACRO);
+            } else if (head == IF_LET || head == MATCH || head == QUASIQUOTE || head == QUASIQUOTEEXPAND
+                       || head == TIME || head == MACROEXPAND || head == TRY) {
+                return new FormNode(form);
+            }
+        }
+
+        // macros get expanded when the form first runs
+        MalType* call_args[1] { form };
+        if (Core::isMacroCall(call_args, 1) == CONSTANTS["true"]) {
+            if (!Core::literalArgs(form))
+                return new FormNode(form);
+            return new MacroNode(form);
+        }
+        if (typeOf(head) == Keyword && (items.size() == 2 || items.size() == 3)
+            && none_of(items.begin(), items.end(), [](MalType* item) { return typeOf(item) == Spreader; }))
+            return new KeyNode(form, head, compileAll(items, 1));
+        return new ListNode(MalNode::CallKind, form, compileAll(items, 0));
+    }
+
+    MalType* compile(MalType* form) {
+        switch (typeOf(form)) {
+            case List:
+                return compileList(form->as_list());
+            case Vector: {
+                auto items = form->as_vector()->items();
+                return new ListNode(MalNode::VectorKind, form, compileAll(items, 0));
+            }
+            case HashMap: {
+                vector < MalType * > keys;
+                vector < MalType * > values;
+                for (auto& entry : *form->as_hashmap()) {
+                    keys.push_back(entry.key);
+                    values.push_back(compile(entry.value));
+                }
+                return new MapNode(form, keys, values);
+            }
+            default:
+                // variables, and values that evaluate to themselves
+                return form;
+        }
+    }
+}
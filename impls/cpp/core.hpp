@@ -3,11 +3,21 @@
 #include <map>
 #include <string>
 #include <cmath>
+#include <climits>
 #include <fstream>
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 #include "mal_types.hpp"
 #include "printer.hpp"
 #include "reader.hpp"
 #include "env.hpp"
+#include "profile.hpp"
 
 using namespace std;
 
@@ -20,6 +30,10 @@ Environ* TOP_LEVEL = new Environ(NULL);
 // EVAL used by eval
 MalType * eval_ast(MalType * ast, Environ* curEnv);
 MalType * EVAL(MalType *, Environ* curEnv);
+// load-file, defined in modules.hpp
+namespace Modules {
+    MalType* load(const string& path);
+}
 
 namespace Core {
     using BuiltIns = map < string, Function >;
@@ -43,6 +57,33 @@ namespace Core {
         }
         return false;
     }
+
+    // ints are 64 bits, and a result that doesn't fit in them is an error rather than wrapping around
+    void overflowed(const string& op) {
+        auto runExcep = RuntimeException();
+        runExcep.errMessage = "integer overflow in '" + op + "'.";
+        throw runExcep;
+    }
+
+    // base to the power of exp, for '**'. a negative exp gives what truncating the fraction would
+    long power(long base, long exp) {
+        if (exp < 0) {
+            if (base == 0)
+                overflowed("**");
+            if (base == 1 || base == -1)
+                return (exp % 2 == 0) ? 1 : base;
+            return 0;
+        }
+        long result = 1;
+        while (exp > 0) {
+            if ((exp & 1) && __builtin_mul_overflow(result, base, &result))
+                overflowed("**");
+            exp >>= 1;
+            if (exp > 0 && __builtin_mul_overflow(base, base, &base))
+                overflowed("**");
+        }
+        return result;
+    }
     
     MalType* add(MalType** args, size_t argc) {
         if (argc < 2) {
@@ -55,26 +96,27 @@ namespace Core {
         // to set the precedence, else throw on
         // type deviation
         auto f = args[0];
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
             long sum = 0;
             for (int i = 0; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    sum += rhs->as_int()->to_long();
+                if (typeCheck(typeOf(rhs), Int)) {
+                    if (__builtin_add_overflow(sum, toLong(rhs), &sum))
+                        overflowed("+");
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'+' not defined for operands of varying types.";
                     throw typeExcep;
                 }
             }
-            return new MalInt(sum);
+            return makeInt(sum);
         } else if (calcType == String) {
             string res = "";
             for (int i = 0; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), String)) {
+                if (typeCheck(typeOf(rhs), String)) {
                     res += rhs->as_string()->content();
                 } else {
                     auto typeExcep = TypeException();
@@ -101,17 +143,19 @@ namespace Core {
         // to set the precedence, else throw on
         // type deviation
         auto f = args[0];
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long diff = f->as_int()->to_long();
+            long diff = toLong(f);
             if (argc == 1) {
-                diff = -diff;
+                if (__builtin_sub_overflow(0, diff, &diff))
+                    overflowed("-");
             } else {
                 for (int i = 1; argc > i; ++i) {
                     auto rhs = args[i];
-                    if (typeCheck(rhs->type(), Int)) {
-                        diff -= rhs->as_int()->to_long();
+                    if (typeCheck(typeOf(rhs), Int)) {
+                        if (__builtin_sub_overflow(diff, toLong(rhs), &diff))
+                            overflowed("-");
                     } else {
                         auto typeExcep = TypeException();
                         typeExcep.errMessage = "'-' not defined for operands of varying types.";
@@ -119,7 +163,7 @@ namespace Core {
                     }
                 }
             }
-            return new MalInt(diff);
+            return makeInt(diff);
         } else {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'-' not defined for operands.";
@@ -138,21 +182,22 @@ namespace Core {
         // to set the precedence, else throw on
         // type deviation
         auto f = args[0];
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long prod = f->as_int()->to_long();
+            long prod = toLong(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    prod *= rhs->as_int()->to_long();
+                if (typeCheck(typeOf(rhs), Int)) {
+                    if (__builtin_mul_overflow(prod, toLong(rhs), &prod))
+                        overflowed("*");
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'*' not defined for operands of varying types.";
                     throw typeExcep;
                 }
             }
-            return new MalInt(prod);
+            return makeInt(prod);
         } else {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'*' not defined for operands.";
@@ -171,26 +216,29 @@ namespace Core {
         // to set the precedence, else throw on
         // type deviation
         auto f = args[0];
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long div_a = f->as_int()->to_long();
+            long div_a = toLong(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    if (rhs->as_int()->to_long() == 0) {
+                if (typeCheck(typeOf(rhs), Int)) {
+                    if (toLong(rhs) == 0) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "division by 0 is illegal.";
                         throw runExcep;
                     }
-                    div_a /= rhs->as_int()->to_long();
+                    // the one quotient that doesn't fit
+                    if (div_a == LONG_MIN && toLong(rhs) == -1)
+                        overflowed("/");
+                    div_a /= toLong(rhs);
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'/' not defined for operands of varying types.";
                     throw typeExcep;
                 }
             }
-            return new MalInt(div_a);
+            return makeInt(div_a);
         } else {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'/' not defined for operands.";
@@ -209,26 +257,27 @@ namespace Core {
         // to set the precedence, else throw on
         // type deviation
         auto f = args[0];
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long mod_a = f->as_int()->to_long();
+            long mod_a = toLong(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    if (rhs->as_int()->to_long() == 0) {
+                if (typeCheck(typeOf(rhs), Int)) {
+                    if (toLong(rhs) == 0) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "modulo by 0 is illegal.";
                         throw runExcep;
                     }
-                    mod_a %= rhs->as_int()->to_long();
+                    // which the hardware traps on, like LONG_MIN / -1
+                    mod_a = toLong(rhs) == -1 ? 0 : mod_a % toLong(rhs);
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'%' not defined for operands of varying types.";
                     throw typeExcep;
                 }
             }
-            return new MalInt(mod_a);
+            return makeInt(mod_a);
         } else {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'%' not defined for operands.";
@@ -247,14 +296,14 @@ namespace Core {
         // to set the precedence, else throw on
         // type deviation
         auto f = args[0];
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Boolean) {
-            bool first = f->as_boolean()->val();
+            bool first = toBool(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Boolean)) {
-                    first = first || rhs->as_boolean()->val();
+                if (typeCheck(typeOf(rhs), Boolean)) {
+                    first = first || toBool(rhs);
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'or' not defined for operands of varying types.";
@@ -280,14 +329,14 @@ namespace Core {
         // to set the precedence, else throw on
         // type deviation
         auto f = args[0];
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Boolean) {
-            bool first = f->as_boolean()->val();
+            bool first = toBool(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Boolean)) {
-                    first = first && rhs->as_boolean()->val();
+                if (typeCheck(typeOf(rhs), Boolean)) {
+                    first = first && toBool(rhs);
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'and' not defined for operands of varying types.";
@@ -313,21 +362,21 @@ namespace Core {
         // to set the precedence, else throw on
         // type deviation
         auto f = args[0];
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long pow_a = f->as_int()->to_long();
+            long pow_a = toLong(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    pow_a = pow(pow_a, rhs->as_int()->to_long());
+                if (typeCheck(typeOf(rhs), Int)) {
+                    pow_a = power(pow_a, toLong(rhs));
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'**' not defined for operands of varying types.";
                     throw typeExcep;
                 }
             }
-            return new MalInt(pow_a);
+            return makeInt(pow_a);
         } else {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'**' not defined for operands.";
@@ -353,14 +402,17 @@ namespace Core {
         auto lhs = args[0];
         auto rhs = args[1];
 
-        // allow prepending to list or a vector
-        if (typeChecksOneOf(rhs->type(), List, Vector)) {
+        // a new cell in front of a list shares all of it
+        if (typeOf(rhs) == List)
+            return new MalList(lhs, rhs->as_list());
+
+        // allow prepending to a vector
+        if (typeOf(rhs) == Vector) {
             auto newSeq = new MalList;
             auto seq = newSeq->as_sequence();
             seq->append(lhs); // add first item
 
-            auto rhsItems = rhs->as_sequence()->items();
-            for (auto item : rhsItems) { // add rhs's items to new sequence
+            for (auto item : *rhs->as_sequence()) { // add rhs's items to new sequence
                 seq->append(item);
             }
             return newSeq;
@@ -368,6 +420,37 @@ namespace Core {
         return new MalPair(lhs, rhs);
     }
 
+    // adds items where it's cheap: in front of a list (one at a time, so they end up reversed),
+    // at the end of a vector. both share the original instead of copying it
+    MalType* conj(MalType** args, size_t argc) {
+        if (argc < 1) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'conj' requires at least 1 argument.";
+            throw runExcep;
+        }
+
+        auto coll = args[0];
+        switch (typeOf(coll)) {
+            case List: {
+                auto res = coll->as_list();
+                for (int i = 1; argc > i; ++i)
+                    res = new MalList(args[i], res);
+                return res;
+            }
+            case Vector: {
+                auto res = coll->as_vector();
+                for (int i = 1; argc > i; ++i)
+                    res = res->conj(args[i]);
+                return res;
+            }
+            default: {
+                auto typeExcep = TypeException();
+                typeExcep.errMessage = "'conj' requires a List|Vector as it's first argument.";
+                throw typeExcep;
+            }
+        }
+    }
+
     MalType* isList(MalType** args, size_t argc) {
         if (argc != 1) {
             auto runExcep = RuntimeException();
@@ -375,7 +458,7 @@ namespace Core {
             throw runExcep;
         }
 
-        return args[0]->type() == List ? CONSTANTS["true"] : CONSTANTS["false"];
+        return typeOf(args[0]) == List ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     MalType* isPair(MalType** args, size_t argc) {
@@ -385,7 +468,7 @@ namespace Core {
                 throw runExcep;
         }
 
-        return args[0]->type() == Pair ? CONSTANTS["true"] : CONSTANTS["false"];
+        return typeOf(args[0]) == Pair ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     MalType* isVector(MalType** args, size_t argc) {
@@ -395,7 +478,7 @@ namespace Core {
             throw runExcep;
         }
 
-        return args[0]->type() == Vector ? CONSTANTS["true"] : CONSTANTS["false"];
+        return typeOf(args[0]) == Vector ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     MalType* isSequence(MalType** args, size_t argc) {
@@ -407,7 +490,7 @@ namespace Core {
 
         auto item = args[0];
         vector < Type > types { List, Vector, Pair };
-        if (!typeChecksOneFrom(item->type(), types)) {
+        if (!typeChecksOneFrom(typeOf(item), types)) {
             return CONSTANTS["false"];
         }
         return CONSTANTS["true"];
@@ -422,12 +505,8 @@ namespace Core {
 
         auto item = args[0];
         bool isEmpty = true;
-        if (item->type() == List) {
-            auto list = item->as_list()->items();
-            isEmpty = list.empty();
-        } else if (item->type() == Vector) {
-            auto vec = item->as_vector()->items();
-            isEmpty = vec.empty();            
+        if (typeChecksOneOf(typeOf(item), List, Vector)) {
+            isEmpty = item->as_sequence()->empty();
         }
         return isEmpty ? CONSTANTS["true"] : CONSTANTS["false"];
     }
@@ -441,43 +520,17 @@ namespace Core {
 
         auto item = args[0];
         size_t count = 0;
-        if (item->type() == List) {
-            auto list = item->as_list()->items();
-            count = list.size();
-        } else if (item->type() == Vector) {
-            auto vec = item->as_vector()->items();
-            count = vec.size();            
-        } else if (item->type() == String) {
+        if (typeChecksOneOf(typeOf(item), List, Vector)) {
+            count = item->as_sequence()->count();
+        } else if (typeOf(item) == String) {
             auto str = item->as_string()->content();
             count = str.size();
-        } else if (item->type() == Nil) {
+        } else if (typeOf(item) == Nil) {
             count = 0;
         } else {
             count = 1;
         }
-        return new MalInt(count);
-    }
-
-    bool compareSequenceItems(vector <MalType* > A, vector < MalType* > B) {
-        if (A.size() != B.size()) {
-            return false;
-        }
-
-        for (int i = 0; A.size() > i; ++i) {
-            auto l = A[i];
-            auto r = B[i];
-
-            if (typeChecksOneOf(l->type(), List, Vector) && typeChecksOneOf(r->type(), List, Vector)) {
-                auto l_con = l->as_sequence()->contents(false);
-                auto r_con = r->as_sequence()->contents(false);
-                if (l_con != r_con)
-                    return false;
-            } else {
-                if (A[i]->inspect() != B[i]->inspect())
-                    return false;
-            }
-        }
-        return true;
+        return makeInt(count);
     }
 
     // TODO: make variadic when I'm bored
@@ -488,74 +541,8 @@ namespace Core {
             throw runExcep;
         }
 
-        auto l = args[0];
-        auto r = args[1];
-
-        bool equal = false;
-        if (typeCheck(l->type(), r->type())) {
-            switch (l->type()) {
-                case Nil:
-                    return CONSTANTS["true"];
-                case Boolean: {
-                    equal = l->as_boolean()->val() == r->as_boolean()->val();
-                    break;
-                }
-                case Int: {
-                    equal = l->as_int()->to_long() == r->as_int()->to_long();
-                    break;
-                }
-                case Keyword: {
-                    equal = l->as_keyword()->inspect() == r->as_keyword()->inspect();
-                    break;
-                }
-                case String: {
-                    equal = l->as_string()->content() == r->as_string()->content();
-                    break;
-                }
-                case Symbol: {
-                    equal = l->as_symbol()->str() == r->as_symbol()->str();
-                    break;
-                }
-                case List:
-                case Vector:
-                case Func:
-                case Pair:
-                case HashMap: {
-                    equal = l->inspect() == r->inspect();
-                    break;
-                }
-                default: 
-                    equal = false;
-            }
-        } else if (typeChecksOneOf(l->type(), List, Vector) && typeChecksOneOf(r->type(), List, Vector)) {
-            if (typeCheck(l->type(), List)) { // l is List so r is a Vector
-                auto lhs = l->as_list();
-                auto rhs = r->as_vector();
-                if (lhs->items().size() != rhs->items().size()) {
-                    equal = false;
-                } else if (lhs->items().size() == 0 && rhs->items().size() == 0) {
-                    equal = true;
-                } else {
-                    auto litems = lhs->items();
-                    auto ritems = rhs->items();
-                    equal = compareSequenceItems(litems, ritems);
-                }
-            } else { // l is a Vector and r is a List
-                auto lhs = l->as_vector();
-                auto rhs = r->as_list();
-
-                if (lhs->items().size() != rhs->items().size()) {
-                    equal = false;
-                } else if (lhs->items().size() == 0 && rhs->items().size() == 0) {
-                    equal = true;
-                } else {
-                    auto litems = lhs->items();
-                    auto ritems = rhs->items();
-                    equal = compareSequenceItems(litems, ritems);
-                }
-            }
-        }
-        return equal ? CONSTANTS["true"] : CONSTANTS["false"];
+        // structural, see MalType::equals
+        return equalsOf(args[0], args[1]) ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     // implement it for a single list or vector argument:
@@ -575,20 +562,20 @@ namespace Core {
         // type deviation
         auto f = args[0];
         bool lthan = false;
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long lhs = f->as_int()->to_long();
+            long lhs = toLong(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    lthan = lhs < rhs->as_int()->to_long();
+                if (typeCheck(typeOf(rhs), Int)) {
+                    lthan = lhs < toLong(rhs);
                     // if we examine any pair that returns false, 
                     // end the calculation there
                     if (!lthan) { 
                         break;
                     }
-                    lhs = rhs->as_int()->to_long();
+                    lhs = toLong(rhs);
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'<' not defined for operands of varying types.";
@@ -615,20 +602,20 @@ namespace Core {
         // type deviation
         auto f = args[0];
         bool lthan_eq = false;
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long lhs = f->as_int()->to_long();
+            long lhs = toLong(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    lthan_eq = lhs <= rhs->as_int()->to_long();
+                if (typeCheck(typeOf(rhs), Int)) {
+                    lthan_eq = lhs <= toLong(rhs);
                     // if we examine any pair that returns false, 
                     // end the calculation there
                     if (!lthan_eq) { 
                         break;
                     }
-                    lhs = rhs->as_int()->to_long();
+                    lhs = toLong(rhs);
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'<=' not defined for operands of varying types.";
@@ -655,20 +642,20 @@ namespace Core {
         // type deviation
         auto f = args[0];
         bool gthan = false;
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long lhs = f->as_int()->to_long();
+            long lhs = toLong(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    gthan = lhs > rhs->as_int()->to_long();
+                if (typeCheck(typeOf(rhs), Int)) {
+                    gthan = lhs > toLong(rhs);
                     // if we examine any pair that returns false, 
                     // end the calculation there
                     if (!gthan) { 
                         break;
                     }
-                    lhs = rhs->as_int()->to_long();
+                    lhs = toLong(rhs);
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'<' not defined for operands of varying types.";
@@ -695,20 +682,20 @@ namespace Core {
         // type deviation
         auto f = args[0];
         bool gthan_eq = false;
-        Type calcType = f->type();
+        Type calcType = typeOf(f);
 
         if (calcType == Int) {
-            long lhs = f->as_int()->to_long();
+            long lhs = toLong(f);
             for (int i = 1; argc > i; ++i) {
                 auto rhs = args[i];
-                if (typeCheck(rhs->type(), Int)) {
-                    gthan_eq = lhs >= rhs->as_int()->to_long();
+                if (typeCheck(typeOf(rhs), Int)) {
+                    gthan_eq = lhs >= toLong(rhs);
                     // if we examine any pair that returns false, 
                     // end the calculation there
                     if (!gthan_eq) { 
                         break;
                     }
-                    lhs = rhs->as_int()->to_long();
+                    lhs = toLong(rhs);
                 } else {
                     auto typeExcep = TypeException();
                     typeExcep.errMessage = "'>=' not defined for operands of varying types.";
@@ -723,47 +710,113 @@ namespace Core {
         }
     }
 
-    MalType* pr__str(MalType** args, size_t argc) { 
-        string out = "";
-        for (int i = 0; argc > i; ++i) {
-            out += pr_str(args[i]);
-            if (i < argc && i + 1 != argc) {
-                out += " ";
+    // stdout, for prn, println and the REPL. what gets written collects in a buffer that goes out
+    // in one write when it fills up, on (flush), and when the program ends. line buffered,
+    // it also goes out at the end of every line, for a REPL (or someone watching a script run)
+    class Output {
+    public:
+        // flushed once this much has collected
+        static const size_t SIZE = 64 * 1024;
+
+        bool lineBuffered { false };
+
+        Output(int f) : fd {f} {
+            pending.reserve(SIZE);
+        }
+
+        ~Output() {
+            flush();
+        }
+
+        // for printing straight into the buffer. call written() after
+        string& buffer() {
+            return pending;
+        }
+
+        void written() {
+            if (pending.size() >= SIZE || (lineBuffered && !pending.empty() && pending.back() == '\n'))
+                flush();
+        }
+
+        void write(string_view text) {
+            pending += text;
+            written();
+        }
+
+        void flush() {
+            size_t done = 0;
+            while (done < pending.size()) {
+                auto count = ::write(fd, pending.data() + done, pending.size() - done);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                // nowhere to write it (a closed pipe, say): drop it, like a failed cout would
+                if (count <= 0)
+                    break;
+                done += count;
             }
+            pending.clear();
         }
+
+    private:
+        int fd;
+        string pending;
+    };
+
+    Output output(STDOUT_FILENO);
+
+    // what pr-str, str, prn and println print: args, each printed straight into out
+    void printArgs(string& out, MalType** args, size_t argc, bool readably, const char* separator) {
+        for (int i = 0; argc > i; ++i) {
+            if (i != 0)
+                out += separator;
+            pr_str(out, args[i], NULL, readably);
+        }
+    }
+
+    MalType* pr__str(MalType** args, size_t argc) { 
+        string out;
+        printArgs(out, args, argc, true, " ");
         return new MalString(out);
     }
 
     MalType* str(MalType** args, size_t argc) { 
-        string out = "";
-        for (int i = 0; argc > i; ++i) {
-            out += pr_str(args[i], NULL, false);
-            if (i < argc && i + 1 != argc) {
-                out += "";
-            }
-        }
+        string out;
+        printArgs(out, args, argc, false, "");
         return new MalString(out);
     }
 
-    MalType* prn(MalType** args, size_t argc) {
-        for (int i = 0; argc > i; ++i) {
-            cout << pr_str(args[i]);
-            if (i < argc && i + 1 != argc) {
-                cout << " ";
-            }
+    // prn and println: a line, printed straight into output's buffer.
+    // none of it is kept if printing fails part of the way through
+    void printLine(MalType** args, size_t argc, bool readably) {
+        auto& out = output.buffer();
+        auto start = out.size();
+        try {
+            printArgs(out, args, argc, readably, " ");
+        } catch (...) {
+            out.resize(start);
+            throw;
         }
-        cout << "\n";
+        out += '\n';
+        output.written();
+    }
+
+    MalType* prn(MalType** args, size_t argc) {
+        printLine(args, argc, true);
         return CONSTANTS["nil"];
     }
 
     MalType* println(MalType** args, size_t argc) { 
-        for (int i = 0; argc > i; ++i) {
-            cout << pr_str(args[i], NULL, false);
-            if (i < argc && i + 1 != argc) {
-                cout << " ";
-            }
+        printLine(args, argc, false);
+        return CONSTANTS["nil"];
+    }
+
+    MalType* flush(MalType** args, size_t argc) {
+        if (argc != 0) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'flush' requires no arguments.";
+            throw runExcep;
         }
-        cout << "\n";
+        output.flush();
         return CONSTANTS["nil"];
     }
 
@@ -776,18 +829,18 @@ namespace Core {
         }
 
         auto arg = args[0];
-        if (typeChecksOneOf(arg->type(), List, Vector)) {
+        if (typeChecksOneOf(typeOf(arg), List, Vector)) {
             auto seq = arg->as_sequence();
-            if (seq->items().size() >= 1)
-                return seq->items()[0];
+            if (!seq->empty())
+                return seq->at(0);
             else
                 return CONSTANTS["nil"];
-        } else if (typeCheck(arg->type(), Pair)) {
+        } else if (typeCheck(typeOf(arg), Pair)) {
             auto pair = arg->as_pair();
             // we already know that pair will not be constructed
             // unless 2 MalTypes are provided as lhs and rhs of its
             // construction
-            return pair->items()[0];
+            return pair->at(0);
         } else {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'first' not defined for non-sequential operands.";
@@ -804,24 +857,28 @@ namespace Core {
         }
 
         auto arg = args[0];
-        if (typeChecksOneOf(arg->type(), List, Vector)) {
-            switch(arg->type()) {
+        if (typeChecksOneOf(typeOf(arg), List, Vector)) {
+            auto seq = arg->as_sequence();
+            if (seq->empty())
+                return new MalList;
+            switch(typeOf(arg)) {
                 case List:
+                    // the list that's already there after the first cell
+                    return arg->as_list()->rest();
                 default: { // default is Vector
-                    auto seq = arg->as_sequence()->items();
-                    if (seq.size() > 1) {
-                        auto rest = vector < MalType * >(seq.begin() + 1, seq.end());
-                        return new MalList(rest);
-                    }
-                    return new MalList;
+                    auto rest = new MalList;
+                    auto item = seq->begin();
+                    for (++item; item != seq->end(); ++item)
+                        rest->append(*item);
+                    return rest;
                 }
             }
-        } else if (typeCheck(arg->type(), Pair)) {
+        } else if (typeCheck(typeOf(arg), Pair)) {
             auto pair = arg->as_pair();
             // we already know that pair will not be constructed
             // unless 2 MalTypes are provided as lhs and rhs of its
             // construction
-            return pair->items()[1];
+            return pair->at(1);
         } else {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'rest' not defined for non-sequential operands.";
@@ -840,28 +897,28 @@ namespace Core {
         auto b = args[1];
 
         vector < Type > atypes { List, Vector, Pair };
-        if (!typeChecksOneFrom(a->type(), atypes)) {
+        if (!typeChecksOneFrom(typeOf(a), atypes)) {
             auto e = TypeException();
             e.errMessage = "'nth' requires a Sequence as its first argument.\n";
-            e.errMessage += "'" + a->inspect() + "' is not a Sequence.";
+            e.errMessage += "'" + inspectOf(a) + "' is not a Sequence.";
             throw e;
         }
         
-        if (!typeCheck(b->type(), Int)) {
+        if (!typeCheck(typeOf(b), Int)) {
             auto e = TypeException();
             e.errMessage = "'nth' requires an Int as its second argument.\n";
-            e.errMessage += "'" + b->inspect() + "' is not an Int.";
+            e.errMessage += "'" + inspectOf(b) + "' is not an Int.";
             throw e;
         }
-        auto seq = a->as_sequence()->items();
-        auto index = b->as_int()->to_long();
-        long size = seq.size();
+        auto seq = a->as_sequence();
+        auto index = toLong(b);
+        long size = seq->count();
 
         if (index >= size) {
             auto e = RuntimeException();
             e.errMessage = to_string(index) + " is out of bounds. ";
-            e.errMessage += a->inspect() + " has " + to_string(seq.size()) + " items.\n";
-            e.errMessage += "indexing starts at 0 and ends at " + to_string(seq.size() - 1) + ".";
+            e.errMessage += inspectOf(a) + " has " + to_string(size) + " items.\n";
+            e.errMessage += "indexing starts at 0 and ends at " + to_string(size - 1) + ".";
             throw e;
         }
 
@@ -875,13 +932,13 @@ namespace Core {
             if (r_index < 0) {
                 auto e = RuntimeException();
                 e.errMessage = to_string(index) + " is out of bounds, as it maps to " + to_string(r_index) + ". ";
-                e.errMessage += a->inspect() + " has " + to_string(seq.size()) + " items.\n";
-                e.errMessage += "indexing starts at 0 and ends at " + to_string(seq.size() - 1) + ".";
+                e.errMessage += inspectOf(a) + " has " + to_string(size) + " items.\n";
+                e.errMessage += "indexing starts at 0 and ends at " + to_string(size - 1) + ".";
                 throw e;
             }
-            return seq[r_index];
+            return seq->at(r_index);
         }
-        return seq[index];
+        return seq->at(index);
     }
 
     MalType* newline(MalType** args, size_t argc) { 
@@ -904,7 +961,7 @@ namespace Core {
         }
         auto item = args[0];
         // make sure argument is a String
-        if (!typeCheck(item->type(), String)) {
+        if (!typeCheck(typeOf(item), String)) {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'read-string' only takes a String argument.";
             throw typeExcep;
@@ -914,6 +971,78 @@ namespace Core {
         return res;
     }
 
+    // a file's contents, mapped into memory for as long as this is around
+    class MappedFile {
+    public:
+        MappedFile(const string& path) {
+            auto fd = open(path.c_str(), O_RDONLY);
+            struct stat info;
+            if (fd < 0 || fstat(fd, &info) != 0) {
+                auto err = errno;
+                if (fd >= 0)
+                    close(fd);
+                throw system_error(err, system_category(), "unable to open " + path);
+            }
+            if (!S_ISREG(info.st_mode)) {
+                // pipes and the like can't be mapped, they get read instead. a
+                // directory reads as empty, like it did through an ifstream
+                readAll(fd, path);
+                close(fd);
+                return;
+            }
+            m_size = info.st_size;
+            // an empty file can't be mapped, and doesn't need to be
+            if (m_size > 0) {
+                auto mapped = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED) {
+                    auto err = errno;
+                    close(fd);
+                    throw system_error(err, system_category(), "unable to read " + path);
+                }
+                m_data = static_cast< const char* >(mapped);
+                // it gets read front to back
+                madvise(mapped, m_size, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+
+        ~MappedFile() {
+            if (m_data != NULL)
+                munmap((void*) m_data, m_size);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+
+        string_view text() {
+            if (m_data == NULL)
+                return m_buffer;
+            return string_view(m_data, m_size);
+        }
+
+    private:
+        void readAll(int fd, const string& path) {
+            char chunk[65536];
+            for (;;) {
+                auto got = read(fd, chunk, sizeof(chunk));
+                if (got == 0 || (got < 0 && errno == EISDIR))
+                    return;
+                if (got < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    auto err = errno;
+                    close(fd);
+                    throw system_error(err, system_category(), "unable to read " + path);
+                }
+                m_buffer.append(chunk, got);
+            }
+        }
+
+        const char* m_data { NULL };
+        size_t m_size { 0 };
+        // what was read, for a file that isn't mapped
+        string m_buffer;
+    };
+
     MalType* slurp(MalType** args, size_t argc) { 
         if (argc != 1) {
             auto runExcep = RuntimeException();
@@ -922,30 +1051,43 @@ namespace Core {
         }
         auto item = args[0];
         // make sure argument is a String
-        if (!typeCheck(item->type(), String)) {
+        if (!typeCheck(typeOf(item), String)) {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'slurp' only takes a String argument.";
             throw typeExcep;
         }
         auto path = item->as_string()->inspect(false);
-        // read file using a closure
-        auto fileReader = [&, path]() {
-            ifstream file(path);
-            if (!file.is_open()) {
-                throw system_error(errno, system_category(), "unable to open " + path);
-            }
-
-            string content = "";
-            string line;
-            while(getline(file, line)) {
-                content += line + "\\n"; // add back the stripped newline character
-            }
-
-            // cout << content << endl;
-            return content;
-        };
-        auto src = fileReader();
-        return new MalString(src);
+        MappedFile file(path);
+        auto text = file.text();
+        // every line ends with an (escaped, like the reader leaves them) newline
+        string content;
+        content.reserve(text.size() + text.size() / 16 + 2);
+        size_t start = 0;
+        while (start < text.size()) {
+            auto end = text.find('\n', start);
+            if (end == string_view::npos)
+                end = text.size();
+            content.append(text.substr(start, end - start));
+            content += "\\n";
+            start = end + 1;
+        }
+        return new MalString(content);
+    }
+
+    // reads and runs the forms in a file one at a time, in TOP_LEVEL (see modules.hpp)
+    MalType* loadFile(MalType** args, size_t argc) {
+        if (argc != 1) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'load-file' requires 1 argument.";
+            throw runExcep;
+        }
+        auto item = args[0];
+        if (!typeCheck(typeOf(item), String)) {
+            auto typeExcep = TypeException();
+            typeExcep.errMessage = "'load-file' only takes a String argument.";
+            throw typeExcep;
+        }
+        return Modules::load(item->as_string()->inspect(false));
     }
 
     MalType* eval(MalType** args, size_t argc) { 
@@ -968,9 +1110,7 @@ namespace Core {
         }
 
         auto obj = args[0];
-        auto atom = new MalAtom(obj);
-        atom->setName("(atom " + obj->inspect() + ")");
-        return atom;
+        return new MalAtom(obj);
     }
 
     MalType* isAtom(MalType** args, size_t argc) {
@@ -980,7 +1120,7 @@ namespace Core {
             throw runExcep;
         }
         auto item = args[0];
-        return item->type() == Atom ? CONSTANTS["true"] : CONSTANTS["false"];
+        return typeOf(item) == Atom ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     MalType* deref(MalType** args, size_t argc) {
@@ -991,7 +1131,7 @@ namespace Core {
         }
 
         auto item = args[0];
-        if (!typeCheck(item->type(), Atom)) {
+        if (!typeCheck(typeOf(item), Atom)) {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'deref' only takes an Atom argument.";
             throw typeExcep;
@@ -1008,7 +1148,7 @@ namespace Core {
         }
 
         auto item = args[0];
-        if (!typeCheck(item->type(), Atom)) {
+        if (!typeCheck(typeOf(item), Atom)) {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'deref' only takes an Atom argument.";
             throw typeExcep;
@@ -1031,20 +1171,22 @@ namespace Core {
         // have to make sure we have at least the atom and fn
         auto item = args[0];
         auto second = args[1];
-        if (!typeCheck(item->type(), Atom)) {
+        if (!typeCheck(typeOf(item), Atom)) {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'swap!' requires an Atom as it's first argument.";
             throw typeExcep;
         }   
         auto atom = item->as_atom();
+        // the atom could move while we EVAL the swap
+        GCRoot atomRoot(atom);
 
         MalType* callable = NULL;
-        if (!typeChecksOneOf(second->type(), TCOptFunc, Func)) {
+        if (!typeChecksOneOf(typeOf(second), TCOptFunc, Func)) {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'swap!' requires a TCOpt|Func as it's second argument.";
             throw typeExcep;
         } else {
-            switch (second->type()) {
+            switch (typeOf(second)) {
                 case TCOptFunc: {
                     callable = second->as_tcoptfunc();
                     break;
@@ -1079,44 +1221,31 @@ namespace Core {
         auto key = args[1];
         vector < Type > stypes { Pair, List, Vector };
         // we expect a sequence to use find one
-        if (!typeChecksOneFrom(item->type(), stypes)) {
+        if (!typeChecksOneFrom(typeOf(item), stypes)) {
             auto typeExcep = TypeException();
             typeExcep.errMessage = "'find' requires a Sequence as it's first argument.";
             throw typeExcep;
         }
 
-        switch (item->type()) {
+        switch (typeOf(item)) {
             case Pair:
             case List:
             case Vector: 
             default: {
-                auto seq = item->as_sequence()->items();
+                auto seq = item->as_sequence();
                 int index = -1;
                 bool found = false;
-                for (int i = 0; seq.size() > i; ++i) {
-                    auto c = seq[i];
-                    // if the key and current item are either a list or vector,
-                    // we use a helper to tell if they're the same content-wise
-                    if (typeChecksOneOf(c->type(), List, Vector) && 
-                        typeChecksOneOf(key->type(), List, Vector)) {
-                        auto seqA = c->as_sequence()->items();
-                        auto seqB = key->as_sequence()->items();
-                        if (compareSequenceItems(seqA, seqB)) {
-                            found = true;
-                            index = i;
-                            break;
-                        }
-                    } else {
-                        if (c->inspect() == key->inspect()) {
-                            found = true;
-                            index = i;
-                            break;
-                        }
+                int i = 0;
+                for (auto it = seq->begin(); it != seq->end(); ++it, ++i) {
+                    if (equalsOf(*it, key)) {
+                        found = true;
+                        index = i;
+                        break;
                     }
                 }
 
                 if (found) {
-                    return new MalInt(index);
+                    return makeInt(index);
                 }
                 return CONSTANTS["nil"];
             }
@@ -1139,20 +1268,29 @@ namespace Core {
         }
 
         auto store = args[0];
-        if (!typeCheck(store->type(), HashMap)) {
+        if (typeCheck(typeOf(store), Vector)) {
+            // the keys are indexes, the count itself adds an item at the end
+            auto res = store->as_vector();
+            for (int i = 1; argc > i; i = i + 2) {
+                auto k = args[i];
+                if (!typeCheck(typeOf(k), Int) || toLong(k) < 0 || size_t(toLong(k)) > res->count()) {
+                    auto e = RuntimeException();
+                    e.errMessage = "'" + inspectOf(k) + "' is not an index of the Vector.";
+                    throw e;
+                }
+                res = res->assoc(toLong(k), args[i+1]);
+            }
+            return res;
+        }
+        if (!typeCheck(typeOf(store), HashMap)) {
             auto typeExcep = TypeException();
-            typeExcep.errMessage = "'assoc' requires a HashMap as it's first argument.";
+            typeExcep.errMessage = "'assoc' requires a HashMap|Vector as it's first argument.";
             throw typeExcep;
         }
 
-        auto hmap = store->as_hashmap();
-        auto res = new MalHashMap(*hmap);
-
-        for (int i = 1; argc > i; i = i + 2) {
-            auto k = args[i];
-            auto v = args[i+1];
-            res->set(k->inspect(), k, v);
-        }
+        auto res = store->as_hashmap();
+        for (int i = 1; argc > i; i = i + 2)
+            res = res->assoc(args[i], args[i+1]);
         return res;
     }
 
@@ -1161,14 +1299,18 @@ namespace Core {
         for (int i = 0; argc > i; ++i) {
             auto arg = args[i];
             // make sure the argument is a List
-            if (!typeChecksOneOf(arg->type(), List, Vector)) {
+            if (!typeChecksOneOf(typeOf(arg), List, Vector)) {
                 auto typeExcep = TypeException();
                 typeExcep.errMessage = "'concat' requires List|Vector arguments.";
                 throw typeExcep;
             }
-            auto seq = arg->as_sequence()->items();
-            for (int j = 0; seq.size() > j; ++j)
-                res->append(seq[j]);
+            // the last list doesn't need copying, the result can end in it
+            if (i + 1 == argc && typeOf(arg) == List) {
+                res->attach(arg->as_list());
+                break;
+            }
+            for (auto item : *arg->as_sequence())
+                res->append(item);
         }
         return res;
     }
@@ -1183,7 +1325,7 @@ namespace Core {
         auto ast = args[0];
         auto result = new MalList;
 
-        switch (ast->type()) {
+        switch (typeOf(ast)) {
             case List: {
                 auto list = ast->as_list();
                 auto items = list->items();
@@ -1195,7 +1337,7 @@ namespace Core {
                 auto first = items[0];
                 
                 // first test
-                if (first->inspect() == "unquote") {
+                if (inspectOf(first) == "unquote") {
                     return items[1];
                 }
 
@@ -1203,24 +1345,24 @@ namespace Core {
                 int count = items.size() - 1;
                 // loop inreverse and then:
                 for (int i = count; i >= 0; --i) {
-                    auto elem = list->items()[i];
+                    auto elem = items[i];
                     // make sure elem is a list, and starts with splice-quote
-                    if (typeCheck(elem->type(), List)) {
+                    if (typeCheck(typeOf(elem), List)) {
                         // check for splice-quote
-                        auto elems = elem->as_list()->items();
+                        auto elems = elem->as_list();
                         
-                        if (elems.size() > 0) {
-                            auto top = elems[0];
+                        if (!elems->empty()) {
+                            auto top = elems->at(0);
 
-                            if (top->inspect() == "splice-unquote") {
+                            if (inspectOf(top) == "splice-unquote") {
                                 // replace current result with a new list that
                                 // contains:
                                 // concat symbol
                                 // elem's second elementsss
                                 // result
                                 auto newRes = new MalList;
-                                newRes->append(new MalSymbol("concat"));
-                                newRes->append(elems.at(1));
+                                newRes->append(MalSymbol::intern("concat"));
+                                newRes->append(elems->at(1));
                                 newRes->append(result);
                                 result = newRes;
                                 continue;
@@ -1229,7 +1371,7 @@ namespace Core {
                     }
                     // catch all
                     auto newRes = new MalList;
-                    newRes->append(new MalSymbol("cons"));
+                    newRes->append(MalSymbol::intern("cons"));
                     // call quasiquote on elem
                     MalType *args[1] { elem };
                     auto q_elem = quasiquote(args, 1);
@@ -1245,22 +1387,22 @@ namespace Core {
                 for (int i = count; i >= 0; --i) {
                     auto elem = vect[i];
                     // make sure elem is a list, and starts with splice-quote
-                    if (typeCheck(elem->type(), List)) {
+                    if (typeCheck(typeOf(elem), List)) {
                         // check for splice-quote
-                        auto elems = elem->as_list()->items();
+                        auto elems = elem->as_list();
                         
-                        if (elems.size() > 0) {
-                            auto top = elems[0];
+                        if (!elems->empty()) {
+                            auto top = elems->at(0);
 
-                            if (top->inspect() == "splice-unquote") {
+                            if (inspectOf(top) == "splice-unquote") {
                                 // replace current result with a new list that
                                 // contains:
                                 // concat symbol
                                 // elem's second elementsss
                                 // result
                                 auto newRes = new MalList;
-                                newRes->append(new MalSymbol("concat"));
-                                newRes->append(elems.at(1));
+                                newRes->append(MalSymbol::intern("concat"));
+                                newRes->append(elems->at(1));
                                 newRes->append(result);
                                 result = newRes;
                                 continue;
@@ -1269,7 +1411,7 @@ namespace Core {
                     }
 
                     auto newRes = new MalList;
-                    newRes->append(new MalSymbol("cons"));
+                    newRes->append(MalSymbol::intern("cons"));
                     MalType *args[1] { elem };
                     auto q_elem = quasiquote(args, 1);
                     newRes->append(q_elem);
@@ -1277,7 +1419,7 @@ namespace Core {
                     result = newRes;
                 }
                 auto temp = new MalList;
-                temp->append(new MalSymbol("vec"));
+                temp->append(MalSymbol::intern("vec"));
                 temp->append(result);
                 result = temp;
                 return result;
@@ -1303,12 +1445,11 @@ namespace Core {
 
         auto item = args[0];
 
-        switch(item->type()) {
+        switch(typeOf(item)) {
             case List:
             case Pair: {
                 auto res = new MalVector;
-                auto items = item->as_sequence()->items();
-                for (auto i : items) {
+                for (auto i : *item->as_sequence()) {
                     res->append(i);
                 }
                 return res;
@@ -1332,7 +1473,35 @@ namespace Core {
         }
 
         auto item = args[0];
-        return item->stringedType();
+        return stringedTypeOf(item);
+    }
+
+    // a function body resolved before a macro got defined refers to it as a global
+    MalType* macroName(MalType* head) {
+        if (typeOf(head) == Local && head->as_local()->slot() == MalLocal::GLOBAL)
+            return head->as_local()->symbol();
+        return head;
+    }
+
+    // bumped whenever a macro gets defined, or a name bound to one gets rebound,
+    // so a remembered expansion (see compiler.hpp) knows it has to expand again
+    size_t macroEpoch = 0;
+
+    bool isMacro(MalType* value) {
+        return typeOf(value) == TCOptFunc && value->as_tcoptfunc()->isMacro();
+    }
+
+    // called before def! (or defmacro!) binds key to value in env
+    void noteDefinition(Environ* env, MalType* key, MalType* value) {
+        if (typeOf(key) != Symbol)
+            return;
+        if (isMacro(value)) {
+            ++macroEpoch;
+            return;
+        }
+        auto old = env->find(key, true);
+        if (old != NULL && isMacro(old))
+            ++macroEpoch;
     }
 
     MalType* isMacroCall(MalType** args, size_t argc) {
@@ -1344,18 +1513,18 @@ namespace Core {
 
         auto item = args[0];
         
-        if (!typeCheck(item->type(), List)) {
+        if (!typeCheck(typeOf(item), List)) {
             return CONSTANTS["false"];
         }
-        auto ast = item->as_list()->items();    
-        if (ast.size() > 0) {
-            auto first = ast[0];
-            if (!typeCheck(first->type(), Symbol))
+        auto ast = item->as_list();
+        if (!ast->empty()) {
+            auto first = macroName(ast->at(0));
+            if (!typeCheck(typeOf(first), Symbol))
                 return CONSTANTS["false"];
 
             auto found = TOP_LEVEL->find(first); 
             if (found != NULL &&
-                typeCheck(found->type(), TCOptFunc)) {
+                typeCheck(typeOf(found), TCOptFunc)) {
                 auto fn = found->as_tcoptfunc();
                 if (fn->isMacro())
                     return CONSTANTS["true"];
@@ -1364,6 +1533,69 @@ namespace Core {
         return CONSTANTS["false"];
     }
 
+    // runs the macro a macro call (see isMacroCall) calls
+    MalType* expandOnce(MalType* ast) {
+        auto items = ast->as_list();
+        // we need to grab the macro itself
+        auto macro = TOP_LEVEL->get(macroName(items->first()));
+        // create a call list with the macro in the callable
+        // position, followed by the (shared) arguments to be EVAL'd
+        auto list = new MalList(macro, items->rest());
+        return EVAL(list, TOP_LEVEL);
+    }
+
+    // a macro gets its arguments evaluated (in TOP_LEVEL) every time it's expanded, so
+    // an expansion only comes out the same every time when they're all literals
+    bool isLiteral(MalType* form) {
+        switch (typeOf(form)) {
+            case Nil:
+            case Boolean:
+            case Int:
+            case String:
+            case Keyword:
+                return true;
+            case List:
+                return form->as_list()->empty();
+            case Vector:
+                for (auto item : *form->as_vector()) {
+                    if (!isLiteral(item))
+                        return false;
+                }
+                return true;
+            case HashMap:
+                // only the values get evaluated
+                for (auto& entry : *form->as_hashmap()) {
+                    if (!isLiteral(entry.value))
+                        return false;
+                }
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool literalArgs(MalType* call) {
+        auto args = call->as_list()->rest();
+        for (auto arg : *args) {
+            if (!isLiteral(arg))
+                return false;
+        }
+        return true;
+    }
+
+    // macroExpand, also saying whether every call it expanded had literal
+    // arguments, so the expansion can be kept and used again
+    MalType* expandAll(MalType* ast, bool& fixed) {
+        fixed = true;
+        MalType* call_args[1] { ast };
+        while (isMacroCall(call_args, 1) == CONSTANTS["true"]) {
+            fixed = fixed && literalArgs(ast);
+            ast = expandOnce(ast);
+            call_args[0] = ast;
+        }
+        return ast;
+    }
+
     MalType* macroExpand(MalType** args, size_t argc) {
         if (argc != 1) {
             auto runExcep = RuntimeException();
@@ -1375,19 +1607,7 @@ namespace Core {
         MalType* call_args[1] { ast };
         auto val = isMacroCall(call_args, 1);
         while (val == CONSTANTS["true"]) {
-            // so we do have a macro call.
-            auto items = ast->as_list()->items();
-            // we need to grab the macro itself
-            auto macro = TOP_LEVEL->get(items[0]);
-            auto list = new MalList;
-            // create a call list with the macro in the callable
-            // position and then add the other arguments to the list
-            // to be EVAL'd
-            list->append(macro);
-            for (int i = 1; items.size() > i; ++i) {
-                list->append(items[i]);
-            }
-            ast = EVAL(list, TOP_LEVEL);
+            ast = expandOnce(ast);
             call_args[0] = ast;
             val = isMacroCall(call_args, 1);
         }
@@ -1416,40 +1636,44 @@ namespace Core {
         auto cal = args[0];
         auto lst = args[1];
 
-        if (!typeChecksOneOf(cal->type(), Func, TCOptFunc)) {
+        if (!typeChecksOneFrom(typeOf(cal), { Func, TCOptFunc, Keyword })) {
             auto t = TypeException();
-            t.errMessage = "'" + cal->inspect() + "' is not a Callable. map takes a Callable and a Sequence.";
+            t.errMessage = "'" + inspectOf(cal) + "' is not a Callable. map takes a Callable and a Sequence.";
             throw t;
         }
 
         vector < Type > stypes { List, Vector, Pair };
-        if (!typeChecksOneFrom(lst->type(), stypes)) {
+        if (!typeChecksOneFrom(typeOf(lst), stypes)) {
             auto t = TypeException();
-            t.errMessage = "'" + lst->inspect() + "' is not a Sequence (List, Vector, Pair).\nmap takes a Callable and a Sequence.";
+            t.errMessage = "'" + inspectOf(lst) + "' is not a Sequence (List, Vector, Pair).\nmap takes a Callable and a Sequence.";
             throw t;
         }
 
         auto seq = lst->as_sequence()->items();
         auto res = new MalList;
-        switch (cal->type()) {
+        // both branches can end up in EVAL, which can collect (and move things)
+        GCRoot seqRoot(seq);
+        GCRoot resRoot(res);
+        GCRoot calRoot(cal);
+        switch (typeOf(cal)) {
             case Func: {
                 auto fn = cal->as_func()->callable();
                 // we need to loop through seq,
                 // call fn on it and then append it to res
-                for (auto i : seq) {
+                for (auto& i : seq) {
                     MalType* arg[1] { i };
-                    res->append(fn(arg, 1));
+                    auto val = fn(arg, 1);
+                    res->append(val);
                 }
                 return res;
             }
             default: { // User Defined Fn
-                auto tco = cal->as_tcoptfunc();
-
-                for (auto i : seq) {
+                for (auto& i : seq) {
                     auto callList = new MalList;
-                    callList->append(tco);
+                    callList->append(cal);
                     callList->append(i);
-                    res->append(EVAL(callList, TOP_LEVEL));
+                    auto val = EVAL(callList, TOP_LEVEL);
+                    res->append(val);
                 }
             }
         }
@@ -1465,17 +1689,17 @@ namespace Core {
 
         // make sure the last argument is a list
         auto fn = args[0];
-        if (!typeChecksOneOf(fn->type(), Func, TCOptFunc)) {
+        if (!typeChecksOneFrom(typeOf(fn), { Func, TCOptFunc, Keyword })) {
             auto t = TypeException();
-            t.errMessage = "'" + fn->inspect() + "' is not a Callable. map takes a Callable as its first argument.";
+            t.errMessage = "'" + inspectOf(fn) + "' is not a Callable. map takes a Callable as its first argument.";
             throw t;
         }
         
         auto last = args[argc - 1];
         vector < Type > stypes { List, Vector, Pair };
-        if (!typeChecksOneFrom(last->type(), stypes)) {
+        if (!typeChecksOneFrom(typeOf(last), stypes)) {
             auto t = TypeException();
-            t.errMessage = "'" + last->inspect() + "' is not a Sequence (List, Vector, Pair).\napply takes a Sequence as its last argument.";
+            t.errMessage = "'" + inspectOf(last) + "' is not a Sequence (List, Vector, Pair).\napply takes a Sequence as its last argument.";
             throw t;
         }
 
@@ -1485,8 +1709,7 @@ namespace Core {
             callList->append(args[i]);
         }
         
-        auto seq = last->as_sequence()->items();
-        for (auto i : seq) {
+        for (auto i : *last->as_sequence()) {
             callList->append(i);
         }
 
@@ -1501,7 +1724,7 @@ namespace Core {
         }
 
         auto item = args[0];
-        return item->type() == Nil ? CONSTANTS["true"] : CONSTANTS["false"];
+        return typeOf(item) == Nil ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     MalType* isTrue(MalType** args, size_t argc) {
@@ -1513,9 +1736,8 @@ namespace Core {
 
         auto item = args[0];
 
-        if (item->type() == Boolean) {
-            auto actual = item->as_boolean();
-            return actual == CONSTANTS["true"] ? CONSTANTS["true"] : CONSTANTS["false"];
+        if (typeOf(item) == Boolean) {
+            return item == CONSTANTS["true"] ? CONSTANTS["true"] : CONSTANTS["false"];
         }
 
         return CONSTANTS["false"];
@@ -1530,9 +1752,8 @@ namespace Core {
 
         auto item = args[0];
 
-        if (item->type() == Boolean) {
-            auto actual = item->as_boolean();
-            return actual == CONSTANTS["false"] ? CONSTANTS["true"] : CONSTANTS["false"];
+        if (typeOf(item) == Boolean) {
+            return item == CONSTANTS["false"] ? CONSTANTS["true"] : CONSTANTS["false"];
         }
 
         return CONSTANTS["false"];
@@ -1546,7 +1767,7 @@ namespace Core {
         }
 
         auto item = args[0];
-        return item->type() == Symbol ? CONSTANTS["true"] : CONSTANTS["false"];
+        return typeOf(item) == Symbol ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     MalType* makeSymbol(MalType** args, size_t argc) {
@@ -1557,13 +1778,13 @@ namespace Core {
         }
 
         auto item = args[0];
-        if (!typeCheck(item->type(), String)) {
+        if (!typeCheck(typeOf(item), String)) {
             auto t = TypeException();
-            t.errMessage = "'" + item->inspect() + "' is not a String. You need a String to make a Symbol.";
+            t.errMessage = "'" + inspectOf(item) + "' is not a String. You need a String to make a Symbol.";
             throw t;
         }
 
-        return new MalSymbol(item->inspect(false));
+        return MalSymbol::intern(inspectOf(item, false));
     }
 
     MalType* makeKeyword(MalType** args, size_t argc) {
@@ -1574,16 +1795,16 @@ namespace Core {
         }
 
         auto item = args[0];
-        if (typeCheck(item->type(), Keyword))
+        if (typeCheck(typeOf(item), Keyword))
             return item;
         
-        if (!typeCheck(item->type(), String)) {
+        if (!typeCheck(typeOf(item), String)) {
             auto t = TypeException();
-            t.errMessage = "'" + item->inspect() + "' is not a String.";
+            t.errMessage = "'" + inspectOf(item) + "' is not a String.";
             throw t;
         }
 
-        return new MalKeyword(item->inspect(false));
+        return MalKeyword::intern(inspectOf(item, false));
     }
 
     MalType* isKeyword(MalType** args, size_t argc) {
@@ -1594,7 +1815,7 @@ namespace Core {
         }
 
         auto item = args[0];
-        return item->type() == Keyword ? CONSTANTS["true"] : CONSTANTS["false"];
+        return typeOf(item) == Keyword ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     MalType* makeVector(MalType** args, size_t argc) {
@@ -1620,7 +1841,7 @@ namespace Core {
         }
 
         auto item = args[0];
-        return item->type() == HashMap ? CONSTANTS["true"] : CONSTANTS["false"];
+        return typeOf(item) == HashMap ? CONSTANTS["true"] : CONSTANTS["false"];
     }
 
     MalType* hashMapGet(MalType** args, size_t argc) {
@@ -1631,9 +1852,9 @@ namespace Core {
         }
         
         auto item = args[0];
-        if (!typeCheck(item->type(), HashMap)) {
+        if (!typeCheck(typeOf(item), HashMap)) {
             auto t = TypeException();
-            t.errMessage = "'" + item->inspect() + "' is not a HashMap.";
+            t.errMessage = "'" + inspectOf(item) + "' is not a HashMap.";
             throw t;
         }
         auto key = args[1];
@@ -1642,7 +1863,30 @@ namespace Core {
         if (match == NULL) {
             return CONSTANTS["nil"];
         }
-        return match->as_pair()->items()[0];
+        return match;
+    }
+
+    // a keyword called like a function, (:k m) or (:k m default), looks itself up in m.
+    // slot is the caller's cache of where it found the key last time (see MalHashMap::get);
+    // a call site that always gets maps built the same way finds it there without a search
+    MalType* keywordGet(MalType* keyword, MalType** args, size_t argc, size_t& slot) {
+        if (argc != 1 && argc != 2) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'" + inspectOf(keyword) + "' requires 1 or 2 arguments.";
+            throw runExcep;
+        }
+
+        auto fallback = argc == 2 ? args[1] : MAL_NIL;
+        auto item = args[0];
+        if (item == MAL_NIL)
+            return fallback;
+        if (!typeCheck(typeOf(item), HashMap)) {
+            auto t = TypeException();
+            t.errMessage = "'" + inspectOf(item) + "' is not a HashMap.";
+            throw t;
+        }
+        auto match = item->as_hashmap()->get(keyword, slot);
+        return match == NULL ? fallback : match;
     }
 
     MalType* hashMapContains(MalType** args, size_t argc) {
@@ -1653,9 +1897,9 @@ namespace Core {
         }
         
         auto item = args[0];
-        if (!typeCheck(item->type(), HashMap)) {
+        if (!typeCheck(typeOf(item), HashMap)) {
             auto t = TypeException();
-            t.errMessage = "'" + item->inspect() + "' is not a HashMap.";
+            t.errMessage = "'" + inspectOf(item) + "' is not a HashMap.";
             throw t;
         }
         auto key = args[1];
@@ -1682,7 +1926,7 @@ namespace Core {
 
         auto res = new MalHashMap;
         for (int i = 0; argc > i; i = i + 2) {
-            res->set(args[i]->inspect(), args[i], args[i+1]);
+            res->set(args[i], args[i+1]);
         }
 
         return res;
@@ -1696,20 +1940,15 @@ namespace Core {
         }
 
         auto item = args[0];
-        if (!typeCheck(item->type(), HashMap)) {
+        if (!typeCheck(typeOf(item), HashMap)) {
             auto t = TypeException();
-            t.errMessage = "'" + item->inspect() + "' is not a HashMap.";
+            t.errMessage = "'" + inspectOf(item) + "' is not a HashMap.";
             throw t;
         }
 
-        auto hmap = item->as_hashmap();
-        auto items = hmap->items();
-        for (int i = 1; argc > i; ++i) {
-            auto item = args[i];
-            items.erase(item->inspect());
-        }
-
-        auto res = new MalHashMap(items);
+        auto res = item->as_hashmap();
+        for (int i = 1; argc > i; ++i)
+            res = res->dissoc(args[i]);
         return res;
     }
 
@@ -1721,21 +1960,17 @@ namespace Core {
         }
 
         auto item = args[0];
-        if (!typeCheck(item->type(), HashMap)) {
+        if (!typeCheck(typeOf(item), HashMap)) {
             auto t = TypeException();
-            t.errMessage = "'" + item->inspect() + "' is not a HashMap.";
+            t.errMessage = "'" + inspectOf(item) + "' is not a HashMap.";
             throw t;
         }
 
         auto hmap = item->as_hashmap();
-        auto items = hmap->items();
 
         auto res = new MalList;
-        for (auto p : items) {
-            auto pair = p.second->as_pair();
-            auto key = pair->items()[1];
-            res->append(key);
-        }
+        for (auto& entry : *hmap)
+            res->append(entry.key);
         return res;
     }
 
@@ -1747,21 +1982,101 @@ namespace Core {
         }
 
         auto item = args[0];
-        if (!typeCheck(item->type(), HashMap)) {
+        if (!typeCheck(typeOf(item), HashMap)) {
             auto t = TypeException();
-            t.errMessage = "'" + item->inspect() + "' is not a HashMap.";
+            t.errMessage = "'" + inspectOf(item) + "' is not a HashMap.";
             throw t;
         }
 
         auto hmap = item->as_hashmap();
-        auto items = hmap->items();
 
         auto res = new MalList;
-        for (auto p : items) {
-            auto pair = p.second->as_pair();
-            auto val = pair->items()[0];
-            res->append(val);
+        for (auto& entry : *hmap)
+            res->append(entry.value);
+        return res;
+    }
+
+    // milliseconds since some fixed point, for timing things from mal
+    MalType* timeMs(MalType** args, size_t argc) {
+        if (argc != 0) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'time-ms' requires no arguments.";
+            throw runExcep;
+        }
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return makeInt(std::chrono::duration_cast< std::chrono::milliseconds >(now).count());
+    }
+
+    // starts the sampling profiler (see profile.hpp). it takes a sample every millisecond
+    // of CPU time, or every however many microseconds it's given
+    MalType* profileStart(MalType** args, size_t argc) {
+        if (argc > 1 || (argc == 1 && (typeOf(args[0]) != Int || toLong(args[0]) <= 0))) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'profile-start' takes an optional sampling interval (positive Int, in microseconds).";
+            throw runExcep;
+        }
+        Profile::startSampling(argc == 1 ? toLong(args[0]) : 1000);
+        return CONSTANTS["nil"];
+    }
+
+    // stops it, writes the stacks it saw to a file, in the collapsed format flamegraph.pl reads,
+    // and returns how many samples it took
+    MalType* profileStop(MalType** args, size_t argc) {
+        if (argc != 1 || typeOf(args[0]) != String) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'profile-stop' requires 1 String argument (the file to write the samples to).";
+            throw runExcep;
         }
+        return makeInt(Profile::stopSampling(args[0]->as_string()->inspect(false)));
+    }
+
+    MalType* gcCollect(MalType** args, size_t argc) {
+        if (argc != 0) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'gc' requires no arguments.";
+            throw runExcep;
+        }
+
+        GC::collect();
+        return CONSTANTS["nil"];
+    }
+
+    MalType* gcStats(MalType** args, size_t argc) {
+        if (argc != 0) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'gc-stats' requires no arguments.";
+            throw runExcep;
+        }
+
+        auto stats = GC::stats();
+        auto res = new MalHashMap;
+        auto add = [&](string name, long value) {
+            auto key = MalKeyword::intern(name);
+            res->set(key, makeInt(value));
+        };
+        add("collections", stats.collections);
+        add("minor-collections", stats.minorCollections);
+        add("nursery-bytes", stats.nurseryBytes);
+        add("nursery-used", stats.nurseryUsed);
+        add("promoted-objects", stats.promotedObjects);
+        add("heap-objects", stats.heapObjects);
+        add("heap-bytes", stats.heapBytes);
+        add("allocated-objects", stats.allocatedObjects);
+        add("freed-objects", stats.freedObjects);
+        add("freed-bytes", stats.freedBytes);
+        add("threshold", stats.threshold);
+        add("last-pause-us", stats.lastPause);
+        add("max-pause-us", stats.maxPause);
+        add("total-pause-us", stats.totalPause);
+        add("last-minor-pause-us", stats.lastMinorPause);
+        add("max-minor-pause-us", stats.maxMinorPause);
+        add("total-minor-pause-us", stats.totalMinorPause);
+        // everything malloc has handed out and not had back: besides the objects (heap-bytes),
+        // the arrays, strings and vectors they keep on the side
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+        auto info = mallinfo2();
+        add("malloc-bytes", info.uordblks + info.hblkhd);
+#endif
         return res;
     }
 
@@ -1779,8 +2094,10 @@ namespace Core {
         core["str"] = str;
         core["prn"] = prn;
         core["println"] = println;
+        core["flush"] = flush;
         core["list"] = list;
         core["cons"] = cons;
+        core["conj"] = conj;
         core["list?"] = isList;
         core["pair?"] = isPair;
         core["vector?"] = isVector;
@@ -1799,6 +2116,7 @@ namespace Core {
         core["read-string"] = readstring;
         core["parse"] = readstring;
         core["slurp"] = slurp;
+        core["load-file"] = loadFile;
         core["eval"] = eval;
         core["atom"] = make_atom;
         core["atom?"] = isAtom;
@@ -1830,6 +2148,11 @@ namespace Core {
         core["dissoc"] = dissoc;
         core["keys"] = hashMapKeysList;
         core["values"] = hashMapValuesList;
+        core["time-ms"] = timeMs;
+        core["profile-start"] = profileStart;
+        core["profile-stop"] = profileStop;
+        core["gc"] = gcCollect;
+        core["gc-stats"] = gcStats;
         return core;
     }
 }
\ No newline at end of file
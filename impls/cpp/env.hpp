@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <unordered_map>
 #include "mal_types.hpp"
 
 using namespace std;
@@ -9,8 +10,12 @@ using namespace std;
 // used in step 2
 using Env = map < string, MalType * >;
 
-// used in step 3 and further
-class Environ {
+// used in step 3 and further.
+// TOP_LEVEL (the only environment without an enclosing one) keeps its bindings in a hash table.
+// every other environment is a frame: a small array of (symbol id, value) pairs, in the order
+// they were bound, so the resolver can turn a local variable into a (depth, slot) pair
+// that lookup() goes straight to
+class Environ : public GCObject {
 public:
     Environ(Environ* parent) : enclosing {parent} { }
 
@@ -23,38 +28,59 @@ public:
             throw runExcep;
         }
 
+        frame.reserve(params.size());
         for (int i = 0; params.size() > i; ++i) {
-            set(params[i], args[i]);
+            bind(params[i], args[i]);
         }
     }
     
+    // used by def!. unlike bind, a new name makes the frame grow past what the resolver
+    // saw, so lookup() stops trusting the slots of anything further out
     void set(MalType * id, MalType * val) {
+        auto size = frame.size();
+        bind(id, val);
+        if (frame.size() != size)
+            extended = true;
+    }
+
+    // used when the environment gets created (function parameters, let* bindings...)
+    void bind(MalType * id, MalType * val) {
         // we don't want to be storing non-symbol types in the Environment
         // so we prevent stuff like: (def! 1 2). Will never get processed as a symbol
         // but resolved as an integer (and rightfully so)
         // even though fn* and def! implement their own checks for this error,
         // i will leave it in as a catch all for anything that slips through
         // the cracks in future additions perhaps...
-        if (id->type() != Symbol) {
+        if (typeOf(id) != Symbol) {
             auto e = TypeException();
-            e.errMessage = "'" + id->inspect() + "' cannot be used as a binding key.";
+            e.errMessage = "'" + inspectOf(id) + "' cannot be used as a binding key.";
             throw e;
         }
-        stored[id->inspect()] = val;
+        GC::writeBarrier(this, val);
+        auto symId = id->as_symbol()->id();
+        if (enclosing == NULL) {
+            globals[symId] = val;
+            return;
+        }
+        for (auto& binding : frame) {
+            if (binding.first == symId) {
+                binding.second = val;
+                return;
+            }
+        }
+        frame.push_back({ symId, val });
     }
 
     MalType * find(MalType * id, bool searchCurrentEnvOnly=false) {
-        auto searched = stored.find(id->inspect());
-
-        if (searched == stored.end()) {
-            if (enclosing != NULL && !searchCurrentEnvOnly) {
-                return enclosing->find(id);
-            } else {
-                return NULL;
-            }
-        } else {
-            return searched->second;
+        auto symId = id->as_symbol()->id();
+        auto env = this;
+        while (env != NULL) {
+            auto found = env->findHere(symId);
+            if (found != NULL || searchCurrentEnvOnly)
+                return found;
+            env = env->enclosing;
         }
+        return NULL;
     }
 
     MalType * get(MalType * id) {
@@ -64,12 +90,96 @@ public:
             return found;
         } else {
             auto runExcep = RuntimeException();
-            runExcep.errMessage = "'" + id->inspect() + "' not found";
+            runExcep.errMessage = "'" + inspectOf(id) + "' not found";
             throw runExcep;
         }
     }
 
+    // looks up a variable the resolver has already found the slot of.
+    // if the frames on the way don't look like what the resolver saw
+    // (a def! added a name that could shadow it, or a let* hasn't bound it yet),
+    // we just search by name instead
+    MalType * lookup(MalLocal * local) {
+        auto env = this;
+        for (size_t i = local->depth(); i > 0; --i) {
+            if (env->extended || env->enclosing == NULL)
+                return get(local->symbol());
+            env = env->enclosing;
+        }
+
+        auto symId = local->symbol()->id();
+        auto slot = local->slot();
+        if (slot == MalLocal::GLOBAL) {
+            if (env->enclosing == NULL) {
+                auto found = env->findHere(symId);
+                if (found != NULL)
+                    return found;
+            }
+        } else if (env->frame.size() > slot && env->frame[slot].first == symId) {
+            return env->frame[slot].second;
+        }
+        return get(local->symbol());
+    }
+
+    // the value in a frame's slot, for the VM's captured variables
+    MalType * at(size_t slot) {
+        return frame[slot].second;
+    }
+
+    // everything bound here, as (symbol id, value), in the order a frame bound them
+    template < typename F >
+    void eachBinding(F f) {
+        for (auto& binding : frame)
+            f(binding.first, binding.second);
+        for (auto& binding : globals)
+            f(binding.first, binding.second);
+    }
+
+    Environ* parent() {
+        return enclosing;
+    }
+
+    bool isExtended() {
+        return extended;
+    }
+
+    // for an environment created before the one around it (see image.hpp)
+    void restore(Environ* parent, bool ext) {
+        GC::writeBarrier(this, parent);
+        enclosing = parent;
+        extended = ext;
+    }
+
+    void trace() {
+        for (auto& item : frame)
+            GC::visit(item.second);
+        for (auto& item : globals)
+            GC::visit(item.second);
+        GC::visit(enclosing);
+    }
+
+    GCObject* relocate() {
+        return new Environ(std::move(*this));
+    }
+
 private:
-    map < string, MalType * > stored;
+    MalType * findHere(size_t symId) {
+        if (enclosing == NULL) {
+            auto searched = globals.find(symId);
+            return searched == globals.end() ? NULL : searched->second;
+        }
+        for (auto& binding : frame) {
+            if (binding.first == symId)
+                return binding.second;
+        }
+        return NULL;
+    }
+
+    // (symbol id, value), for frames
+    vector < pair < size_t, MalType * > > frame;
+    // keyed by symbol id, for TOP_LEVEL
+    unordered_map < size_t, MalType * > globals;
     Environ* enclosing;
+    // whether def! added a name to this frame
+    bool extended { false };
 };
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include "gc.hpp"
+
+using namespace std::chrono;
+
+namespace GC {
+    // run a major collection after this many old generation allocations,
+    // unless the old generation is bigger than it
+    const size_t DEFAULT_THRESHOLD = 100000;
+    // small enough to stay in cache
+    const size_t DEFAULT_NURSERY_SIZE = 2 * 1024 * 1024;
+    const size_t ALIGNMENT = alignof(max_align_t);
+
+    bool enabled = false;
+    bool promoting = false;
+    bool permanent = false;
+    bool sweeping = false;
+    bool stress = false;
+
+    char* nurseryStart = NULL;
+    char* nurseryTop = NULL;
+    char* nurseryEnd = NULL;
+    char* nurseryLimit = NULL;
+    bool nurseryOverflowed = false;
+
+    size_t allocatedSinceLast = 0;
+    // nothing gets collected until enable() is called
+    size_t threshold = SIZE_MAX;
+    size_t minThreshold = DEFAULT_THRESHOLD;
+
+    // objects in the nursery, so we can run their destructors when we empty it
+    vector < GCObject* > young;
+    // objects in the old generation (and may delete)
+    vector < GCObject* > heap;
+    // old objects that (might) point into the nursery
+    vector < GCObject* > rememberedSet;
+    // objects copied out of the nursery during this minor collection whose
+    // children haven't been promoted yet
+    vector < GCObject* > promoted;
+    // objects that were marked but whose children haven't been marked yet
+    vector < GCObject* > grey;
+    // roots registered by live EVAL frames, popped as they go out of scope
+    vector < Root > rootStack;
+    // roots that live as long as the interpreter
+    vector < Root > globals;
+    size_t epoch = 0;
+    Stats gcStats;
+
+    void enable() {
+        if (auto env = getenv("MAL_GC_THRESHOLD")) {
+            auto requested = strtoul(env, NULL, 10);
+            if (requested > 0)
+                minThreshold = requested;
+        }
+        size_t nurserySize = DEFAULT_NURSERY_SIZE;
+        if (auto env = getenv("MAL_GC_NURSERY")) {
+            auto requested = strtoul(env, NULL, 10);
+            if (requested > 0)
+                nurserySize = requested;
+        }
+        if (auto env = getenv("MAL_GC_STRESS")) {
+            stress = env[0] != '\0' && env[0] != '0';
+        }
+
+        nurserySize = (nurserySize + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        nurseryStart = static_cast< char* >(aligned_alloc(ALIGNMENT, nurserySize));
+        nurseryTop = nurseryStart;
+        nurseryEnd = nurseryStart + nurserySize;
+        // leave some room for whatever gets allocated before we reach the next safepoint
+        nurseryLimit = nurseryEnd - nurserySize / 4;
+
+        enabled = true;
+        threshold = stress ? 0 : minThreshold;
+        gcStats.threshold = threshold;
+        gcStats.nurseryBytes = nurserySize;
+    }
+
+    void track(GCObject* obj) {
+        if (!enabled || permanent)
+            return;
+        if (isYoung(obj)) {
+            young.push_back(obj);
+            ++gcStats.allocatedObjects;
+            return;
+        }
+
+        heap.push_back(obj);
+        ++allocatedSinceLast;
+        if (promoting) {
+            promoted.push_back(obj);
+            ++gcStats.promotedObjects;
+        } else {
+            // it didn't fit in the nursery. its constructor is about to store
+            // pointers to young objects into it, without going through a write barrier
+            ++gcStats.allocatedObjects;
+            remember(obj);
+        }
+    }
+
+    // drops an object whose constructor threw from wherever track put it
+    void untrack(GCObject* obj) {
+        for (auto list : { &young, &heap, &rememberedSet }) {
+            auto found = find(list->rbegin(), list->rend(), obj);
+            if (found != list->rend())
+                list->erase(next(found).base());
+        }
+    }
+
+    void mark(GCObject* obj) {
+        if (obj == NULL || obj->gcEpoch == epoch)
+            return;
+        obj->gcEpoch = epoch;
+        grey.push_back(obj);
+    }
+
+    GCObject* evacuate(GCObject* obj) {
+        if (obj->forwarded == NULL) {
+            obj->forwarded = obj->relocate();
+        }
+        return obj->forwarded;
+    }
+
+    void remember(GCObject* obj) {
+        obj->remembered = true;
+        rememberedSet.push_back(obj);
+    }
+
+    void pushRoot(Root root) {
+        rootStack.push_back(root);
+    }
+
+    void popRoot() {
+        rootStack.pop_back();
+    }
+
+    void addRoot(Root root) {
+        globals.push_back(root);
+    }
+
+    void minorCollect() {
+        if (!enabled)
+            return;
+        auto start = high_resolution_clock::now();
+
+        // with promoting set, visiting a slot copies its young object into the old generation
+        // (new now allocates there) and points the slot at the copy
+        promoting = true;
+        for (auto root : globals)
+            root.trace(root.slot);
+        for (auto root : rootStack)
+            root.trace(root.slot);
+        for (auto obj : rememberedSet)
+            obj->trace();
+        // the copies still point into the nursery, so promote their children as well.
+        // promoted grows as we go, which is why this isn't a range based for
+        for (size_t i = 0; promoted.size() > i; ++i)
+            promoted[i]->trace();
+        promoting = false;
+
+        // what's left in the nursery is either dead or the husk of something we copied out
+        for (auto obj : young)
+            obj->~GCObject();
+        for (auto obj : rememberedSet)
+            obj->remembered = false;
+        young.clear();
+        promoted.clear();
+        rememberedSet.clear();
+
+        if (stress) {
+            // anything still pointing in here is a missing root, make it crash loudly
+            memset(nurseryStart, 0xdb, nurseryTop - nurseryStart);
+        }
+        nurseryTop = nurseryStart;
+        nurseryOverflowed = false;
+
+        auto end = high_resolution_clock::now();
+        auto pause = duration_cast<microseconds>(end - start).count();
+        ++gcStats.minorCollections;
+        gcStats.lastMinorPause = pause;
+        gcStats.maxMinorPause = max(gcStats.maxMinorPause, pause);
+        gcStats.totalMinorPause += pause;
+    }
+
+    void collect() {
+        if (!enabled)
+            return;
+        // empty the nursery first, so everything alive is in the old generation
+        minorCollect();
+
+        auto start = high_resolution_clock::now();
+        // bumping the epoch unmarks everything at once,
+        // including the objects created before enable() which we never sweep
+        ++epoch;
+
+        for (auto root : globals)
+            root.trace(root.slot);
+        for (auto root : rootStack)
+            root.trace(root.slot);
+
+        // we use an explicit worklist instead of recursing through trace(),
+        // a long list would otherwise blow the C++ stack
+        while (!grey.empty()) {
+            auto obj = grey.back();
+            grey.pop_back();
+            obj->trace();
+        }
+
+        size_t live = 0;
+        auto bytesBefore = gcStats.heapBytes;
+        sweeping = true;
+        for (size_t i = 0; heap.size() > i; ++i) {
+            auto obj = heap[i];
+            if (obj->gcEpoch == epoch) {
+                heap[live++] = obj;
+            } else {
+                delete obj;
+                ++gcStats.freedObjects;
+            }
+        }
+        sweeping = false;
+        heap.resize(live);
+        gcStats.freedBytes += bytesBefore - gcStats.heapBytes;
+
+        // let the heap grow in proportion to what survived,
+        // so a big live heap doesn't make us collect all the time
+        allocatedSinceLast = 0;
+        threshold = stress ? 0 : max(minThreshold, live);
+
+        auto end = high_resolution_clock::now();
+        auto pause = duration_cast<microseconds>(end - start).count();
+        ++gcStats.collections;
+        gcStats.threshold = threshold;
+        gcStats.lastPause = pause;
+        gcStats.maxPause = max(gcStats.maxPause, pause);
+        gcStats.totalPause += pause;
+    }
+
+    const Stats& stats() {
+        gcStats.heapObjects = heap.size();
+        gcStats.nurseryUsed = nurseryTop - nurseryStart;
+        return gcStats;
+    }
+}
+
+GCObject::GCObject() {
+    GC::track(this);
+}
+
+GCObject::GCObject(const GCObject&) {
+    GC::track(this);
+}
+
+GCObject::GCObject(GCObject&&) {
+    GC::track(this);
+}
+
+void* GCObject::operator new(size_t size) {
+    if (GC::enabled && !GC::promoting && !GC::permanent) {
+        auto rounded = (size + GC::ALIGNMENT - 1) & ~(GC::ALIGNMENT - 1);
+        if (static_cast< size_t >(GC::nurseryEnd - GC::nurseryTop) >= rounded) {
+            auto ptr = GC::nurseryTop;
+            GC::nurseryTop += rounded;
+            return ptr;
+        }
+        GC::nurseryOverflowed = true;
+    }
+    GC::gcStats.heapBytes += size;
+    return ::operator new(size);
+}
+
+void GCObject::operator delete(void* ptr, size_t size) {
+    // outside of a sweep, we only get here when a constructor threw
+    if (!GC::sweeping)
+        GC::untrack(static_cast< GCObject* >(ptr));
+    // nursery memory gets reused wholesale after the next minor collection
+    if (GC::isYoung(ptr))
+        return;
+    GC::gcStats.heapBytes -= size;
+    ::operator delete(ptr);
+}
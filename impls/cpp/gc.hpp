@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <string>
+
+using namespace std;
+
+// every heap allocated MalType (and every Environ) is a GCObject.
+// the heap has two generations:
+// 1. the nursery, a single block we bump allocate new objects out of.
+//    a minor collection copies whatever is still reachable out of it (into the old generation)
+//    and then reuses the whole block, so most values die without ever being freed one by one
+// 2. the old generation, plain new/delete'd objects collected by mark and sweep
+// the roots are TOP_LEVEL, CONSTANTS and whatever the live EVAL frames
+// registered with a GCRoot.
+// collection only ever happens at a safepoint (the top of EVAL's loop, or an explicit (gc)),
+// never inside an allocation. since a minor collection moves objects, any C++ local
+// holding a value across a call that might collect (EVAL, or a builtin that calls it)
+// has to be a GCRoot, so the collector can update it
+class GCObject {
+public:
+    GCObject();
+    GCObject(const GCObject& other);
+    GCObject(GCObject&& other);
+    virtual ~GCObject() { }
+
+    // called by the collector with every GCObject pointer this object holds onto,
+    // through GC::visit, so they can be marked or updated after a move.
+    // leaf types (ints, strings, symbols...) have nothing to visit
+    virtual void trace() { }
+
+    // moves this object out of the nursery, returning the copy.
+    // only called while the collector is promoting, so new'ing the copy
+    // allocates it in the old generation
+    virtual GCObject* relocate() = 0;
+
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
+
+    // the epoch of the last major collection that found this object alive
+    size_t gcEpoch { 0 };
+    // where a promoted nursery object went
+    GCObject* forwarded { NULL };
+    // whether this (old) object is in the remembered set
+    bool remembered { false };
+};
+
+namespace GC {
+    struct Stats {
+        // major (mark and sweep) collections
+        size_t collections { 0 };
+        size_t minorCollections { 0 };
+        // objects in the old generation the collector is responsible for
+        // (everything allocated after enable())
+        size_t heapObjects { 0 };
+        // bytes taken up by the old generation, including the objects created before enable()
+        size_t heapBytes { 0 };
+        size_t nurseryBytes { 0 };
+        size_t nurseryUsed { 0 };
+        size_t allocatedObjects { 0 };
+        size_t promotedObjects { 0 };
+        size_t freedObjects { 0 };
+        size_t freedBytes { 0 };
+        // number of old generation allocations since the last major collection that triggers the next one
+        size_t threshold { 0 };
+        // pause times are in microseconds, just like the time special form
+        long lastPause { 0 };
+        long maxPause { 0 };
+        long totalPause { 0 };
+        long lastMinorPause { 0 };
+        long maxMinorPause { 0 };
+        long totalMinorPause { 0 };
+    };
+
+    // a root is the address of something the collector should visit,
+    // with the function that knows how to visit its contents
+    struct Root {
+        void* slot;
+        void (*trace)(void*);
+    };
+
+    // objects created before this is called (the constants, TOP_LEVEL, ...) are never collected
+    // (and neither are the ones created inside a GCPermanent scope).
+    // reads from the environment:
+    // MAL_GC_THRESHOLD: old generation allocations between major collections
+    // MAL_GC_NURSERY: size of the nursery in bytes
+    // MAL_GC_STRESS: collect at every safepoint (and scribble over the emptied nursery),
+    //                useful to shake out missing roots
+    void enable();
+    void track(GCObject* obj);
+    void minorCollect();
+    void collect();
+    const Stats& stats();
+
+    void mark(GCObject* obj);
+    GCObject* evacuate(GCObject* obj);
+    void remember(GCObject* obj);
+    void pushRoot(Root root);
+    void popRoot();
+    void addRoot(Root root);
+
+    extern bool enabled;
+    extern bool promoting;
+    // set by GCPermanent
+    extern bool permanent;
+    extern char* nurseryStart;
+    extern char* nurseryTop;
+    extern char* nurseryEnd;
+    // a minor collection is due once the nursery fills past this point
+    extern char* nurseryLimit;
+    // set when an allocation didn't fit into the nursery and went to the old generation
+    extern bool nurseryOverflowed;
+    extern size_t allocatedSinceLast;
+    extern size_t threshold;
+
+    // a slot can also hold an immediate (see mal_types.hpp),
+    // a tagged word that isn't an object at all
+    inline bool isObject(const void* ptr) {
+        return (reinterpret_cast< uintptr_t >(ptr) & 0b11) == 0;
+    }
+
+    inline bool isYoung(const void* ptr) {
+        auto p = static_cast< const char* >(ptr);
+        return p >= nurseryStart && p < nurseryEnd;
+    }
+
+    // called where every live value is reachable from a root
+    inline void safepoint() {
+        if (allocatedSinceLast >= threshold)
+            collect();
+        else if (nurseryTop >= nurseryLimit || nurseryOverflowed)
+            minorCollect();
+    }
+
+    // has to be called whenever a pointer gets stored into an object that already exists,
+    // so we know which old objects point into the nursery without scanning all of them
+    inline void writeBarrier(GCObject* owner, const void* value) {
+        if (isObject(value) && isYoung(value) && !owner->remembered && !isYoung(owner))
+            remember(owner);
+    }
+
+    // a minor collection promotes the young object a slot points to (and fixes the slot),
+    // a major one marks it
+    template < typename T >
+    void visit(T*& slot) {
+        if (!isObject(slot))
+            return;
+        if (promoting) {
+            if (isYoung(slot))
+                slot = static_cast< T* >(evacuate(slot));
+        } else {
+            mark(slot);
+        }
+    }
+
+    template < typename T >
+    Root rootFor(T*& slot) {
+        return Root { &slot, [](void* s) { visit(*static_cast< T** >(s)); } };
+    }
+
+    template < typename T >
+    Root rootFor(vector < T* >& items) {
+        return Root { &items, [](void* s) {
+            for (auto& item : *static_cast< vector < T* >* >(s))
+                visit(item);
+        } };
+    }
+
+    template < typename T >
+    Root rootFor(map < string, T* >& items) {
+        return Root { &items, [](void* s) {
+            for (auto& item : *static_cast< map < string, T* >* >(s))
+                visit(item.second);
+        } };
+    }
+
+    // for globals that live as long as the interpreter (TOP_LEVEL, CONSTANTS...)
+    template < typename T >
+    void addRoot(T& item) {
+        addRoot(rootFor(item));
+    }
+}
+
+// keeps a C++ local (a pointer, a vector or a map of pointers) alive and up to date
+// across a call that might collect, for as long as the GCRoot is in scope.
+// e.g:
+//  auto results = new MalList;
+//  GCRoot resultsRoot(results);
+//  auto item = EVAL(ast, curEnv);
+//  results->append(item); // results survived (and maybe moved) during EVAL
+// note that `results->append(EVAL(ast, curEnv))` would be wrong: results gets read
+// before EVAL runs, so it could be appending to the copy a minor collection left behind
+class GCRoot {
+public:
+    template < typename T >
+    GCRoot(T& item) {
+        GC::pushRoot(GC::rootFor(item));
+    }
+
+    ~GCRoot() {
+        GC::popRoot();
+    }
+
+    GCRoot(const GCRoot&) = delete;
+    GCRoot& operator=(const GCRoot&) = delete;
+};
+
+// while one of these is in scope, new objects are allocated outside of the collector,
+// just like the ones created before GC::enable(): never moved, never freed.
+// for things that live as long as the interpreter anyway (interned symbols...).
+// they can't point to collected objects, since nothing traces them
+class GCPermanent {
+public:
+    GCPermanent() : wasPermanent { GC::permanent } {
+        GC::permanent = true;
+    }
+
+    ~GCPermanent() {
+        GC::permanent = wasPermanent;
+    }
+
+    GCPermanent(const GCPermanent&) = delete;
+    GCPermanent& operator=(const GCPermanent&) = delete;
+
+private:
+    bool wasPermanent;
+};
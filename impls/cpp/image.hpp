@@ -0,0 +1,406 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "mal_types.hpp"
+#include "env.hpp"
+#include "core.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include "modules.hpp"
+
+using namespace std;
+
+// --save-image and --image: everything TOP_LEVEL has once a file has run (or once the
+// builtins are set up), written out so a later run can start from it instead of loading
+// and evaluating that file again.
+// the heap itself can't just be dumped and mapped back in (its objects point at each other,
+// at vtables, and into the C++ library's containers, none of which stay put between runs),
+// so the image is the graph of values reachable from TOP_LEVEL, in the same compact form
+// the .malc caches use (see modules.hpp). functions keep their resolved body forms and get
+// compiled again when they come back, atoms, closures and the environments they share are
+// written once and referred back to, and builtins are saved by name.
+// an image only fits the build that wrote it: a different set of builtins gets it refused
+namespace Image {
+    const char MAGIC[4] = { 'M', 'A', 'L', 'I' };
+    // bump when the layout changes
+    const uint64_t VERSION = 1;
+
+    // set by main from --image and --save-image
+    string restoreFrom;
+    string saveTo;
+
+    // past the ones modules.hpp uses for the forms a reader makes
+    enum Tag : uint8_t {
+        NameTag = Modules::MapTag + 1, ResolvedFnTag, LocalTag, PairTag, BuiltinTag,
+        AtomTag, FnTag, RefTag, TopLevelTag, EnvTag
+    };
+
+    using Modules::put;
+    using Modules::Input;
+    using Modules::Corrupt;
+
+    // which builtins this build has, so an image from a different one isn't trusted
+    uint64_t builtinsHash() {
+        string names;
+        for (auto& fn : Core::getCoreBuiltins()) {
+            names += fn.first;
+            names += '\0';
+        }
+        return Modules::contentHash(names);
+    }
+
+    // writing
+
+    class Writer {
+    public:
+        string out;
+
+        void value(MalType* val) {
+            switch (typeOf(val)) {
+                case Nil:
+                case Boolean:
+                case Int:
+                case String:
+                case Keyword:
+                case Spreader:
+                    Modules::serialize(val, out);
+                    return;
+                case Symbol:
+                    if (val == Resolver::RESOLVED_FN) {
+                        out += (char) ResolvedFnTag;
+                    } else {
+                        out += (char) NameTag;
+                        name(val->as_symbol()->id());
+                    }
+                    return;
+                case Local: {
+                    auto local = val->as_local();
+                    out += (char) LocalTag;
+                    name(local->symbol()->id());
+                    put(out, local->depth());
+                    // so GLOBAL comes out as 0
+                    put(out, local->slot() + 1);
+                    return;
+                }
+                case List:
+                case Vector: {
+                    auto seq = val->as_sequence();
+                    out += (char) (typeOf(val) == List ? Modules::ListTag : Modules::VectorTag);
+                    put(out, seq->count());
+                    for (auto item : *seq)
+                        value(item);
+                    return;
+                }
+                case Pair: {
+                    auto pair = val->as_sequence();
+                    out += (char) PairTag;
+                    value(pair->at(0));
+                    value(pair->at(1));
+                    return;
+                }
+                case HashMap: {
+                    auto hmap = val->as_hashmap();
+                    out += (char) Modules::MapTag;
+                    put(out, hmap->count());
+                    for (auto& entry : *hmap) {
+                        value(entry.key);
+                        value(entry.value);
+                    }
+                    return;
+                }
+                case Node:
+                    value(static_cast< MalNode* >(val)->form());
+                    return;
+                case Func:
+                    if (seen(val))
+                        return;
+                    out += (char) BuiltinTag;
+                    put(out, val->as_func()->name());
+                    return;
+                case Atom:
+                    if (seen(val))
+                        return;
+                    out += (char) AtomTag;
+                    value(val->as_atom()->deref());
+                    return;
+                case TCOptFunc: {
+                    if (seen(val))
+                        return;
+                    auto fn = val->as_tcoptfunc();
+                    out += (char) FnTag;
+                    put(out, fn->name());
+                    out += (char) fn->isVariad();
+                    out += (char) fn->isMacro();
+                    auto params = fn->getParameters();
+                    put(out, params.size());
+                    for (auto param : params)
+                        name(param->as_symbol()->id());
+                    value(fn->getBody());
+                    env(fn->getEnviron());
+                    return;
+                }
+                default: {
+                    auto runExcep = RuntimeException();
+                    runExcep.errMessage = "can't save '" + inspectOf(val) + "' in an image.";
+                    throw runExcep;
+                }
+            }
+        }
+
+        void env(Environ* e) {
+            if (e == TOP_LEVEL) {
+                out += (char) TopLevelTag;
+                return;
+            }
+            if (seen(e))
+                return;
+            out += (char) EnvTag;
+            env(e->parent());
+            out += (char) e->isExtended();
+            size_t count = 0;
+            e->eachBinding([&](size_t, MalType*) { ++count; });
+            put(out, count);
+            e->eachBinding([&](size_t id, MalType* val) {
+                name(id);
+                value(val);
+            });
+        }
+
+        // every symbol is written once, up front (see save), and referred to by its index after that
+        void name(size_t id) {
+            auto [found, inserted] = nameIndex.try_emplace(id, names.size());
+            if (inserted)
+                names.push_back(id);
+            put(out, found->second);
+        }
+
+        vector < size_t > names;
+
+    private:
+        // writes a reference to obj if it has been written already, or numbers it so it can be
+        bool seen(GCObject* obj) {
+            auto [found, inserted] = ids.try_emplace(obj, ids.size());
+            if (inserted)
+                return false;
+            out += (char) RefTag;
+            put(out, found->second);
+            return true;
+        }
+
+        unordered_map < GCObject*, size_t > ids;
+        unordered_map < size_t, size_t > nameIndex;
+    };
+
+    // an image:
+    // MALI, version, checksum of the rest
+    // the hash of the builtins' names
+    // the symbols: count, then each one's name
+    // TOP_LEVEL's bindings: count, then the name and value (see Writer) of each
+    void save(const string& path) {
+        Writer writer;
+        size_t count = 0;
+        TOP_LEVEL->eachBinding([&](size_t, MalType*) { ++count; });
+        put(writer.out, count);
+        TOP_LEVEL->eachBinding([&](size_t id, MalType* val) {
+            writer.name(id);
+            writer.value(val);
+        });
+
+        string rest;
+        put(rest, builtinsHash());
+        put(rest, writer.names.size());
+        for (auto id : writer.names)
+            put(rest, MalSymbol::forId(id)->str());
+        rest.append(writer.out);
+
+        string data(MAGIC, 4);
+        put(data, VERSION);
+        put(data, Modules::contentHash(rest));
+        data.append(rest);
+
+        auto temp = path + "." + to_string(getpid());
+        auto file = fopen(temp.c_str(), "wb");
+        bool written = file != NULL && fwrite(data.data(), 1, data.size(), file) == data.size();
+        if (file == NULL || fclose(file) != 0 || !written || rename(temp.c_str(), path.c_str()) != 0) {
+            remove(temp.c_str());
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "couldn't write the image '" + path + "'.";
+            throw runExcep;
+        }
+    }
+
+    // reading
+
+    // nothing collects while this runs (compiling a function doesn't either),
+    // so what it builds needs no rooting
+    class Restorer {
+    public:
+        Restorer(Input& input) : in {input} {
+            for (auto count = in.word(); count > 0; --count)
+                names.push_back(MalSymbol::intern(in.text()));
+        }
+
+        MalSymbol* name() {
+            auto index = in.word();
+            if (index >= names.size())
+                throw Corrupt();
+            return names[index];
+        }
+
+        MalType* value() {
+            auto tag = in.byte();
+            switch (tag) {
+                case NameTag:
+                    return name();
+                case ResolvedFnTag:
+                    return Resolver::RESOLVED_FN;
+                case LocalTag: {
+                    auto sym = name();
+                    auto depth = in.word();
+                    auto slot = in.word() - 1;
+                    return new MalLocal(sym, depth, slot);
+                }
+                case Modules::ListTag: {
+                    auto list = new MalList();
+                    for (auto count = in.word(); count > 0; --count)
+                        list->append(value());
+                    return list;
+                }
+                case Modules::VectorTag: {
+                    auto vec = new MalVector;
+                    for (auto count = in.word(); count > 0; --count)
+                        vec->append(value());
+                    return vec;
+                }
+                case Modules::MapTag: {
+                    auto hmap = new MalHashMap;
+                    for (auto count = in.word(); count > 0; --count) {
+                        auto key = value();
+                        hmap->set(key, value());
+                    }
+                    return hmap;
+                }
+                case PairTag: {
+                    auto lhs = value();
+                    return new MalPair(lhs, value());
+                }
+                case BuiltinTag: {
+                    auto name = string(in.text());
+                    auto found = builtins.find(name);
+                    if (found == builtins.end())
+                        throw Corrupt();
+                    return remember(new MalFunc(found->second, name));
+                }
+                case AtomTag: {
+                    auto atom = new MalAtom(MAL_NIL);
+                    remember(atom);
+                    atom->reset(value());
+                    return atom;
+                }
+                case FnTag:
+                    return fn();
+                case RefTag: {
+                    auto id = in.word();
+                    if (id >= objects.size() || !isValue[id])
+                        throw Corrupt();
+                    return static_cast< MalType* >(objects[id]);
+                }
+                default:
+                    // the rest are what modules.hpp reads
+                    return Modules::deserialize(in, tag);
+            }
+        }
+
+        Environ* env() {
+            switch (in.byte()) {
+                case TopLevelTag:
+                    return TOP_LEVEL;
+                case RefTag: {
+                    auto id = in.word();
+                    if (id >= objects.size() || isValue[id])
+                        throw Corrupt();
+                    return static_cast< Environ* >(objects[id]);
+                }
+                case EnvTag: {
+                    // numbered before what's in it, which can refer back to it
+                    auto e = new Environ(TOP_LEVEL);
+                    objects.push_back(e);
+                    isValue.push_back(false);
+                    auto parent = env();
+                    e->restore(parent, in.byte() != 0);
+                    for (auto count = in.word(); count > 0; --count) {
+                        auto sym = name();
+                        e->bind(sym, value());
+                    }
+                    return e;
+                }
+                default:
+                    throw Corrupt();
+            }
+        }
+
+    private:
+        // like fn* does (see EVAL), but from the body the function was resolved to back then
+        MalType* fn() {
+            auto fnName = string(in.text());
+            bool variadic = in.byte() != 0;
+            bool macro = in.byte() != 0;
+            vector < MalType * > params;
+            for (auto count = in.word(); count > 0; --count)
+                params.push_back(name());
+
+            auto fn = new MalTCOptFunc(MAL_NIL, params, TOP_LEVEL, variadic);
+            remember(fn);
+            fn->setName(fnName);
+            fn->changeMacroStatus(macro);
+            auto body = value();
+            auto env = this->env();
+            // a flat closure's captures are already in its environment, so it runs on the tree walker
+            GCObject* code = NULL;
+            if (VM::enabled && env == TOP_LEVEL)
+                code = VM::compile(params, variadic, body, NULL);
+            if (code == NULL)
+                body = Compiler::compile(body);
+            fn->fill(body, params, env);
+            fn->setCode(code);
+            return fn;
+        }
+
+        MalType* remember(MalType* val) {
+            objects.push_back(val);
+            isValue.push_back(true);
+            return val;
+        }
+
+        Input& in;
+        vector < MalSymbol * > names;
+        Core::BuiltIns builtins { Core::getCoreBuiltins() };
+        // what RefTag refers to, in the order it was written
+        vector < GCObject * > objects;
+        vector < bool > isValue;
+    };
+
+    // fills TOP_LEVEL from the image at path, in place of setting up the builtins
+    void restore(const string& path) {
+        try {
+            Core::MappedFile file(path);
+            Input in(Modules::checked(file.text(), MAGIC, VERSION));
+            if (in.word() != builtinsHash()) {
+                auto runExcep = RuntimeException();
+                runExcep.errMessage = "the image '" + path + "' was saved by a different build.";
+                throw runExcep;
+            }
+            Restorer restorer(in);
+            for (auto count = in.word(); count > 0; --count) {
+                auto name = restorer.name();
+                TOP_LEVEL->set(name, restorer.value());
+            }
+        } catch (Corrupt&) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "'" + path + "' is not an image (or is corrupt).";
+            throw runExcep;
+        }
+    }
+}
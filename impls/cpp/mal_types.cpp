@@ -1,4 +1,6 @@
+#include <unordered_map>
 #include "mal_types.hpp"
+#include "env.hpp"
 
 MalString* LIST = new MalString("List");
 MalString* VEC = new MalString("Vector");
@@ -14,6 +16,72 @@ MalString* NUM = new MalString("Int");
 MalString* FN = new MalString("Func");
 MalString* TCOFN = new MalString("TCOFunc");
 MalString* ATOM = new MalString("Atom");
+MalString* CODE = new MalString("Code");
+
+// these are functions so they exist before the static MalSymbols
+// in the step files get interned
+// every symbol name we have seen, mapped to its id
+unordered_map < string, size_t >& symbolIds() {
+    static unordered_map < string, size_t > ids;
+    return ids;
+}
+
+// the interned symbol for each id (NULL until someone interns it)
+vector < MalSymbol* >& symbolTable() {
+    static vector < MalSymbol* > table;
+    return table;
+}
+
+// the name of each id
+vector < string >& symbolNames() {
+    static vector < string > names;
+    return names;
+}
+
+size_t symbolId(string_view name) {
+    auto& ids = symbolIds();
+    auto [found, inserted] = ids.try_emplace(string(name), ids.size());
+    if (inserted) {
+        symbolTable().push_back(NULL);
+        symbolNames().push_back(string(name));
+    }
+    return found->second;
+}
+
+MalSymbol::MalSymbol(string_view str): s_str {str}, s_id { symbolId(str) } { }
+
+MalSymbol* MalSymbol::intern(string_view name) {
+    auto id = symbolId(name);
+    auto& sym = symbolTable()[id];
+    if (sym == NULL) {
+        // symbols hold no pointers, and there's a bounded number of them,
+        // so keeping them out of the collector costs nothing and keeps them from moving
+        GCPermanent permanent;
+        sym = new MalSymbol(name);
+    }
+    return sym;
+}
+
+MalSymbol* MalSymbol::forId(size_t id) {
+    auto sym = symbolTable()[id];
+    return sym != NULL ? sym : intern(symbolNames()[id]);
+}
+
+MalSymbol* MalSymbol::uninterned(string_view name) {
+    GCPermanent permanent;
+    return new MalSymbol(name);
+}
+
+MalKeyword* MalKeyword::intern(string_view name) {
+    static unordered_map < string, MalKeyword* > keywords;
+    auto& kw = keywords[string(name)];
+    if (kw == NULL) {
+        // same as symbols: no pointers inside, and never collected
+        GCPermanent permanent;
+        kw = new MalKeyword(name);
+    }
+    return kw;
+}
 
 MalList* MalType::as_list() {
     assert(type() == List);
@@ -50,21 +118,6 @@ MalString* MalType::as_string() {
     return static_cast<MalString *>(this);
 }
 
-MalNil* MalType::as_nil() {
-    assert(type() == Nil);
-    return static_cast<MalNil *>(this);
-}
-
-MalBoolean* MalType::as_boolean() {
-    assert(type() == Boolean);
-    return static_cast<MalBoolean *>(this);
-}
-
-MalInt* MalType::as_int() {
-    assert(type() == Int);
-    return static_cast<MalInt *>(this);
-}
-
 MalFunc* MalType::as_func() {
     assert(type() == Func);
     return static_cast<MalFunc *>(this);
@@ -90,3 +143,350 @@ MalAtom* MalType::as_atom() {
     assert(type() == Atom);
     return static_cast<MalAtom *>(this);
 }
+
+MalLocal* MalType::as_local() {
+    assert(type() == Local);
+    return static_cast<MalLocal *>(this);
+}
+
+MalNode* MalType::as_node() {
+    assert(type() == Node);
+    return static_cast<MalNode *>(this);
+}
+
+void MalTCOptFunc::fill(MalType* body, vector < MalType* > pars, Environ* e) {
+    GC::writeBarrier(this, body);
+    for (auto param : pars)
+        GC::writeBarrier(this, param);
+    GC::writeBarrier(this, e);
+    astBody = body;
+    parameters = pars;
+    envAtTimeOf = e;
+}
+
+void MalTCOptFunc::trace() {
+    GC::visit(astBody);
+    for (auto& param : parameters)
+        GC::visit(param);
+    GC::visit(envAtTimeOf);
+    GC::visit(code);
+}
+
+size_t MalType::hash() {
+    // functions and atoms are only equal to themselves, but they move, so their address won't do
+    return mixHash(type());
+}
+
+bool MalType::equals(MalType* other) {
+    return this == other;
+}
+
+// what the hash of an empty list or vector is. a sequence of n items adds 31^n times this
+static const size_t SEQUENCE_SEED = 0x2545f4914f6cdd1d;
+
+size_t MalSequence::hash() {
+    if (s_hash != 0)
+        return s_hash;
+    size_t h = 0;
+    if (layout == Linked) {
+        // every cell we get to caches the hash of the list it starts, so go to the first cell
+        // that already knows (or the end), then work back to this one
+        vector < MalList* > cells;
+        auto cell = static_cast< MalList* >(this);
+        while (cell->l_tail != NULL && cell->s_hash == 0) {
+            cells.push_back(cell);
+            cell = cell->l_tail;
+        }
+        h = cell->l_tail == NULL ? SEQUENCE_SEED : cell->s_hash;
+        for (auto it = cells.rbegin(); it != cells.rend(); ++it) {
+            h = hashOf((*it)->l_head) + 31 * h;
+            (*it)->s_hash = h;
+        }
+        return h;
+    }
+    // the same sum, front to back
+    size_t power = 1;
+    for (auto item : *this) {
+        h += hashOf(item) * power;
+        power *= 31;
+    }
+    h += (type() == Pair ? mixHash(Pair) : SEQUENCE_SEED) * power;
+    // (if it comes out as 0, it just doesn't get cached)
+    s_hash = h;
+    return h;
+}
+
+bool MalSequence::equals(MalType* other) {
+    auto type = this->type();
+    auto otherType = typeOf(other);
+    bool sequential = (type == List || type == Vector) && (otherType == List || otherType == Vector);
+    if (type != otherType && !sequential)
+        return false;
+    auto that = other->as_sequence();
+    if (count() != that->count())
+        return false;
+    if (s_hash != 0 && that->s_hash != 0 && s_hash != that->s_hash)
+        return false;
+
+    if (type == List && otherType == List) {
+        // two lists that share their tails are equal from where they start sharing
+        auto a = static_cast< MalList* >(this);
+        auto b = static_cast< MalList* >(that);
+        for (; a != b && a->l_tail != NULL; a = a->l_tail, b = b->l_tail) {
+            if (!equalsOf(a->l_head, b->l_head))
+                return false;
+        }
+        return true;
+    }
+    auto item = that->begin();
+    for (auto mine : *this) {
+        if (!equalsOf(mine, *item))
+            return false;
+        ++item;
+    }
+    return true;
+}
+
+size_t MalHashMap::hash() {
+    if (h_hash != 0)
+        return h_hash;
+    size_t h = mixHash(HashMap);
+    for (auto& entry : *this)
+        h += hashOf(entry.key) ^ mixHash(hashOf(entry.value));
+    h_hash = h | 1;
+    return h_hash;
+}
+
+bool MalHashMap::equals(MalType* other) {
+    if (typeOf(other) != HashMap)
+        return false;
+    auto that = other->as_hashmap();
+    if (h_count != that->h_count)
+        return false;
+    if (h_hash != 0 && that->h_hash != 0 && h_hash != that->h_hash)
+        return false;
+    for (auto& entry : *this) {
+        auto found = that->get(entry.key);
+        if (found == NULL || !equalsOf(entry.value, found))
+            return false;
+    }
+    return true;
+}
+
+// the hashmap trie. every node is 5 more bits into the hash than its parent,
+// and a node that's past the end of the hash is a plain list of colliding keys
+static const size_t HASH_BITS = sizeof(size_t) * 8;
+
+static uint32_t bitFor(size_t hash, size_t shift) {
+    return uint32_t(1) << ((hash >> shift) & 31);
+}
+
+static size_t indexFor(HashNode* node, uint32_t bit) {
+    return __builtin_popcount(node->bitmap & (bit - 1));
+}
+
+static HashNode::Entry* findIn(HashNode* node, size_t shift, size_t hash, MalType* key) {
+    while (node != NULL) {
+        if (shift >= HASH_BITS) {
+            for (auto& entry : node->entries) {
+                if (equalsOf(entry.key, key))
+                    return &entry;
+            }
+            return NULL;
+        }
+        auto bit = bitFor(hash, shift);
+        if ((node->bitmap & bit) == 0)
+            return NULL;
+        auto& entry = node->entries[indexFor(node, bit)];
+        if (entry.key != NULL)
+            return entry.hash == hash && equalsOf(entry.key, key) ? &entry : NULL;
+        node = entry.node;
+        shift += 5;
+    }
+    return NULL;
+}
+
+static HashNode* assocIn(HashNode* node, size_t shift, const HashNode::Entry& added, bool& grew) {
+    auto copy = node == NULL ? new HashNode : new HashNode(*node);
+    if (shift >= HASH_BITS) {
+        for (auto& entry : copy->entries) {
+            if (equalsOf(entry.key, added.key)) {
+                entry.value = added.value;
+                return copy;
+            }
+        }
+        copy->entries.push_back(added);
+        grew = true;
+        return copy;
+    }
+
+    auto bit = bitFor(added.hash, shift);
+    auto i = indexFor(copy, bit);
+    if ((copy->bitmap & bit) == 0) {
+        copy->bitmap |= bit;
+        copy->entries.insert(copy->entries.begin() + i, added);
+        grew = true;
+        return copy;
+    }
+    auto& entry = copy->entries[i];
+    if (entry.key == NULL) {
+        entry.node = assocIn(entry.node, shift + 5, added, grew);
+    } else if (entry.hash == added.hash && equalsOf(entry.key, added.key)) {
+        entry.value = added.value;
+    } else {
+        // two keys sharing these bits, move both a level down
+        auto below = assocIn(NULL, shift + 5, entry, grew);
+        grew = false;
+        below = assocIn(below, shift + 5, added, grew);
+        entry.key = NULL;
+        entry.value = NULL;
+        entry.node = below;
+    }
+    return copy;
+}
+
+// returns node itself when key isn't there, and NULL when nothing is left
+static HashNode* dissocIn(HashNode* node, size_t shift, size_t hash, MalType* key, bool& shrank) {
+    if (shift >= HASH_BITS) {
+        for (size_t i = 0; node->entries.size() > i; ++i) {
+            if (equalsOf(node->entries[i].key, key)) {
+                shrank = true;
+                if (node->entries.size() == 1)
+                    return NULL;
+                auto copy = new HashNode(*node);
+                copy->entries.erase(copy->entries.begin() + i);
+                return copy;
+            }
+        }
+        return node;
+    }
+
+    auto bit = bitFor(hash, shift);
+    if ((node->bitmap & bit) == 0)
+        return node;
+    auto i = indexFor(node, bit);
+    auto& entry = node->entries[i];
+    HashNode* below = NULL;
+    if (entry.key == NULL) {
+        below = dissocIn(entry.node, shift + 5, hash, key, shrank);
+        if (below == entry.node)
+            return node;
+    } else if (entry.hash != hash || !equalsOf(entry.key, key)) {
+        return node;
+    } else {
+        shrank = true;
+    }
+
+    if (below == NULL && node->entries.size() == 1)
+        return NULL;
+    auto copy = new HashNode(*node);
+    if (below != NULL) {
+        copy->entries[i].node = below;
+    } else {
+        copy->bitmap &= ~bit;
+        copy->entries.erase(copy->entries.begin() + i);
+    }
+    return copy;
+}
+
+void MalHashMap::set(MalType* key, MalType* val) {
+    h_hash = 0;
+    if (h_root == NULL) {
+        // keys are usually the same (interned) object, so try that before comparing them
+        for (size_t i = 0; h_count > i; ++i) {
+            if (h_small[i].key == key || equalsOf(h_small[i].key, key)) {
+                GC::writeBarrier(this, val);
+                h_small[i].value = val;
+                return;
+            }
+        }
+        if (h_count < SMALL) {
+            GC::writeBarrier(this, key);
+            GC::writeBarrier(this, val);
+            h_small[h_count++] = { key, val };
+            return;
+        }
+        // too big for the array, move everything into a trie
+        HashNode* root = NULL;
+        bool grew = false;
+        for (size_t i = 0; h_count > i; ++i) {
+            HashNode::Entry entry;
+            entry.key = h_small[i].key;
+            entry.value = h_small[i].value;
+            entry.hash = hashOf(entry.key);
+            entry.node = NULL;
+            root = assocIn(root, 0, entry, grew);
+        }
+        GC::writeBarrier(this, root);
+        h_root = root;
+    }
+
+    bool grew = false;
+    HashNode::Entry added;
+    added.key = key;
+    added.value = val;
+    added.hash = hashOf(key);
+    added.node = NULL;
+    auto root = assocIn(h_root, 0, added, grew);
+    GC::writeBarrier(this, root);
+    h_root = root;
+    if (grew)
+        ++h_count;
+}
+
+MalHashMap* MalHashMap::assoc(MalType* key, MalType* val) {
+    auto res = new MalHashMap(*this);
+    res->set(key, val);
+    return res;
+}
+
+MalHashMap* MalHashMap::dissoc(MalType* key) {
+    if (h_root == NULL) {
+        for (size_t i = 0; h_count > i; ++i) {
+            if (h_small[i].key == key || equalsOf(h_small[i].key, key)) {
+                auto res = new MalHashMap(*this);
+                copy(h_small.begin() + i + 1, h_small.begin() + h_count, res->h_small.begin() + i);
+                --res->h_count;
+                res->h_hash = 0;
+                return res;
+            }
+        }
+        return this;
+    }
+    // a trie that shrinks stays a trie
+    bool shrank = false;
+    auto root = dissocIn(h_root, 0, hashOf(key), key, shrank);
+    if (!shrank)
+        return this;
+    auto res = new MalHashMap;
+    res->h_root = root;
+    res->h_count = h_count - 1;
+    return res;
+}
+
+MalType* MalHashMap::get(MalType* key) {
+    if (h_root == NULL) {
+        for (size_t i = 0; h_count > i; ++i) {
+            if (h_small[i].key == key || equalsOf(h_small[i].key, key))
+                return h_small[i].value;
+        }
+        return NULL;
+    }
+    auto found = findIn(h_root, 0, hashOf(key), key);
+    return found == NULL ? NULL : found->value;
+}
+
+MalType* MalHashMap::get(MalType* key, size_t& slot) {
+    if (h_root != NULL)
+        return get(key);
+    // maps built by the same code put their keys in the same order
+    if (h_count > slot && h_small[slot].key == key)
+        return h_small[slot].value;
+    for (size_t i = 0; h_count > i; ++i) {
+        if (h_small[i].key == key || equalsOf(h_small[i].key, key)) {
+            slot = i;
+            return h_small[i].value;
+        }
+    }
+    return NULL;
+}
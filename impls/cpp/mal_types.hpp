@@ -6,6 +6,9 @@
 #include <string_view>
 #include <functional>
 #include <map>
+#include <array>
+#include <charconv>
+#include "gc.hpp"
 
 using namespace std;
 
@@ -18,25 +21,34 @@ class MalHashMap;
 class MalSymbol;
 class MalKeyword;
 class MalString;
-class MalNil;
-class MalBoolean;
-class MalInt;
 class MalFunc;
 class MalTCOptFunc;
 class MalSpreader;
 class MalAtom;
+class MalLocal;
+class MalNode;
 
 enum Type {
     List, Vector, Pair, HashMap, Symbol,
     Keyword, String, Nil, Boolean, Int,
-    Func, Seq, Spreader, TCOptFunc, Atom
+    Func, Seq, Spreader, TCOptFunc, Atom,
+    Local, Node
 };
 
-class MalType {
+class MalType : public GCObject {
 public:
     virtual Type type() = 0;
     virtual MalString* stringedType() = 0;
     virtual string inspect(bool readably=true) = 0;
+    // appends what inspect returns to out. collections (and strings) override it to write
+    // straight into out, so printing a big value builds one string instead of one per item
+    virtual void print(string& out, bool readably=true) {
+        out += inspect(readably);
+    }
+    // structural: values that are equal hash the same. by default a value is only equal
+    // to itself (functions, atoms...), collections and the types they can hold override both
+    virtual size_t hash();
+    virtual bool equals(MalType* other);
     virtual ~MalType() { }
     MalList* as_list();
     MalVector* as_vector();
@@ -45,14 +57,13 @@ public:
     MalSymbol* as_symbol();
     MalKeyword* as_keyword();
     MalString* as_string();
-    MalNil* as_nil();
-    MalBoolean* as_boolean();
-    MalInt* as_int();
     MalFunc* as_func();
     MalSequence* as_sequence();
     MalSpreader* as_spreader();
     MalTCOptFunc* as_tcoptfunc();
     MalAtom* as_atom();
+    MalLocal* as_local();
+    MalNode* as_node();
 };
 
 extern MalString* LIST;
@@ -69,6 +80,27 @@ extern MalString* NUM;
 extern MalString* FN;
 extern MalString* TCOFN;
 extern MalString* ATOM;
+extern MalString* CODE;
+
+// these work on any value, including the immediates (see below).
+// only call MalType's methods directly on a value you know is on the heap
+inline Type typeOf(MalType* val);
+inline MalString* stringedTypeOf(MalType* val);
+inline string inspectOf(MalType* val, bool readably=true);
+inline void printOf(MalType* val, string& out, bool readably=true);
+
+// what = and hashmaps go by. lists and vectors with equal items are equal,
+// otherwise equal values have the same type and equal contents
+inline size_t hashOf(MalType* val);
+inline bool equalsOf(MalType* a, MalType* b);
+
+// spreads the bits of x over the whole word (the finalizer of splitmix64),
+// so values that differ in a few low bits don't end up in the same branches of a hashmap
+inline size_t mixHash(size_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
 
 class TypeException : exception {
 public:
@@ -90,92 +122,421 @@ public:
     string errMessage;
 };
 
+// the interface printers and builtins use for lists, vectors and pairs.
+// a list is a chain of cells (see MalList), a vector a trie of arrays (see MalVector)
+// and a pair keeps its items in an array (see MalArray). which one a sequence is,
+// is known without a virtual call, so reading items stays as cheap as it was
+// when everything was an array
 class MalSequence : public MalType {
 public:
-    MalSequence() { }
-    virtual ~MalSequence() { }
-
-    string contents(bool readable=true) {
-        string out = "";
-        for (int i = 0; stored.size() > i; ++i) {
-            auto item = stored[i];       
-            if ((!readable) && (item->type() == List || item->type() == Vector)) {
-                out += item->as_sequence()->contents(readable);
-                if (i + 1 != stored.size())
-                    out += " ";
-                continue;
-            } 
-            auto nonseq = item->inspect(readable);
-            out += nonseq;
-
-            if (i + 1 != stored.size())
-                out += " ";
+    // walks any kind: a position in an array (for a vector, in one of its arrays),
+    // or the cell we are at in a list
+    class iterator {
+    public:
+        iterator(MalType* const* i, MalList* c) : item {i}, cell {c} { }
+        iterator(MalVector* v, size_t from) : cell {NULL}, vec {v} {
+            load(from);
         }
-        return out;
-    }
-    
-    // add new item to list
-    void append(MalType* item) {
-        stored.push_back(item);
-    }
 
-    auto items() {
-        return stored;
-    }
+        MalType* operator*() const;
+        iterator& operator++();
+
+        bool operator==(const iterator& other) const {
+            return item == other.item && cell == other.cell;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        void load(size_t from);
+
+        MalType* const* item;
+        MalList* cell;
+        // for a vector: the end of the array item points into, and where the next one starts
+        MalVector* vec { NULL };
+        MalType* const* arrayEnd { NULL };
+        size_t next { 0 };
+    };
+
+    // the items, separated by spaces
+    void contents(string& out, bool readable=true);
+
+    // add new item to the end. for a list, only while it is being built (see MalList)
+    void append(MalType* item);
+
+    // computed once, and cached (a list's in every cell it walks through).
+    // the hash of a list or vector is the hash of its first item plus 31 times the hash
+    // of the rest, which a cons cell can work out from the hash its tail already has
+    size_t hash();
+    // stops at the first item that differs, or right away when the hashes are known and differ
+    bool equals(MalType* other);
+
+    // a copy of the items, for holding on to (in a GCRoot) across anything that might collect
+    vector < MalType* > items();
+
+    // the view: reads the items in place, without copying them.
+    // an iterator, or an item read out of it, is only good until the next collection.
+    // at() walks the cells of a list, prefer iterating when you want more than one item
+    size_t count();
+    bool empty();
+    MalType* at(size_t i);
+    iterator begin();
+    iterator end();
 
 protected:
-    vector < MalType* > stored;
+    enum Layout : uint8_t { Linked, Array, Trie };
+
+    MalSequence(Layout l) : layout {l} { }
+
+    Layout layout;
+    // 0 until hash() gets called, and after anything gets appended
+    size_t s_hash { 0 };
 };
 
+// an immutable singly linked list: every cell holds an item and the list of the items after it,
+// which any number of other lists can share. so (cons x xs) is one new cell pointing at xs,
+// (rest xs) is the cell xs points at, and neither copies anything.
+// the empty list is a cell without an item (its tail is NULL), every chain ends in one
 class MalList : public MalSequence {
 public:
-    MalList() { }
-    MalList(vector < MalType* > items) {
-        stored = items;
+    MalList() : MalSequence(Linked) { }
+
+    MalList(vector < MalType* > items) : MalSequence(Linked) {
+        if (items.empty())
+            return;
+        // build the cells back to front, this one is the first
+        auto next = new MalList;
+        l_end = next;
+        for (size_t i = items.size() - 1; i > 0; --i)
+            next = new MalList(items[i], next);
+        l_head = items[0];
+        l_tail = next;
+        l_length = items.size();
     }
 
+    // cons
+    MalList(MalType* first, MalList* rest)
+    : MalSequence(Linked), l_head {first}, l_tail {rest}, l_length {rest->l_length + 1} { }
+
     Type type() {
         return List;
     }
 
+    GCObject* relocate() {
+        return new MalList(std::move(*this));
+    }
+
     MalString* stringedType() {
         return LIST;
     }
 
     string inspect(bool readably=true) {
-        string out = "(";
-        out += contents(readably);
+        string out;
+        print(out, readably);
+        return out;
+    }
+
+    void print(string& out, bool readably=true) {
+        out += '(';
+        contents(out, readably);
         out += ')';
+    }
 
-        return out;
+    // first and rest are only for a non empty list
+    MalType* first() {
+        return l_head;
+    }
+
+    MalList* rest() {
+        if (l_stale)
+            fixLengths();
+        return l_tail;
+    }
+
+    // lists are built front to back by appending to a new one: the item goes into the empty cell
+    // at the end, which gets a new empty cell after it. once a list has been handed to anything
+    // else it must not be appended to anymore, the cells are shared from then on
+    void append(MalType* item) {
+        auto cell = l_tail == NULL ? this : l_end;
+        assert(cell != NULL && cell->l_tail == NULL);
+        auto end = new MalList;
+        GC::writeBarrier(cell, item);
+        GC::writeBarrier(cell, end);
+        cell->l_head = item;
+        cell->l_tail = end;
+        cell->l_length = 1;
+        GC::writeBarrier(this, end);
+        l_end = end;
+        s_hash = 0;
+        if (cell != this)
+            ++l_length;
+        // the cells in between still count only what came after them when they were added
+        l_stale = cell != this;
+    }
+
+    // ends the list being built with the items of rest, sharing all of rest's cells but its first.
+    // nothing can be appended after this
+    void attach(MalList* rest) {
+        auto cell = l_tail == NULL ? this : l_end;
+        assert(cell != NULL && cell->l_tail == NULL);
+        if (rest->l_tail == NULL)
+            return;
+        GC::writeBarrier(cell, rest->l_head);
+        GC::writeBarrier(cell, rest->l_tail);
+        cell->l_head = rest->l_head;
+        cell->l_tail = rest->l_tail;
+        cell->l_length = rest->l_length;
+        if (cell != this)
+            l_length += rest->l_length;
+        l_stale = cell != this;
+        s_hash = 0;
+        l_end = cell;
+    }
+
+    void trace() {
+        GC::visit(l_head);
+        GC::visit(l_tail);
+        GC::visit(l_end);
+    }
+
+private:
+    friend class MalSequence;
+    friend class MalSequence::iterator;
+
+    // appending leaves the lengths of the cells after the first one behind,
+    // they get fixed the first time anyone can get to them (by taking the rest of this)
+    void fixLengths() {
+        auto n = l_length;
+        for (auto cell = this; cell != l_end; cell = cell->l_tail)
+            cell->l_length = n--;
+        l_stale = false;
+    }
+
+    bool l_stale { false };
+    MalType* l_head { NULL };
+    MalList* l_tail { NULL };
+    size_t l_length { 0 };
+    // the last cell, for append and attach. only set on a list that is being built
+    MalList* l_end { NULL };
+};
+
+// pairs: the items in an array
+class MalArray : public MalSequence {
+public:
+    void append(MalType* item) {
+        GC::writeBarrier(this, item);
+        stored.push_back(item);
+        s_hash = 0;
     }
+
+    void trace() {
+        for (auto& item : stored)
+            GC::visit(item);
+    }
+
+protected:
+    friend class MalSequence;
+
+    MalArray() : MalSequence(Array) { }
+
+    vector < MalType* > stored;
 };
 
+// the nodes of a vector's trie (see MalVector)
+class VectorLeaf : public GCObject {
+public:
+    VectorLeaf(const vector < MalType* >& from) {
+        copy(from.begin(), from.end(), items.begin());
+    }
+
+    void trace() {
+        for (auto& item : items)
+            GC::visit(item);
+    }
+
+    GCObject* relocate() {
+        return new VectorLeaf(std::move(*this));
+    }
+
+    array < MalType*, 32 > items;
+};
+
+class VectorBranch : public GCObject {
+public:
+    VectorBranch() {
+        kids.fill(NULL);
+    }
+
+    void trace() {
+        for (auto& kid : kids)
+            GC::visit(kid);
+    }
+
+    GCObject* relocate() {
+        return new VectorBranch(std::move(*this));
+    }
+
+    // branches, or leaves for the branches right above the leaves
+    array < GCObject*, 32 > kids;
+};
+
+// a persistent vector, like clojure's: the items are kept in arrays of 32, the leaves
+// of a trie that branches 32 ways, plus a tail array of the last (up to) 32 items
+// that isn't in the trie yet. so nth walks down a handful of levels at most,
+// append goes into the tail (and moves it into the trie when it fills up), and the
+// vectors conj and assoc return copy only the path down to the item that changed,
+// sharing the rest of the trie with the vector they came from.
+// the tail is never shared, which is why appending in place stays safe
 class MalVector : public MalSequence {
 public:
-    MalVector() { }
-    MalVector(vector < MalType* > items) {
-        stored = items;
+    MalVector() : MalSequence(Trie) { }
+    MalVector(vector < MalType* > items) : MalSequence(Trie) {
+        for (auto item : items)
+            append(item);
     }
 
     Type type() {
         return Vector;
     }
 
+    GCObject* relocate() {
+        return new MalVector(std::move(*this));
+    }
+
     MalString* stringedType() {
         return VEC;
     }
 
     string inspect(bool readably=true) {
-        string out = "[";
-        out += contents(readably);
+        string out;
+        print(out, readably);
+        return out;
+    }
+
+    void print(string& out, bool readably=true) {
+        out += '[';
+        contents(out, readably);
         out += ']';
+    }
 
-        return out;
+    MalType* nth(size_t i) {
+        return arrayFor(i)[i & 31];
     }
+
+    void append(MalType* item) {
+        if (v_count - tailOffset() == 32) {
+            // the tail is full, it becomes a leaf of the trie
+            auto leaf = new VectorLeaf(v_tail);
+            VectorBranch* root;
+            if ((v_count >> 5) > (size_t(1) << v_shift)) {
+                // no room left under the root, add a level on top
+                root = new VectorBranch;
+                root->kids[0] = v_root;
+                root->kids[1] = newPath(v_shift, leaf);
+                v_shift += 5;
+            } else {
+                root = pushTail(v_shift, v_root, leaf);
+            }
+            GC::writeBarrier(this, root);
+            v_root = root;
+            v_tail.clear();
+        }
+        GC::writeBarrier(this, item);
+        v_tail.push_back(item);
+        ++v_count;
+        s_hash = 0;
+    }
+
+    // a new vector with item added at the end
+    MalVector* conj(MalType* item) {
+        auto res = new MalVector(*this);
+        res->append(item);
+        return res;
+    }
+
+    // a new vector with the item at i replaced (or added, when i is the count)
+    MalVector* assoc(size_t i, MalType* item) {
+        if (i == v_count)
+            return conj(item);
+        auto res = new MalVector(*this);
+        res->s_hash = 0;
+        auto offset = tailOffset();
+        if (i >= offset)
+            res->v_tail[i - offset] = item;
+        else
+            res->v_root = assocIn(v_shift, v_root, i, item);
+        return res;
+    }
+
+    void trace() {
+        GC::visit(v_root);
+        for (auto& item : v_tail)
+            GC::visit(item);
+    }
+
+private:
+    friend class MalSequence;
+    friend class MalSequence::iterator;
+
+    // the index of the first item in the tail
+    size_t tailOffset() {
+        return v_count < 32 ? 0 : ((v_count - 1) >> 5) << 5;
+    }
+
+    // the array holding item i
+    MalType* const* arrayFor(size_t i) {
+        if (i >= tailOffset())
+            return v_tail.data();
+        auto node = v_root;
+        for (auto level = v_shift; level > 5; level -= 5)
+            node = static_cast< VectorBranch* >(node->kids[(i >> level) & 31]);
+        return static_cast< VectorLeaf* >(node->kids[(i >> 5) & 31])->items.data();
+    }
+
+    // a copy of parent (level bits up from the items) with leaf added as its last leaf
+    VectorBranch* pushTail(size_t level, VectorBranch* parent, VectorLeaf* leaf) {
+        auto node = parent == NULL ? new VectorBranch : new VectorBranch(*parent);
+        auto sub = ((v_count - 1) >> level) & 31;
+        if (level == 5) {
+            node->kids[sub] = leaf;
+        } else {
+            auto child = parent == NULL ? NULL : static_cast< VectorBranch* >(parent->kids[sub]);
+            node->kids[sub] = child == NULL ? newPath(level - 5, leaf) : pushTail(level - 5, child, leaf);
+        }
+        return node;
+    }
+
+    // branches down to leaf, level bits up from the items
+    GCObject* newPath(size_t level, VectorLeaf* leaf) {
+        if (level == 0)
+            return leaf;
+        auto node = new VectorBranch;
+        node->kids[0] = newPath(level - 5, leaf);
+        return node;
+    }
+
+    VectorBranch* assocIn(size_t level, VectorBranch* parent, size_t i, MalType* item) {
+        auto node = new VectorBranch(*parent);
+        auto sub = (i >> level) & 31;
+        if (level == 5) {
+            auto leaf = new VectorLeaf(*static_cast< VectorLeaf* >(parent->kids[sub]));
+            leaf->items[i & 31] = item;
+            node->kids[sub] = leaf;
+        } else {
+            node->kids[sub] = assocIn(level - 5, static_cast< VectorBranch* >(parent->kids[sub]), i, item);
+        }
+        return node;
+    }
+
+    size_t v_count { 0 };
+    size_t v_shift { 5 };
+    VectorBranch* v_root { NULL };
+    vector < MalType* > v_tail;
 };
 
-class MalPair : public MalSequence {
+class MalPair : public MalArray {
 public:
     MalPair(MalType* lhs, MalType* rhs) {
         stored.push_back(lhs);
@@ -186,96 +547,401 @@ public:
         return Pair;
     }
 
+    GCObject* relocate() {
+        return new MalPair(std::move(*this));
+    }
+
     MalString* stringedType() {
         return PAIR;
     }
 
     string inspect(bool readably=true) {
-        string out = "(";
-        string lhs = stored.at(0)->inspect(readably);
-        string rhs = stored.at(1)->inspect(readably);
-        out += lhs + " . " + rhs + ")";
+        string out;
+        print(out, readably);
         return out;
     }
+
+    void print(string& out, bool readably=true) {
+        out += '(';
+        printOf(stored.at(0), out, readably);
+        out += " . ";
+        printOf(stored.at(1), out, readably);
+        out += ')';
+    }
 };
 
+inline MalType* MalSequence::iterator::operator*() const {
+    return cell != NULL ? cell->l_head : *item;
+}
+
+inline MalSequence::iterator& MalSequence::iterator::operator++() {
+    if (cell != NULL) {
+        cell = cell->l_tail;
+        if (cell->l_tail == NULL)
+            cell = NULL;
+    } else if (++item == arrayEnd) {
+        load(next);
+    }
+    return *this;
+}
+
+inline void MalSequence::iterator::load(size_t from) {
+    if (from >= vec->v_count) {
+        item = NULL;
+        arrayEnd = NULL;
+        return;
+    }
+    auto start = from & ~size_t(31);
+    auto items = vec->arrayFor(from);
+    item = items + (from - start);
+    arrayEnd = items + min(vec->v_count - start, size_t(32));
+    next = start + 32;
+}
+
+inline void MalSequence::append(MalType* item) {
+    switch (layout) {
+        case Linked:
+            static_cast< MalList* >(this)->append(item);
+            break;
+        case Trie:
+            static_cast< MalVector* >(this)->append(item);
+            break;
+        default:
+            static_cast< MalArray* >(this)->append(item);
+    }
+}
+
+inline size_t MalSequence::count() {
+    switch (layout) {
+        case Linked:
+            return static_cast< MalList* >(this)->l_length;
+        case Trie:
+            return static_cast< MalVector* >(this)->v_count;
+        default:
+            return static_cast< MalArray* >(this)->stored.size();
+    }
+}
+
+inline bool MalSequence::empty() {
+    if (layout == Linked)
+        return static_cast< MalList* >(this)->l_tail == NULL;
+    return count() == 0;
+}
+
+inline MalType* MalSequence::at(size_t i) {
+    switch (layout) {
+        case Linked: {
+            auto it = begin();
+            while (i-- > 0)
+                ++it;
+            return *it;
+        }
+        case Trie:
+            return static_cast< MalVector* >(this)->nth(i);
+        default:
+            return static_cast< MalArray* >(this)->stored[i];
+    }
+}
+
+inline MalSequence::iterator MalSequence::begin() {
+    switch (layout) {
+        case Linked:
+            return iterator(static_cast< MalType* const* >(NULL), empty() ? NULL : static_cast< MalList* >(this));
+        case Trie:
+            return iterator(static_cast< MalVector* >(this), 0);
+        default:
+            return iterator(static_cast< MalArray* >(this)->stored.data(), NULL);
+    }
+}
+
+inline MalSequence::iterator MalSequence::end() {
+    if (layout == Array) {
+        auto& stored = static_cast< MalArray* >(this)->stored;
+        return iterator(stored.data() + stored.size(), NULL);
+    }
+    return iterator(static_cast< MalType* const* >(NULL), NULL);
+}
+
+inline vector < MalType* > MalSequence::items() {
+    if (layout == Array)
+        return static_cast< MalArray* >(this)->stored;
+    vector < MalType* > copy;
+    copy.reserve(count());
+    for (auto item : *this)
+        copy.push_back(item);
+    return copy;
+}
+
+inline void MalSequence::contents(string& out, bool readable) {
+    bool first = true;
+    for (auto item : *this) {
+        if (!first)
+            out += ' ';
+        first = false;
+        if ((!readable) && (typeOf(item) == List || typeOf(item) == Vector)) {
+            item->as_sequence()->contents(out, readable);
+            continue;
+        }
+        printOf(item, out, readable);
+    }
+}
+
+// a key and its value, what iterating over a hashmap gives you
+struct MapEntry {
+    MalType* key;
+    MalType* value;
+};
+
+// a node of a hashmap's trie (see MalHashMap). the bitmap says which of the 32 possible
+// children (one for every value of the 5 bits of the hash this level looks at) are there,
+// entries holds just those, in order. an entry is either a key and its value,
+// or (with a NULL key) the node for all the keys that share those bits.
+// once the hash runs out of bits, a node is a plain list of keys with the same hash
+class HashNode : public GCObject {
+public:
+    struct Entry : MapEntry {
+        size_t hash;
+        HashNode* node;
+    };
+
+    void trace() {
+        for (auto& entry : entries) {
+            GC::visit(entry.key);
+            GC::visit(entry.value);
+            GC::visit(entry.node);
+        }
+    }
+
+    GCObject* relocate() {
+        return new HashNode(std::move(*this));
+    }
+
+    uint32_t bitmap { 0 };
+    vector < Entry > entries;
+};
+
+// most maps are small (a handful of keyword keys), so up to SMALL entries live right in the map,
+// in an array we scan. past that the map moves them into a hash array mapped trie, keyed by
+// the structural hash of the keys (see hashOf): a lookup follows 5 bits of the hash per level,
+// and compares keys only once it got to the one entry that can hold it.
+// either way it's persistent, assoc and dissoc copy the small array or just the nodes on the path
+// to the key, and share everything else with the map they came from
 class MalHashMap : public MalType {
 public:
+    static const size_t SMALL = 8;
+
+    // walks the entries (the trie depth first). like MalSequence's, only good until the next collection
+    class iterator {
+    public:
+        iterator(const MapEntry* from, const MapEntry* to) : item {from}, end {to} { }
+
+        iterator(HashNode* root) {
+            path.push_back({ root, 0 });
+            settle();
+        }
+
+        const MapEntry& operator*() const {
+            if (item != NULL)
+                return *item;
+            return path.back().first->entries[path.back().second];
+        }
+
+        iterator& operator++() {
+            if (item != NULL) {
+                if (++item == end)
+                    item = NULL;
+                return *this;
+            }
+            ++path.back().second;
+            settle();
+            return *this;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return item != other.item || path != other.path;
+        }
+
+    private:
+        // moves down to the next entry that is a key, or up when a node is done
+        void settle() {
+            while (!path.empty()) {
+                auto& [node, i] = path.back();
+                if (i == node->entries.size()) {
+                    path.pop_back();
+                    if (!path.empty())
+                        ++path.back().second;
+                } else if (node->entries[i].key == NULL) {
+                    path.push_back({ node->entries[i].node, 0 });
+                } else {
+                    return;
+                }
+            }
+        }
+
+        // in the small array, NULL once we're past it
+        const MapEntry* item { NULL };
+        const MapEntry* end { NULL };
+        vector < pair < HashNode*, size_t > > path;
+    };
+
     MalHashMap() { }
-    
-    MalHashMap(map < string, MalType* > mp): hmap {mp} { }
 
     Type type() {
         return HashMap;
     }
+
+    GCObject* relocate() {
+        return new MalHashMap(std::move(*this));
+    }
     
     MalString* stringedType() {
         return HASHMAP;
     }
 
-    void set(string key, MalType *actualKey, MalType* val) {
-        hmap[key] = new MalPair(val, actualKey);
-    }
+    // for building a new map, before anything else can see it
+    void set(MalType* key, MalType* val);
+
+    // a new map with key set to val, or without key
+    MalHashMap* assoc(MalType* key, MalType* val);
+    MalHashMap* dissoc(MalType* key);
 
-    MalType* get(MalType* key) {
-        auto search = hmap.find(key->inspect());
+    // the value at key, NULL if there is none
+    MalType* get(MalType* key);
+    // the same, for a caller that keeps asking for one (interned) key.
+    // in a small map, slot is where to look first, and gets set to where the key was
+    MalType* get(MalType* key, size_t& slot);
 
-        if (search != hmap.end()) {
-            return search->second;
+    // cached like a sequence's. the entries can come in any order, so it's their sum
+    size_t hash();
+    bool equals(MalType* other);
+
+    // a copy of the entries as key, value, key, value..., for holding on to (in a GCRoot)
+    // across anything that might collect
+    vector < MalType* > items() {
+        vector < MalType* > copy;
+        copy.reserve(h_count * 2);
+        for (auto& entry : *this) {
+            copy.push_back(entry.key);
+            copy.push_back(entry.value);
         }
+        return copy;
+    }
+
+    // the view, like MalSequence's: entries with a key and a value, in place
+    size_t count() {
+        return h_count;
+    }
+
+    iterator begin() {
+        if (h_root != NULL)
+            return iterator(h_root);
+        if (h_count == 0)
+            return end();
+        return iterator(h_small.data(), h_small.data() + h_count);
+    }
 
-        return NULL;
+    iterator end() {
+        return iterator(NULL, NULL);
     }
 
-    auto items() {
-        return hmap;
+    void trace() {
+        GC::visit(h_root);
+        if (h_root == NULL) {
+            for (size_t i = 0; h_count > i; ++i) {
+                GC::visit(h_small[i].key);
+                GC::visit(h_small[i].value);
+            }
+        }
     }
 
     string inspect(bool readably=true) {
-        string out = "{";
-        for (auto item : hmap) {
-            out += item.first + " ";
-            auto pair = item.second->as_pair();
-            out += pair->items()[0]->inspect(readably) + " ";
+        string out;
+        print(out, readably);
+        return out;
+    }
+
+    void print(string& out, bool readably=true) {
+        auto start = out.size();
+        out += '{';
+        for (auto& entry : *this) {
+            printOf(entry.key, out);
+            out += ' ';
+            printOf(entry.value, out, readably);
+            out += ' ';
         }
         // overwrite the last append space 
         // only if we have list items
-        if (out.length() > 1) {
-            out[out.length()-1] = '}';
+        if (out.size() - start > 1) {
+            out.back() = '}';
         }
         else
             out += '}';
-
-        return out;
     }
 
 private:
-    map < string, MalType* > hmap;
+    // the first h_count entries, while h_root is NULL
+    array < MapEntry, SMALL > h_small;
+    HashNode* h_root { NULL };
+    size_t h_count { 0 };
+    size_t h_hash { 0 };
 };
 
-
+// symbols are interned: every name maps to a single MalSymbol (see intern),
+// and a small integer id that environments use as the key, so looking a symbol up
+// or comparing two of them never has to touch its name
 class MalSymbol : public MalType {
 public:
-    MalSymbol(string_view str): s_str {str} { }
+    // returns the canonical symbol for name, creating it (permanently) if needed
+    static MalSymbol* intern(string_view name);
+    // a (permanent) symbol with the same name and id as the canonical one,
+    // but a different address. lets EVAL tell forms it generated apart from the ones it read
+    static MalSymbol* uninterned(string_view name);
+    // the canonical symbol with the given id
+    static MalSymbol* forId(size_t id);
 
     Type type() {
         return Symbol;
     }
 
+    GCObject* relocate() {
+        return new MalSymbol(std::move(*this));
+    }
+
     MalString* stringedType() {
         return SYM;
     }
 
-    string str() {
+    const string& str() {
         return s_str;
     }
 
+    size_t id() {
+        return s_id;
+    }
+
+    size_t hash() {
+        return mixHash(s_id * 32 + Symbol);
+    }
+
+    // an uninterned symbol is the same symbol, just at another address
+    bool equals(MalType* other) {
+        return typeOf(other) == Symbol && other->as_symbol()->id() == s_id;
+    }
+
     string inspect(bool readably=true) {
         return str();
     }
 
+    void print(string& out, bool readably=true) {
+        out += s_str;
+    }
+
 protected:
+    // use intern instead. only MalSpreader (which isn't a plain symbol) creates one directly
+    MalSymbol(string_view str);
+
     string s_str;
+    size_t s_id;
 };
 
 class MalSpreader : public MalSymbol {
@@ -286,19 +952,79 @@ public:
         return Spreader;
     }
 
+    GCObject* relocate() {
+        return new MalSpreader(std::move(*this));
+    }
+
     MalString* stringedType() {
         return SPREADR;
     }
 };
 
+// a variable reference the resolver (see resolver.hpp) has already looked up:
+// it is bound depth frames up from where it is evaluated, at index slot of that frame.
+// a GLOBAL slot means it lives in TOP_LEVEL, which is depth frames up.
+// it only ever shows up in function bodies the resolver rewrote, as a stand-in for its symbol
+class MalLocal : public MalType {
+public:
+    static const size_t GLOBAL = SIZE_MAX;
+
+    MalLocal(MalSymbol* sym, size_t d, size_t s) : l_sym {sym}, l_depth {d}, l_slot {s} { }
+
+    Type type() {
+        return Local;
+    }
+
+    GCObject* relocate() {
+        return new MalLocal(std::move(*this));
+    }
+
+    MalString* stringedType() {
+        return SYM;
+    }
+
+    MalSymbol* symbol() {
+        return l_sym;
+    }
+
+    size_t depth() {
+        return l_depth;
+    }
+
+    size_t slot() {
+        return l_slot;
+    }
+
+    string inspect(bool readably=true) {
+        return l_sym->inspect(readably);
+    }
+
+    void print(string& out, bool readably=true) {
+        l_sym->print(out, readably);
+    }
+
+private:
+    // interned, so it never moves and needs no tracing
+    MalSymbol* l_sym;
+    size_t l_depth;
+    size_t l_slot;
+};
+
+// keywords are interned like symbols, so two keywords are equal only when
+// they are the same object, and a map lookup can compare keys by address
 class MalKeyword : public MalType {
 public:
-    MalKeyword(string_view str): k_str {str} { }
+    // returns the canonical keyword for name (without the ':'), creating it (permanently) if needed
+    static MalKeyword* intern(string_view name);
 
     Type type() {
         return Keyword;
     }
 
+    GCObject* relocate() {
+        return new MalKeyword(std::move(*this));
+    }
+
     MalString* stringedType() {
         return KEYWORD;
     }
@@ -307,8 +1033,27 @@ public:
         return ":" + k_str;
     }
 
+    void print(string& out, bool readably=true) {
+        out += ':';
+        out += k_str;
+    }
+
+    const string& name() {
+        return k_str;
+    }
+
+    size_t hash() {
+        if (k_hash == 0)
+            k_hash = mixHash(std::hash < string > {}(k_str) + Keyword) | 1;
+        return k_hash;
+    }
+
 private:
+    // use intern instead
+    MalKeyword(string_view str): k_str {str} { }
+
     string k_str;
+    size_t k_hash { 0 };
 };
 
 class MalString : public MalType {
@@ -319,6 +1064,10 @@ public:
         return String;
     }   
 
+    GCObject* relocate() {
+        return new MalString(std::move(*this));
+    }
+
     MalString* stringedType() {
         return STR;
     }
@@ -329,15 +1078,35 @@ public:
         return "";
     }
 
+    const string& str() {
+        return s_str;
+    }
+
+    size_t hash() {
+        if (s_hash == 0)
+            s_hash = mixHash(std::hash < string > {}(s_str) + String) | 1;
+        return s_hash;
+    }
+
+    bool equals(MalType* other) {
+        return typeOf(other) == String && other->as_string()->str() == s_str;
+    }
+
     string inspect(bool readably=true) {
-        return readably ? escape() : unescape(s_str);
+        string out;
+        print(out, readably);
+        return out;
     }
 
-    string unescape(string_view s) {
-        if (s.size() == 0)
-            return string(s);
+    void print(string& out, bool readably=true) {
+        if (readably)
+            escape(out);
+        else
+            unescape(s_str, out);
+    }
+
+    void unescape(string_view s, string& out) {
         auto ns = s;
-        string out = "";
         for (int i = 0; ns.size() > i; ++i) {
             char c = ns[i];
             switch (c) {
@@ -364,16 +1133,12 @@ public:
                 }
             }
         }
-        return out;
     }
 
-    string escape() {
-        if (s_str.size() == 0) {
-            return "\"" + s_str + "\"";
-        }
+    void escape(string& finalStr) {
         // extract string content without the parenthesis
-        auto stringContent = s_str;
-        string finalStr = "";
+        auto& stringContent = s_str;
+        finalStr += '"';
         for (size_t i = 0; i < stringContent.size(); ++i) {
             char c = stringContent[i];
             switch(c) {
@@ -408,78 +1173,94 @@ public:
                     finalStr += c;
             }
         }
-        return "\"" + finalStr + "\"";
+        finalStr += '"';
     }
 
 
 private:
     string s_str;
+    size_t s_hash { 0 };
 };
 
-class MalNil : public MalType {
+// nil, booleans and ints aren't heap objects. they are stored in the MalType* itself,
+// which is never a valid pointer for them since heap objects are (at least) 4 byte aligned:
+// ...xxx1 -> an Int, the value is the rest of the word (so only ints that fit in 63 bits,
+//            bigger ones are a MalBoxedInt)
+// ...0010 -> nil
+// ...0110 -> false
+// ...1010 -> true
+// so creating one never allocates, and the GC skips over them
+inline MalType* const MAL_NIL = reinterpret_cast< MalType* >(0b0010);
+inline MalType* const MAL_FALSE = reinterpret_cast< MalType* >(0b0110);
+inline MalType* const MAL_TRUE = reinterpret_cast< MalType* >(0b1010);
+
+inline bool isImmediate(MalType* val) {
+    return reinterpret_cast< uintptr_t >(val) & 0b11;
+}
+
+// an Int too big (either way) to be an immediate. makeInt only makes one for those,
+// so an int is always stored the one way and equal ints that are immediates are the same word
+class MalBoxedInt : public MalType {
 public:
-    MalNil() { }
+    MalBoxedInt(long val) : value {val} { }
 
     Type type() {
-        return Nil;
+        return Int;
     }
 
-    MalString* stringedType() {
-        return NIL_V;
+    GCObject* relocate() {
+        return new MalBoxedInt(value);
     }
 
-    string inspect(bool readably=true) {
-        return "nil";
+    MalString* stringedType() {
+        return NUM;
     }
-};
-
-class MalBoolean : public MalType {
-public:
-    MalBoolean(bool val) : value {val} { }
 
-    Type type() {
-        return Boolean;
+    long to_long() {
+        return value;
     }
 
-    MalString* stringedType() {
-        return BOOL;
+    string inspect(bool readably=true) {
+        return to_string(value);
     }
 
-    bool val() {
-        return value;
+    size_t hash() {
+        return mixHash(value);
     }
 
-    string inspect(bool readably=true) {
-        return value ? "true" : "false";
+    bool equals(MalType* other) {
+        return typeOf(other) == Int && !isImmediate(other)
+            && static_cast< MalBoxedInt* >(other)->value == value;
     }
 
 private:
-    bool value;
+    long value;
 };
 
-class MalInt : public MalType {
-public:
-    MalInt(long val) : value {val} { }
-
-    Type type() {
-        return Int;
-    }
+// the most an immediate Int holds, the 62 bits next to the tag and the sign
+const long IMMEDIATE_INT_MAX = (1L << 62) - 1;
+const long IMMEDIATE_INT_MIN = -(1L << 62);
 
-    MalString* stringedType() {
-        return NUM;
-    }
+inline MalType* makeInt(long val) {
+    if (val > IMMEDIATE_INT_MAX || val < IMMEDIATE_INT_MIN)
+        return new MalBoxedInt(val);
+    return reinterpret_cast< MalType* >((static_cast< uintptr_t >(val) << 1) | 1);
+}
 
-    long to_long() {
-        return value;
-    }
+inline long toLong(MalType* val) {
+    if (!isImmediate(val))
+        return static_cast< MalBoxedInt* >(val)->to_long();
+    // arithmetic shift, to keep the sign
+    return static_cast< long >(reinterpret_cast< intptr_t >(val)) >> 1;
+}
 
-    string inspect(bool readably=true) {
-        return to_string(value);
-    }
+inline MalType* makeBoolean(bool val) {
+    return val ? MAL_TRUE : MAL_FALSE;
+}
 
-private:
-    long value;
-};
+inline bool toBool(MalType* val) {
+    return val == MAL_TRUE;
+}
 
 // this means:
 // a FuncPtr points to an (unnamed) function that returns a pointer to a 
@@ -497,6 +1278,10 @@ public:
         return Func;
     }
 
+    GCObject* relocate() {
+        return new MalFunc(std::move(*this));
+    }
+
     MalString* stringedType() {
         return FN;
     }
@@ -509,28 +1294,38 @@ public:
         return "{function " + nameTag + "}";
     }
 
-    string name() {
+    const string& name() {
         return nameTag;
     }
 
     void setName(string name) {
         nameTag = name;
+        profiledAs = SIZE_MAX;
+    }
+
+    // the id the profiler knows it by (see Profile::functionOf), once it has looked it up
+    size_t profileId() {
+        return profiledAs;
+    }
+
+    void setProfileId(size_t id) {
+        profiledAs = id;
     }
 
 private:
     Function m_fn { NULL };
     string nameTag;
+    size_t profiledAs { SIZE_MAX };
 };
 
 class MalTCOptFunc : public MalType {
 public:
     MalTCOptFunc(MalType* body, vector < MalType* > pars, 
-                 Environ* e, MalFunc* fn, bool variadic=false) 
+                 Environ* e, bool variadic=false) 
     { 
         astBody = body;
         parameters = pars;
         envAtTimeOf = e;
-        actualFn = fn;
         isVariadic = variadic;
         isMacroFn = false;
     }
@@ -539,14 +1334,18 @@ public:
         return TCOptFunc;
     }
 
+    GCObject* relocate() {
+        return new MalTCOptFunc(std::move(*this));
+    }
+
     MalString* stringedType() {
         return TCOFN;
     }
 
     string inspect(bool readably=true) {
         if (!isMacroFn)
-            return "{TCOptFunction " + actualFn->name() + "}";
-        return "{Macro_TCOptFunction " + actualFn->name() + "}";
+            return "{TCOptFunction " + nameTag + "}";
+        return "{Macro_TCOptFunction " + nameTag + "}";
     }
 
     auto getParameters() {
@@ -561,8 +1360,22 @@ public:
         return astBody;
     }
 
-    auto getMalFunc() {
-        return actualFn;
+    const string& name() {
+        return nameTag;
+    }
+
+    void setName(string name) {
+        nameTag = name;
+        profiledAs = SIZE_MAX;
+    }
+
+    // the id the profiler knows it by (see Profile::functionOf), once it has looked it up
+    size_t profileId() {
+        return profiledAs;
+    }
+
+    void setProfileId(size_t id) {
+        profiledAs = id;
     }
 
     bool isVariad() {
@@ -577,29 +1390,60 @@ public:
         isMacroFn = is_macro;
     }
 
+    // the bytecode the VM runs instead of the body, if it could compile it (see vm.hpp)
+    GCObject* getCode() {
+        return code;
+    }
+
+    void setCode(GCObject* c) {
+        GC::writeBarrier(this, c);
+        code = c;
+    }
+
+    // for a function created before what it refers to (see image.hpp)
+    void fill(MalType* body, vector < MalType* > pars, Environ* e);
+
+    void trace();
+
 private:
     MalType* astBody;
     vector < MalType* > parameters;
     Environ* envAtTimeOf;
-    MalFunc* actualFn;
+    string nameTag { "<~lambda~>" };
+    size_t profiledAs { SIZE_MAX };
+    GCObject* code { NULL };
     bool isVariadic;
     bool isMacroFn;
 };
 
 class MalAtom : public MalType {
 public:
-    MalAtom(MalType* c) : content {c}, tag {"<|atom|>"} { }
+    MalAtom(MalType* c) : content {c} { }
 
     Type type() {
         return Atom;
     }
 
+    GCObject* relocate() {
+        return new MalAtom(std::move(*this));
+    }
+
     MalString* stringedType() {
         return ATOM;
     }
 
+    // printed from the current content, rather than kept up to date on every reset!
+    // (which made a big value in an atom cost as much to update as to print)
     string inspect(bool readably=true) {
-        return tag;
+        string out;
+        print(out, readably);
+        return out;
+    }
+
+    void print(string& out, bool readably=true) {
+        out += "(atom ";
+        printOf(content, out);
+        out += ')';
     }
 
     auto deref() {
@@ -607,19 +1451,127 @@ public:
     }
 
     void reset(MalType* n) {
+        GC::writeBarrier(this, n);
         content = n;
-        tag = "(atom " + n->inspect() + ")";
     }
 
-    string name() {
-        return tag;
+    void trace() {
+        GC::visit(content);
+    }
+
+private:
+    MalType* content;
+};
+
+// a form compiled by compiler.hpp: EVAL runs it without looking at (or copying) the form again.
+// it keeps the form it came from, to print it and to fall back on
+class MalNode : public MalType {
+public:
+    enum Kind {
+        ConstKind, IfKind, DoKind, LetKind, CondKind, FnKind,
+        DefKind, CallKind, VectorKind, MapKind, MacroKind, FormKind, KeyKind
+    };
+
+    MalNode(Kind k, MalType* f) : n_kind {k}, n_form {f} { }
+
+    Type type() {
+        return Node;
+    }
+
+    MalString* stringedType() {
+        return CODE;
+    }
+
+    string inspect(bool readably=true) {
+        return inspectOf(n_form, readably);
+    }
+
+    void print(string& out, bool readably=true) {
+        printOf(n_form, out, readably);
+    }
+
+    Kind kind() {
+        return n_kind;
+    }
+
+    MalType* form() {
+        return n_form;
     }
 
-    void setName(string n) {
-        tag = n;
+    void trace() {
+        GC::visit(n_form);
     }
 
 private:
-    MalType* content;
-    string tag;
-};
\ No newline at end of file
+    Kind n_kind;
+    MalType* n_form;
+};
+
+inline Type typeOf(MalType* val) {
+    if (!isImmediate(val))
+        return val->type();
+    if (reinterpret_cast< uintptr_t >(val) & 1)
+        return Int;
+    return val == MAL_NIL ? Nil : Boolean;
+}
+
+inline MalString* stringedTypeOf(MalType* val) {
+    if (!isImmediate(val))
+        return val->stringedType();
+    switch (typeOf(val)) {
+        case Int:
+            return NUM;
+        case Nil:
+            return NIL_V;
+        default:
+            return BOOL;
+    }
+}
+
+inline size_t hashOf(MalType* val) {
+    if (!isImmediate(val))
+        return val->hash();
+    return mixHash(reinterpret_cast< uintptr_t >(val));
+}
+
+inline bool equalsOf(MalType* a, MalType* b) {
+    if (a == b)
+        return true;
+    // immediates are only equal when they are the same word
+    if (isImmediate(a) || isImmediate(b))
+        return false;
+    return a->equals(b);
+}
+
+inline string inspectOf(MalType* val, bool readably) {
+    if (!isImmediate(val))
+        return val->inspect(readably);
+    switch (typeOf(val)) {
+        case Int:
+            return to_string(toLong(val));
+        case Nil:
+            return "nil";
+        default:
+            return toBool(val) ? "true" : "false";
+    }
+}
+
+inline void printOf(MalType* val, string& out, bool readably) {
+    if (!isImmediate(val)) {
+        val->print(out, readably);
+        return;
+    }
+    switch (typeOf(val)) {
+        case Int: {
+            char digits[24];
+            auto end = to_chars(digits, digits + sizeof digits, toLong(val)).ptr;
+            out.append(digits, end);
+            break;
+        }
+        case Nil:
+            out += "nil";
+            break;
+        default:
+            out += toBool(val) ? "true" : "false";
+    }
+}
@@ -0,0 +1,615 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mal_types.hpp"
+#include "env.hpp"
+#include "core.hpp"
+
+using namespace std;
+
+// load-file, and a cache of the files it has read (a .malc file per source file).
+// a file gets read and run one top level form at a time. on the way, each form is expanded
+// (if it is a macro call, like EVAL would do first anyway) and written out in a compact
+// binary form. the next time the file gets loaded, if the cache is still fresh, the forms
+// come straight out of it: one sequential read, no tokenizing, parsing or expanding.
+// a cache is fresh when the file has the same mtime and size it had when the cache was
+// written (or failing that, the same contents).
+// an expanded form also keeps the form it came from, and the macros it was expanded with,
+// each with a hash of its definition (see definitionHash). when TOP_LEVEL no longer binds
+// those same macros to those names by the time the form runs, the expansion is stale
+// (a different library defined them this time, say, or nothing did) and the form it came
+// from runs instead, which EVAL expands the way it would without a cache.
+// only the head of each top level form is expanded: expanding the ones inside function
+// bodies ahead of time would run those macros (and their arguments) at a different time.
+// caching is off unless $MAL_CACHE_DIR is set: the caches go there, named after a hash
+// of the file's absolute path
+namespace Modules {
+    const char MAGIC[4] = { 'M', 'A', 'L', 'C' };
+    // bump when the layout changes, or what the reader makes of a file does
+    // (2: ints past 63 bits read as themselves instead of wrapping around,
+    //  3: expansions carry the macros they were made with)
+    const uint64_t VERSION = 3;
+
+    enum Tag : uint8_t {
+        NilTag, TrueTag, FalseTag, IntTag, StringTag, SymbolTag,
+        KeywordTag, SpreadTag, ListTag, VectorTag, MapTag
+    };
+
+    // thrown for a cache file that isn't laid out like one
+    struct Corrupt { };
+
+    struct Stamp {
+        uint64_t mtime { 0 };
+        uint64_t size { 0 };
+
+        bool operator==(const Stamp& other) const {
+            return mtime == other.mtime && size == other.size;
+        }
+    };
+
+    bool stampOf(const string& path, Stamp& stamp) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return false;
+#if defined(__APPLE__)
+        auto mtime = info.st_mtimespec;
+#else
+        auto mtime = info.st_mtim;
+#endif
+        stamp.mtime = (uint64_t) mtime.tv_sec * 1000000000 + mtime.tv_nsec;
+        stamp.size = info.st_size;
+        return true;
+    }
+
+    uint64_t contentHash(string_view text) {
+        uint64_t hash = text.size();
+        size_t i = 0;
+        for (; i + 8 <= text.size(); i += 8) {
+            uint64_t word;
+            memcpy(&word, text.data() + i, 8);
+            hash = mixHash(hash ^ word);
+        }
+        for (; i < text.size(); ++i)
+            hash = mixHash(hash ^ (uint8_t) text[i]);
+        return hash;
+    }
+
+    // where the cache for path goes, or "" when there isn't going to be one
+    string cacheFor(const string& path, string& absolute) {
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved) == NULL)
+            return "";
+        absolute = resolved;
+
+        auto dir = getenv("MAL_CACHE_DIR");
+        if (dir == NULL || *dir == '\0')
+            return "";
+
+        char name[32];
+        snprintf(name, sizeof name, "%016llx.malc", (unsigned long long) contentHash(absolute));
+        return string(dir) + "/" + name;
+    }
+
+    // writing
+
+    // 7 bits at a time, low ones first, with the top bit set on all but the last byte
+    void put(string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out += (char) (value | 0x80);
+            value >>= 7;
+        }
+        out += (char) value;
+    }
+
+    void put(string& out, string_view text) {
+        put(out, text.size());
+        out.append(text);
+    }
+
+    // false for what the reader can't have made (functions, atoms...), which a macro can
+    // put in its expansion. a file with one of those doesn't get a cache
+    bool serialize(MalType* value, string& out) {
+        switch (typeOf(value)) {
+            case Nil:
+                out += (char) NilTag;
+                return true;
+            case Boolean:
+                out += (char) (value == MAL_TRUE ? TrueTag : FalseTag);
+                return true;
+            case Int:
+                out += (char) IntTag;
+                // zigzag, so small negative numbers stay small too
+                put(out, ((uint64_t) toLong(value) << 1) ^ (uint64_t) (toLong(value) >> 63));
+                return true;
+            case String:
+                out += (char) StringTag;
+                put(out, value->as_string()->str());
+                return true;
+            case Symbol: {
+                // not the fn* the resolver marks its functions with, say
+                auto sym = value->as_symbol();
+                if (MalSymbol::intern(sym->str()) != sym)
+                    return false;
+                out += (char) SymbolTag;
+                put(out, sym->str());
+                return true;
+            }
+            case Keyword:
+                out += (char) KeywordTag;
+                put(out, value->as_keyword()->name());
+                return true;
+            case Spreader:
+                out += (char) SpreadTag;
+                return true;
+            case List:
+            case Vector: {
+                auto seq = value->as_sequence();
+                out += (char) (typeOf(value) == List ? ListTag : VectorTag);
+                put(out, seq->count());
+                for (auto item : *seq) {
+                    if (!serialize(item, out))
+                        return false;
+                }
+                return true;
+            }
+            case HashMap: {
+                auto hmap = value->as_hashmap();
+                out += (char) MapTag;
+                put(out, hmap->count());
+                for (auto& entry : *hmap) {
+                    if (!serialize(entry.key, out) || !serialize(entry.value, out))
+                        return false;
+                }
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    // what describe writes for the forms only a resolved function body has
+    enum BodyTag : uint8_t {
+        UninternedTag = MapTag + 1, LocalTag, PairTag, BuiltinTag
+    };
+
+    bool describe(MalType* value, string& out);
+
+    bool describeAll(MalSequence* seq, string& out) {
+        put(out, seq->count());
+        for (auto item : *seq) {
+            if (!describe(item, out))
+                return false;
+        }
+        return true;
+    }
+
+    // like serialize, but for a macro's body (see definitionHash), which the resolver and
+    // the compiler have been over: it has locals, nodes, builtins and resolved fn*s in it too.
+    // only ever hashed, never read back
+    bool describe(MalType* value, string& out) {
+        switch (typeOf(value)) {
+            case Symbol: {
+                auto sym = value->as_symbol();
+                // the resolver's fn* isn't interned
+                if (MalSymbol::intern(sym->str()) == sym)
+                    out += (char) SymbolTag;
+                else
+                    out += (char) UninternedTag;
+                put(out, sym->str());
+                return true;
+            }
+            case Local: {
+                auto local = value->as_local();
+                out += (char) LocalTag;
+                put(out, local->symbol()->str());
+                put(out, local->depth());
+                put(out, local->slot() + 1);
+                return true;
+            }
+            case Node:
+                return describe(static_cast< MalNode* >(value)->form(), out);
+            case Func:
+                out += (char) BuiltinTag;
+                put(out, value->as_func()->name());
+                return true;
+            case List:
+                out += (char) ListTag;
+                return describeAll(value->as_sequence(), out);
+            case Vector:
+                out += (char) VectorTag;
+                return describeAll(value->as_sequence(), out);
+            case Pair:
+                out += (char) PairTag;
+                return describeAll(value->as_sequence(), out);
+            case HashMap: {
+                auto hmap = value->as_hashmap();
+                out += (char) MapTag;
+                put(out, hmap->count());
+                for (auto& entry : *hmap) {
+                    if (!describe(entry.key, out) || !describe(entry.value, out))
+                        return false;
+                }
+                return true;
+            }
+            default:
+                return serialize(value, out);
+        }
+    }
+
+    // the same for the same definition, in this run or any other. false for a macro that
+    // closes over more than TOP_LEVEL, or has a value in its body (a function, an atom)
+    // that can't be told apart from another one that way
+    bool definitionHash(MalTCOptFunc* macro, uint64_t& hash) {
+        if (macro->getEnviron() != TOP_LEVEL)
+            return false;
+        string out;
+        out += (char) macro->isVariad();
+        for (auto param : macro->getParameters())
+            put(out, param->as_symbol()->str());
+        if (!describe(macro->getBody(), out))
+            return false;
+        hash = contentHash(out);
+        return true;
+    }
+
+    // the hashes of the macros TOP_LEVEL binds, each worked out once until a macro gets (re)defined
+    class MacroHashes {
+    public:
+        // false when name isn't bound to a macro, or to one definitionHash can't hash
+        bool of(MalSymbol* name, uint64_t& hash) {
+            if (epoch != Core::macroEpoch) {
+                known.clear();
+                epoch = Core::macroEpoch;
+            }
+            auto macro = TOP_LEVEL->find(name);
+            if (macro == NULL || !Core::isMacro(macro))
+                return false;
+            auto [found, added] = known.try_emplace(macro);
+            if (added)
+                found->second.first = definitionHash(macro->as_tcoptfunc(), found->second.second);
+            hash = found->second.second;
+            return found->second.first;
+        }
+
+    private:
+        size_t epoch { SIZE_MAX };
+        unordered_map < MalType*, pair < bool, uint64_t > > known;
+    };
+
+    // reading
+
+    class Input {
+    public:
+        Input(string_view data) : i_data {data} { }
+
+        uint8_t byte() {
+            need(1);
+            return i_data[i_pos++];
+        }
+
+        uint64_t word() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                auto next = byte();
+                value |= (uint64_t) (next & 0x7f) << shift;
+                if ((next & 0x80) == 0)
+                    return value;
+            }
+            throw Corrupt();
+        }
+
+        string_view text() {
+            auto size = word();
+            need(size);
+            auto text = i_data.substr(i_pos, size);
+            i_pos += size;
+            return text;
+        }
+
+        size_t position() {
+            return i_pos;
+        }
+
+    private:
+        void need(uint64_t size) {
+            if (i_data.size() - i_pos < size)
+                throw Corrupt();
+        }
+
+        string_view i_data;
+        size_t i_pos { 0 };
+    };
+
+    MalType* deserialize(Input& in);
+
+    // nothing collects while this runs, so what it builds needs no rooting.
+    // tag is the byte the value starts with
+    MalType* deserialize(Input& in, uint8_t tag) {
+        switch (tag) {
+            case NilTag:
+                return MAL_NIL;
+            case TrueTag:
+                return MAL_TRUE;
+            case FalseTag:
+                return MAL_FALSE;
+            case IntTag: {
+                auto zigzag = in.word();
+                return makeInt((long) (zigzag >> 1) ^ -(long) (zigzag & 1));
+            }
+            case StringTag:
+                return new MalString(in.text());
+            case SymbolTag:
+                return MalSymbol::intern(in.text());
+            case KeywordTag:
+                return MalKeyword::intern(in.text());
+            case SpreadTag:
+                return CONSTANTS.at("...");
+            case ListTag: {
+                auto list = new MalList();
+                for (auto count = in.word(); count > 0; --count)
+                    list->append(deserialize(in));
+                return list;
+            }
+            case VectorTag: {
+                auto vec = new MalVector;
+                for (auto count = in.word(); count > 0; --count)
+                    vec->append(deserialize(in));
+                return vec;
+            }
+            case MapTag: {
+                auto hmap = new MalHashMap;
+                for (auto count = in.word(); count > 0; --count) {
+                    auto key = deserialize(in);
+                    hmap->set(key, deserialize(in));
+                }
+                return hmap;
+            }
+            default:
+                throw Corrupt();
+        }
+    }
+
+    MalType* deserialize(Input& in) {
+        return deserialize(in, in.byte());
+    }
+
+    // a cache file:
+    // MALC, version, checksum of the rest
+    // the source's absolute path, mtime, size and content hash
+    // the forms: count, then for each one either
+    //   PlainForm, the form (see serialize)
+    //   ExpandedForm, the macros it was expanded with (count, then each one's name and
+    //   definitionHash), the form it was read as, and what it expanded to
+    enum FormTag : uint8_t { PlainForm, ExpandedForm };
+
+    struct Header {
+        string path;
+        Stamp stamp;
+        uint64_t hash;
+    };
+
+    void putHeader(string& out, Header& header) {
+        put(out, header.path);
+        put(out, header.stamp.mtime);
+        put(out, header.stamp.size);
+        put(out, header.hash);
+    }
+
+    // the part after the checksum, or Corrupt
+    string_view checked(string_view data, const char* magic = MAGIC, uint64_t version = VERSION) {
+        if (data.size() < 4 || memcmp(data.data(), magic, 4) != 0)
+            throw Corrupt();
+        Input in(data.substr(4));
+        if (in.word() != version)
+            throw Corrupt();
+        auto checksum = in.word();
+        auto rest = data.substr(4 + in.position());
+        if (contentHash(rest) != checksum)
+            throw Corrupt();
+        return rest;
+    }
+
+    // replaced in one go, so a load running alongside never sees half of it.
+    // not being able to write it just means there's no cache
+    void writeCache(const string& cachePath, string_view rest) {
+        string data(MAGIC, 4);
+        put(data, VERSION);
+        put(data, contentHash(rest));
+        data.append(rest);
+
+        auto dir = cachePath.substr(0, cachePath.rfind('/'));
+        for (auto at = dir.find('/', 1); at != string::npos; at = dir.find('/', at + 1))
+            mkdir(dir.substr(0, at).c_str(), 0755);
+        mkdir(dir.c_str(), 0755);
+
+        auto temp = cachePath + "." + to_string(getpid());
+        auto file = fopen(temp.c_str(), "wb");
+        if (file == NULL)
+            return;
+        bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+        if (fclose(file) != 0 || !written || rename(temp.c_str(), cachePath.c_str()) != 0)
+            remove(temp.c_str());
+    }
+
+    // expands the head of original into form, the way EVAL would first, and writes what
+    // the cache keeps for it to out. false when it can't go in a cache.
+    // both have to be rooted, since expanding runs code
+    bool expand(MalType*& original, MalType*& form, MacroHashes& hashes, string& out) {
+        form = original;
+        string macros;
+        size_t count = 0;
+        bool expanded = false;
+        // whether every macro it gets expanded with can be checked next time, and was
+        // given literal arguments (anything else is evaluated again each expansion, see Core::isLiteral)
+        bool known = true;
+        MalType* call_args[1] { form };
+        while (Core::isMacroCall(call_args, 1) == CONSTANTS["true"]) {
+            known = known && Core::literalArgs(form);
+            auto name = Core::macroName(form->as_list()->first())->as_symbol();
+            uint64_t hash;
+            if (known && (known = hashes.of(name, hash))) {
+                put(macros, name->str());
+                put(macros, hash);
+                ++count;
+            }
+            form = Core::expandOnce(form);
+            call_args[0] = form;
+            expanded = true;
+        }
+        // an expansion that can't be checked is left to EVAL to make every time
+        if (!expanded || !known) {
+            out += (char) PlainForm;
+            return serialize(original, out);
+        }
+        out += (char) ExpandedForm;
+        put(out, count);
+        out.append(macros);
+        return serialize(original, out) && serialize(form, out);
+    }
+
+    // runs the forms in the cache, if it is fresh. false if it isn't (having run nothing).
+    // when some of the expansions in it turn out to be stale, it gets written again
+    // with those expanded over
+    bool loadCached(const string& path, const string& absolute, const string& cachePath) {
+        Stamp stamp;
+        if (!stampOf(path, stamp))
+            return false;
+
+        unique_ptr < Core::MappedFile > cache;
+        string_view rest;
+        Input in("");
+        Header header;
+        try {
+            cache = make_unique < Core::MappedFile >(cachePath);
+            rest = checked(cache->text());
+            in = Input(rest);
+            header.path = in.text();
+            header.stamp.mtime = in.word();
+            header.stamp.size = in.word();
+            header.hash = in.word();
+            if (header.path != absolute || header.stamp.size != stamp.size)
+                return false;
+
+            // touched, but not changed: the cache is fine, and gets the new mtime
+            if (header.stamp.mtime != stamp.mtime) {
+                Core::MappedFile source(path);
+                if (contentHash(source.text()) != header.hash)
+                    return false;
+                header.stamp = stamp;
+                string updated;
+                putHeader(updated, header);
+                updated.append(rest.substr(in.position()));
+                writeCache(cachePath, updated);
+            }
+        } catch (system_error&) {
+            return false;
+        } catch (Corrupt&) {
+            return false;
+        }
+
+        // past the checksum, this is very unlikely. but by now some of the forms have run
+        try {
+            MacroHashes hashes;
+            MalType* original = NULL;
+            MalType* form = NULL;
+            GCRoot originalRoot(original);
+            GCRoot formRoot(form);
+            // the forms as they go in the cache now, once one of them is stale
+            string forms;
+            bool stale = false;
+            bool caching = true;
+            auto count = in.word();
+            auto formsStart = in.position();
+            for (auto left = count; left > 0; --left) {
+                auto formStart = in.position();
+                bool fresh = true;
+                if (in.byte() == PlainForm) {
+                    form = deserialize(in);
+                } else {
+                    // checked now rather than up front: the file itself can (re)define them on the way
+                    for (auto macros = in.word(); macros > 0; --macros) {
+                        auto name = MalSymbol::intern(in.text());
+                        auto recorded = in.word();
+                        uint64_t current;
+                        fresh = fresh && hashes.of(name, current) && current == recorded;
+                    }
+                    original = deserialize(in);
+                    form = deserialize(in);
+                }
+                if (!fresh) {
+                    if (!stale)
+                        forms = rest.substr(formsStart, formStart - formsStart);
+                    stale = true;
+                    caching = expand(original, form, hashes, forms) && caching;
+                } else if (stale) {
+                    forms.append(rest.substr(formStart, in.position() - formStart));
+                }
+                EVAL(form, TOP_LEVEL);
+            }
+            if (stale && caching) {
+                string updated;
+                putHeader(updated, header);
+                put(updated, count);
+                updated.append(forms);
+                writeCache(cachePath, updated);
+            }
+        } catch (Corrupt&) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "the cache for '" + path + "' (" + cachePath + ") is corrupt.";
+            throw runExcep;
+        }
+        return true;
+    }
+
+    // reads and runs the file's forms, and writes its cache when there is somewhere to
+    void loadSource(const string& path, const string& absolute, const string& cachePath) {
+        Core::MappedFile file(path);
+        Reader reader(file.text(), CONSTANTS);
+        Header header;
+        header.path = absolute;
+        bool caching = !cachePath.empty() && stampOf(path, header.stamp);
+        if (caching)
+            header.hash = contentHash(file.text());
+        string forms;
+        size_t count = 0;
+        MacroHashes hashes;
+
+        MalType* original = NULL;
+        MalType* form = NULL;
+        GCRoot originalRoot(original);
+        GCRoot formRoot(form);
+        while (auto read = read_form(reader)) {
+            original = form = *read;
+            if (caching) {
+                caching = expand(original, form, hashes, forms);
+                ++count;
+            }
+            EVAL(form, TOP_LEVEL);
+        }
+        if (!caching)
+            return;
+
+        string rest;
+        putHeader(rest, header);
+        put(rest, count);
+        rest.append(forms);
+        writeCache(cachePath, rest);
+    }
+
+    MalType* load(const string& path) {
+        string absolute;
+        auto cachePath = cacheFor(path, absolute);
+        if (cachePath.empty() || !loadCached(path, absolute, cachePath))
+            loadSource(path, absolute, cachePath);
+        return MalKeyword::intern("success");
+    }
+}
@@ -3,8 +3,15 @@
 using std::string;
 
 string pr_str(MalType* t, MalString* Newline, bool readable) {
+    string out;
+    pr_str(out, t, Newline, readable);
+    return out;
+}
+
+void pr_str(string& out, MalType* t, MalString* Newline, bool readable) {
     if (t == Newline) {
-        return "\n";
+        out += "\n";
+        return;
     }
-    return t->inspect(readable);
+    printOf(t, out, readable);
 }
\ No newline at end of file
@@ -5,4 +5,6 @@
 
 using std::string;
 
-string pr_str(MalType *, MalString* n=NULL, bool r=true);
\ No newline at end of file
+string pr_str(MalType *, MalString* n=NULL, bool r=true);
+// the same, appended to out
+void pr_str(string& out, MalType *, MalString* n=NULL, bool r=true);
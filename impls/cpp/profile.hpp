@@ -0,0 +1,337 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <csignal>
+#include <sys/time.h>
+#include "mal_types.hpp"
+
+using namespace std;
+
+// the functions being called, kept on a stack of their own alongside EVAL's and the VM's,
+// for two profilers:
+// --profile counts the calls to every function (by the name def! gave it, builtins included)
+// and how long they took, with (inclusive) and without (exclusive) the functions they called.
+// time is charged to whatever is on top of the stack whenever that changes. when the program
+// ends, a report goes to stderr, and the time spent in each chain of calls goes to a file
+// in the collapsed stack format flamegraph.pl reads.
+// (profile-start) and (profile-stop "out.folded") sample the stack instead, from a SIGPROF
+// handler every millisecond (of CPU time), and write how often each chain of calls was seen.
+// that costs a push and a pop per call, rather than reading the clock twice, so tight loops
+// look the way they do without a profiler.
+// EVAL, apply and the VM push a function when they start running it and pop it when it's done,
+// and a tail call replaces the function on top
+namespace Profile {
+    // whether calls are being tracked at all
+    bool enabled = false;
+    // whether they are being timed (--profile)
+    bool timing = false;
+    // bumped whenever tracking starts, so a frame from before doesn't pop what came after
+    size_t session = 0;
+    // where --profile puts the collapsed stacks
+    string foldedPath = "profile.folded";
+
+    struct Function {
+        string name;
+        uint64_t calls { 0 };
+        // in nanoseconds
+        uint64_t exclusive { 0 };
+        uint64_t inclusive { 0 };
+        // how many times it is on the stack. only its outermost call counts towards
+        // its inclusive time, so a recursive one isn't counted over and over
+        size_t active { 0 };
+    };
+    vector < Function > functions;
+    unordered_map < string, size_t > functionIds;
+
+    // the tree of every chain of calls made, for --profile's collapsed stacks.
+    // the root (nodes[0]) is the top level, outside of any function
+    struct Node {
+        size_t function { SIZE_MAX };
+        size_t parent { SIZE_MAX };
+        uint64_t exclusive { 0 };
+        unordered_map < size_t, size_t > children { };
+    };
+    vector < Node > nodes { Node { SIZE_MAX, SIZE_MAX } };
+
+    struct Frame {
+        size_t function;
+        size_t node;
+        uint64_t start;
+    };
+    // a fixed array rather than a vector, so the signal handler never sees it moving.
+    // calls nested deeper than this are counted, but not kept: their time goes to
+    // the deepest call that is
+    const size_t MAX_DEPTH = 1 << 14;
+    Frame frames[MAX_DEPTH];
+    // the SIGPROF handler reads it while calls change it, so it's atomic. relaxed is enough:
+    // the fences in push and pop order it with the frames
+    atomic < size_t > depth { 0 };
+    static_assert(atomic < size_t >::is_always_lock_free, "the SIGPROF handler can't wait on a lock");
+    uint64_t last = 0;
+
+    uint64_t now() {
+        return chrono::duration_cast< chrono::nanoseconds >(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // the id of the function called name
+    size_t functionId(const string& name) {
+        auto found = functionIds.find(name);
+        if (found != functionIds.end())
+            return found->second;
+        functions.push_back(Function { name });
+        functionIds.emplace(name, functions.size() - 1);
+        return functions.size() - 1;
+    }
+
+    // the id of fn (a MalFunc or a MalTCOptFunc), looked up by its name the first time
+    // and kept on it after that, so a call doesn't hash its name
+    template < typename Fn >
+    size_t functionOf(Fn* fn) {
+        auto id = fn->profileId();
+        if (id == SIZE_MAX) {
+            id = functionId(fn->name());
+            fn->setProfileId(id);
+        }
+        return id;
+    }
+
+    // --profile: charges the time since the last call to whatever is running
+    uint64_t tick() {
+        auto time = now();
+        auto depth = Profile::depth.load(memory_order_relaxed);
+        if (depth == 0) {
+            nodes[0].exclusive += time - last;
+        } else {
+            auto& top = frames[min(depth, MAX_DEPTH) - 1];
+            nodes[top.node].exclusive += time - last;
+            functions[top.function].exclusive += time - last;
+        }
+        last = time;
+        return time;
+    }
+
+    // returns the session the frame belongs to, for popping it later
+    size_t push(size_t id) {
+        auto depth = Profile::depth.load(memory_order_relaxed);
+        if (depth < MAX_DEPTH) {
+            auto& frame = frames[depth];
+            frame.function = id;
+            if (timing) {
+                frame.start = tick();
+                auto parent = depth == 0 ? 0 : frames[depth - 1].node;
+                auto [child, added] = nodes[parent].children.try_emplace(id, nodes.size());
+                frame.node = child->second;
+                if (added)
+                    nodes.push_back(Node { id, parent });
+                ++functions[id].calls;
+                ++functions[id].active;
+            }
+        } else if (timing) {
+            ++functions[id].calls;
+        }
+        // the frame has to be all there before a sample can see it
+        atomic_signal_fence(memory_order_release);
+        Profile::depth.store(depth + 1, memory_order_relaxed);
+        return session;
+    }
+
+    void pop() {
+        auto depth = Profile::depth.load(memory_order_relaxed);
+        if (depth == 0)
+            return;
+        if (timing && depth <= MAX_DEPTH) {
+            auto time = tick();
+            auto& frame = frames[depth - 1];
+            auto& function = functions[frame.function];
+            if (--function.active == 0)
+                function.inclusive += time - frame.start;
+        }
+        Profile::depth.store(depth - 1, memory_order_relaxed);
+        atomic_signal_fence(memory_order_release);
+    }
+
+    void leaveTo(size_t to) {
+        while (depth.load(memory_order_relaxed) > to)
+            pop();
+    }
+
+    // the functions a C++ frame (EVAL's, say) runs, one after the other when it makes tail calls.
+    // whatever it pushed is popped when it returns or throws
+    class Mark {
+    public:
+        Mark() : at {enabled ? depth.load(memory_order_relaxed) : SIZE_MAX}, in {session} { }
+
+        ~Mark() {
+            if (at != SIZE_MAX && in == session)
+                leaveTo(at);
+        }
+
+        // fn starts running in this frame, in place of whatever was before
+        template < typename Fn >
+        void call(Fn* fn) {
+            if (at == SIZE_MAX || in != session)
+                return;
+            leaveTo(at);
+            push(functionOf(fn));
+        }
+
+        Mark(const Mark&) = delete;
+
+    private:
+        size_t at;
+        size_t in;
+    };
+
+    void start() {
+        enabled = true;
+        ++session;
+        depth.store(0, memory_order_relaxed);
+    }
+
+    // --profile
+
+    void startTiming() {
+        start();
+        timing = true;
+        last = now();
+    }
+
+    // one chain of calls per line: the names, outermost first, separated by ;
+    // and then a count (how long was spent in the last one, or how often it was seen)
+    void writeFolded(const string& path, map < vector < size_t >, uint64_t >& counts) {
+        auto file = fopen(path.c_str(), "w");
+        if (file == NULL) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "couldn't write the profile '" + path + "'.";
+            throw runExcep;
+        }
+        for (auto& [chain, count] : counts) {
+            string line = "<top-level>";
+            for (auto function : chain)
+                line += ";" + functions[function].name;
+            fprintf(file, "%s %llu\n", line.c_str(), (unsigned long long) count);
+        }
+        fclose(file);
+    }
+
+    // the calls and times of every function, the ones that took longest on their own first
+    void report() {
+        leaveTo(0);
+        tick();
+        vector < Function* > sorted;
+        for (auto& function : functions)
+            sorted.push_back(&function);
+        sort(sorted.begin(), sorted.end(), [](Function* a, Function* b) { return a->exclusive > b->exclusive; });
+
+        fprintf(stderr, "%12s %14s %14s  %s\n", "calls", "inclusive ms", "exclusive ms", "function");
+        for (auto function : sorted)
+            fprintf(stderr, "%12llu %14.3f %14.3f  %s\n", (unsigned long long) function->calls,
+                    function->inclusive / 1e6, function->exclusive / 1e6, function->name.c_str());
+        fprintf(stderr, "%12s %14s %14.3f  %s\n", "", "", nodes[0].exclusive / 1e6, "<top-level>");
+
+        // in microseconds
+        map < vector < size_t >, uint64_t > counts;
+        for (size_t i = 0; nodes.size() > i; ++i) {
+            auto micros = nodes[i].exclusive / 1000;
+            if (micros == 0)
+                continue;
+            vector < size_t > chain;
+            for (auto node = i; node != 0; node = nodes[node].parent)
+                chain.push_back(nodes[node].function);
+            reverse(chain.begin(), chain.end());
+            counts[chain] = micros;
+        }
+        try {
+            writeFolded(foldedPath, counts);
+        } catch (RuntimeException& r) {
+            fprintf(stderr, "%s\n", r.what());
+        }
+    }
+
+    // (profile-start) and (profile-stop)
+
+    // what the handler saw: for each sample, how deep the stack was, then the functions on it.
+    // set aside up front, since the handler can't allocate
+    const size_t SAMPLES_SIZE = 1 << 22;
+    size_t* samples = NULL;
+    volatile size_t samplesEnd = 0;
+    // samples there was no room for
+    volatile size_t dropped = 0;
+    bool sampling = false;
+
+    void onSample(int) {
+        atomic_signal_fence(memory_order_acquire);
+        auto count = min(depth.load(memory_order_relaxed), MAX_DEPTH);
+        auto end = samplesEnd;
+        if (end + count + 1 > SAMPLES_SIZE) {
+            dropped = dropped + 1;
+            return;
+        }
+        samples[end] = count;
+        for (size_t i = 0; count > i; ++i)
+            samples[end + 1 + i] = frames[i].function;
+        samplesEnd = end + count + 1;
+    }
+
+    void startSampling(long intervalMicros) {
+        if (sampling || timing) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "the profiler is already running.";
+            throw runExcep;
+        }
+        if (samples == NULL)
+            samples = new size_t[SAMPLES_SIZE];
+        samplesEnd = 0;
+        dropped = 0;
+        start();
+        sampling = true;
+
+        struct sigaction action {};
+        action.sa_handler = onSample;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, NULL);
+        struct itimerval timer {};
+        timer.it_interval.tv_sec = intervalMicros / 1000000;
+        timer.it_interval.tv_usec = intervalMicros % 1000000;
+        timer.it_value = timer.it_interval;
+        setitimer(ITIMER_PROF, &timer, NULL);
+    }
+
+    // writes what was sampled to path, and returns how many samples there were
+    size_t stopSampling(const string& path) {
+        if (!sampling) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "the profiler isn't running.";
+            throw runExcep;
+        }
+        struct itimerval timer {};
+        setitimer(ITIMER_PROF, &timer, NULL);
+        // rather than the default, which would end the program if one was already on its way
+        signal(SIGPROF, SIG_IGN);
+        sampling = false;
+        enabled = false;
+        ++session;
+        depth.store(0, memory_order_relaxed);
+
+        map < vector < size_t >, uint64_t > counts;
+        size_t taken = 0;
+        for (size_t at = 0; samplesEnd > at; at += samples[at] + 1, ++taken) {
+            vector < size_t > chain(samples + at + 1, samples + at + 1 + samples[at]);
+            ++counts[chain];
+        }
+        writeFolded(path, counts);
+        if (dropped > 0)
+            fprintf(stderr, "the profiler ran out of room for %zu samples.\n", (size_t) dropped);
+        return taken;
+    }
+}
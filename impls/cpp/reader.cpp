@@ -10,21 +10,8 @@ using std::vector;
 using std::cout;
 using std::cerr;
 
-Env glob;
-vector < string_view > tokenize(string &input) {
-    Tokenizer tokenizer(input);
-    vector < string_view > tokens;
-    while(auto token = tokenizer.nextToken()) {
-        tokens.push_back(*token);
-    }
-    return tokens;
-}
-
-optional < MalType * > read_str(string &input, Env global) {
-    vector < string_view > tokens = tokenize(input);
-    glob = global;
-    // pass vector of all tokens to reader
-    Reader reader(tokens);
+optional < MalType * > read_str(string_view input, Env &constants) {
+    Reader reader(input, constants);
     return read_form(reader);
 }
 
@@ -139,7 +126,7 @@ optional < MalType * > read_hashmap(Reader &reader) {
             throw r_except;
         }
         auto val = read_form(reader);
-        hmap->set(key.value()->inspect(), *key, *val);
+        hmap->set(*key, *val);
     }
     auto r_except = ReaderException();
     r_except.errMessage = "unbalanced";
@@ -185,22 +172,22 @@ optional < MalType * > read_atom(Reader &reader) {
         case '&': {
             if (token.size() == 1) {
                 reader.next();
-                return glob.at("&");
+                return reader.constant("&");
             }
         }
         case '.': {
             if (token.size() == 3 && token == "...") {
                 reader.next();
-                return glob.at("...");
+                return reader.constant("...");
             }
         }
         default: {
             if (isNilToken(token)) {
                 reader.next();
-                return glob.at("nil");
+                return reader.constant("nil");
             } else if (isBooleanToken(token)) {
                 reader.next();
-                return token == "true" ? glob.at("true") : glob.at("false");
+                return token == "true" ? reader.constant("true") : reader.constant("false");
             } else if (isNumberToken(token)) {
                 reader.next();
                 // cast token to long from a string and then make a MalInt with it
@@ -213,7 +200,7 @@ optional < MalType * > read_atom(Reader &reader) {
                 
                 // no errors, and entirety of token is a number
                 if (errCode == errc() && tokenEnd - rest == 0) {
-                    return new MalInt(num);
+                    return makeInt(num);
                 } else if (errCode == errc()) {
                     // no errors but not a fully formed number
                     // e.g: 1234abc, 200b
@@ -239,13 +226,13 @@ optional < MalType * > read_atom(Reader &reader) {
                 if (token.size() > 1 && firstChar == '-') {
                     bool isKeyword = token.find(":") != string::npos;
                     if (!isKeyword) { // its not a keyword so parse it to a symbol
-                        return new MalSymbol(reader.next().value());
+                        return MalSymbol::intern(reader.next().value());
                     }
                     reader.next();
                     // if it is a negated symbol, return only the negation sign
-                    return new MalSymbol("-");
+                    return MalSymbol::intern("-");
                 }
-                return new MalSymbol(reader.next().value());
+                return MalSymbol::intern(reader.next().value());
             }
         }
     }
@@ -254,7 +241,7 @@ optional < MalType * > read_atom(Reader &reader) {
 optional < MalType * > read_keyword(Reader &reader) {
     // skip over :
     reader.next().value();
-    return new MalKeyword(reader.next().value());
+    return MalKeyword::intern(reader.next().value());
 }
 
 optional < MalType * > read_string(Reader &reader) {
@@ -281,6 +268,17 @@ optional < MalType * > read_string(Reader &reader) {
     return new MalString(token.substr(1, token.size() - 2));
 }
 
+// the form a quote or a deref applies to, which has to be there
+static MalType * read_quoted_form(Reader &reader) {
+    auto form = read_form(reader);
+    if (!form) {
+        auto r_except = ReaderException();
+        r_except.errMessage = "unbalanced";
+        throw r_except;
+    }
+    return form.value();
+}
+
 optional < MalType * > read_quoted_val(Reader &reader) {
     string_view token = reader.peek().value();
 
@@ -291,8 +289,8 @@ optional < MalType * > read_quoted_val(Reader &reader) {
             // skip '
             reader.next();
             auto quoteList = new MalList();
-            quoteList->append(glob["quote"]);
-            quoteList->append(read_form(reader).value());
+            quoteList->append(reader.constant("quote"));
+            quoteList->append(read_quoted_form(reader));
             return quoteList;
         }
          // quasiquote
@@ -300,8 +298,8 @@ optional < MalType * > read_quoted_val(Reader &reader) {
             // skip `
             reader.next();
             auto q_quoteList = new MalList();
-            q_quoteList->append(glob["quasiquote"]);
-            q_quoteList->append(read_form(reader).value());
+            q_quoteList->append(reader.constant("quasiquote"));
+            q_quoteList->append(read_quoted_form(reader));
             return q_quoteList;
         }
         // unquote or splice-unquote
@@ -312,13 +310,13 @@ optional < MalType * > read_quoted_val(Reader &reader) {
             // splice-unquote
             if (token.length() > 1 && token[1] == '@') {
                 auto s_unquoteList = new MalList();
-                s_unquoteList->append(glob["splice-unquote"]);
-                s_unquoteList->append(read_form(reader).value());
+                s_unquoteList->append(reader.constant("splice-unquote"));
+                s_unquoteList->append(read_quoted_form(reader));
                 return s_unquoteList;
             } else { // unquote
                 auto unquoteList = new MalList();
-                unquoteList->append(glob["unquote"]);
-                unquoteList->append(read_form(reader).value());
+                unquoteList->append(reader.constant("unquote"));
+                unquoteList->append(read_quoted_form(reader));
                 return unquoteList;
             }
             break;
@@ -334,16 +332,16 @@ optional < MalType * > read_quoted_val(Reader &reader) {
 optional < MalType * > read_dereferenced_val(Reader &reader) {
     reader.next();
     auto deref_list = new MalList();
-    auto sym = glob["deref"];
+    auto sym = reader.constant("deref");
     deref_list->append(sym);
-    deref_list->append(read_form(reader).value());
+    deref_list->append(read_quoted_form(reader));
     return deref_list;
 }
 
 optional < MalType * > read_metadata_w_object(Reader &reader) {
     reader.next();
     auto meta_list = new MalList();
-    auto sym = glob["with-meta"];
+    auto sym = reader.constant("with-meta");
     meta_list->append(sym);
     auto metadata_hmap = read_hashmap(reader).value();
     auto obj = read_form(reader).value();
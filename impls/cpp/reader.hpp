@@ -6,6 +6,12 @@
 #include <exception>
 #include <vector>
 #include <optional>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#if defined(__SSE2__) && !defined(MAL_NO_SIMD)
+#include <emmintrin.h>
+#endif
 #include "mal_types.hpp"
 #include "env.hpp"
 
@@ -16,6 +22,8 @@ using std::optional;
 using std::endl;
 using std::vector;
 using std::cout;
+using std::array;
+using std::min;
 
 class ReaderException : exception {
 public:
@@ -31,210 +39,227 @@ class CommentException : exception { };
 
 class Tokenizer {
 public:
-    // we use a reference because we expect input to outlive Tokenizer
-    // so we won't hold a dangling reference at any point
-    Tokenizer(string &input) : t_input {input} { }
+    // a view, because we expect input to outlive Tokenizer (the tokens point into it too)
+    Tokenizer(string_view input) : t_input {input} { }
 
     optional < string_view > nextToken() {
-        auto s_view = string_view(t_input);
-        // while we still have unseen characters in the input
-        while(!isAtEndOfInput()) {
-            bool bufferedChar = false;
-            char ch = currentCharacter();
-
-            switch (ch) {
-                // skip whitespace and commas
-                case ' ':
-                case '\t':
-                case '\n':
-                case '\r':
-                case ',':
+        while (true) {
+            auto i = skipSpace(t_input_index);
+            if (i >= t_input.size()) {
+                t_input_index = i;
+                return {};
+            }
+
+            auto start = i;
+            switch (classOf(t_input[i])) {
+                // ~@ is a token by itself, unlike ~ followed by anything else
+                case TILDE:
+                    i += i + 1 < t_input.size() && t_input[i + 1] == '@' ? 2 : 1;
                     break;
-                // process special pair ~@ and ~
-                case '~': {
-                    // if it has a @ next to it, return them both
-                    if (peekCharacter() == '@') {
-                        // skip over both ~ and @
-                        advanceIndexBy(2);
-                        return s_view.substr(t_input_index-2, 2);
-                    } 
-                    // step over ~
-                    advanceIndexBy(1);
-                    return s_view.substr(t_input_index-1, 1);
-                }
-                case '[':
-                case ']':
-                case '{':
-                case '}':
-                case '(':
-                case ')':
-                case '\'':
-                case '`':
-                case '@':
-                case ':':
-                case '^': {
-                    // step over it
-                    advanceIndexBy(1);
-                    return s_view.substr(t_input_index-1, 1);
-                }
-                // process an escapable string
-                case '"': {
-                    // so we can do the full span of the string
-                    size_t stringStart = t_input_index; 
-                    advanceIndexBy(1);
-                    while(!isAtEndOfInput()) {
-                        char cToken = currentCharacter();
-                        switch (cToken) {
-                            // termination of string
-                            case '"': {
-                                // skip terminating "
-                                advanceIndexBy(1);
-                                return s_view.substr(stringStart, t_input_index - stringStart);
-                            }
-                            // possible escape of a character (eg: ")
-                            case '\\': {
-                                // skip \ and next character
-                                advanceIndexBy(1);
-                                // external advanceIndexBy will move it by 1 again, so this is fine
-                                break;
-                            }
-                        }
-                        advanceIndexBy(1);
-                    }
-                    // return unterminated string
-                    return s_view.substr(stringStart, t_input_index - stringStart);
-                }
-                // handle comments
-                case ';': {
-                    size_t commentStart = t_input_index;
-                    // step over ;
-                    advanceIndexBy(1);
-                    // skip over comments till newline
-                    while(!isAtEndOfInput() && currentCharacter() != '\n') {
-                        advanceIndexBy(1);
-                    }
+                case SPECIAL:
+                    i += 1;
+                    break;
+                // an escapable string, with its quotes. an unterminated one goes to the end of input
+                case QUOTE:
+                    i = stringEnd(i + 1);
+                    break;
+                // skip over comments till newline
+                case COMMENT: {
+                    auto newline = t_input.find('\n', i);
+                    t_input_index = newline == string_view::npos ? t_input.size() : newline;
                     continue;
-                    // return s_view.substr(commentStart, t_input_index - commentStart);
-                    // break;
                 }
                 // handles everything else:
-                /*
-                * symbols -> identifiers or atoms
-                * numbers 
-                * "true"
-                * "false"
-                * "nil"
-                * 
-                * we parse it as an inverse of the other characters we have already seen
-                */
-                default: {
-                    size_t start = t_input_index;
-                    bool done = false;
-                    while (!isAtEndOfInput() && !done) {
-                        char c = currentCharacter();
-                        switch (c) {
-                            case ' ':
-                            case '\t':
-                            case '\n':
-                            case '\r':
-                            case ',':
-                            case '~': 
-                            case '[':
-                            case ']':
-                            case '{':
-                            case '}':
-                            case '(':
-                            case ')':
-                            case '\'':
-                            case '`':
-                            case '@':
-                            case '^':    
-                            case '"':
-                            case ';': {
-                                done = true; // don't include into this token
-                                bufferedChar = true;
-                                break; 
-                            }
-                            default: {
-                                // include in this token
-                                advanceIndexBy(1);
-                            }
-                        }
-                    }
-                    return s_view.substr(start, t_input_index - start);
-                }
-            }
-            // if there is no unprocessed character,
-            // unprocessed characters can result from inside the default branch of above switch
-            // because we broke from internal default while loop on that character, 
-            // we need to make sure we process it in the next external loop
-            if (!bufferedChar) {
-                // move index forward after processing character
-                advanceIndexBy(1);
-            } else {
-                bufferedChar = false;
+                // symbols, numbers, "true", "false", "nil", keyword names...
+                // up to the next character that isn't part of one (':' is, inside a token)
+                default:
+                    i = atomEnd(i);
+                    break;
             }
+            t_input_index = i;
+            return t_input.substr(start, i - start);
         }
+    }
 
-        return {};
+    bool isAtEndOfInput() {
+        return t_input_index >= t_input.size();
     }
 
-    void advanceIndexBy(int charCount) {
-        if (!isAtEndOfInput())
-            t_input_index += charCount;
+private:
+    // what the tokenizer does with each byte, from the table below
+    enum CharClass : uint8_t {
+        ATOM_CHAR,  // part of a symbol, number, keyword name...
+        SPACE,      // whitespace and commas
+        SPECIAL,    // a token by itself: [ ] { } ( ) ' ` @ ^ and :
+        TILDE,      // ~ or ~@
+        QUOTE,      // starts a string
+        COMMENT,    // ; until the end of the line
+    };
+
+    static CharClass classOf(char c) {
+        return (CharClass) charClasses()[(uint8_t) c];
     }
 
-    char currentCharacter() {
-        return t_input.at(t_input_index);
+    static const uint8_t* charClasses() {
+        static const auto table = [] {
+            array < uint8_t, 256 > t {};
+            for (auto c : string_view(" \t\n\r,"))
+                t[(uint8_t) c] = SPACE;
+            for (auto c : string_view("[]{}()'`@^:"))
+                t[(uint8_t) c] = SPECIAL;
+            t['~'] = TILDE;
+            t['"'] = QUOTE;
+            t[';'] = COMMENT;
+            return t;
+        }();
+        return table.data();
     }
 
-    char peekCharacter() {
-        return isAtEndOfInput() ? '\0' : t_input.at(t_input_index+1);
+    // the rest is where the time goes on big inputs, so each of these looks at a whole
+    // block of bytes at once (SSE2 is always there on x86-64) to find where the run it's
+    // in ends, and finishes the last few bytes (or everything, elsewhere) one at a time.
+    // building with -DMAL_NO_SIMD leaves only the byte at a time loops
+
+#if defined(__SSE2__) && !defined(MAL_NO_SIMD)
+    static constexpr size_t BLOCK = 16;
+
+    // a bit per byte of the block at p that is one of chars
+    template < size_t N >
+    static uint32_t matches(const char* p, const char (&chars)[N]) {
+        auto block = _mm_loadu_si128((const __m128i*) p);
+        auto found = _mm_setzero_si128();
+        // the last one is the string's '\0'
+        for (size_t i = 0; N - 1 > i; ++i)
+            found = _mm_or_si128(found, _mm_cmpeq_epi8(block, _mm_set1_epi8(chars[i])));
+        return _mm_movemask_epi8(found);
     }
 
-    bool isAtEndOfInput() {
-        return t_input_index >= t_input.length();
+    // a bit per byte of the block at p that might end a symbol: anything but a letter,
+    // a digit or a '-', which is most of what symbols and keywords are made of
+    static uint32_t unusual(const char* p) {
+        auto block = _mm_loadu_si128((const __m128i*) p);
+        auto within = [&](char lo, char hi) {
+            return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(lo - 1)),
+                                 _mm_cmplt_epi8(block, _mm_set1_epi8(hi + 1)));
+        };
+        auto usual = _mm_or_si128(_mm_or_si128(within('a', 'z'), within('A', 'Z')),
+                                  _mm_or_si128(within('0', '9'), _mm_cmpeq_epi8(block, _mm_set1_epi8('-'))));
+        return ~_mm_movemask_epi8(usual) & 0xffff;
     }
+#endif
 
-private:
-    string &t_input;
+    // the first character from i on that isn't whitespace or a comma
+    size_t skipSpace(size_t i) {
+        // most runs are a single space
+        if (i < t_input.size() && classOf(t_input[i]) != SPACE)
+            return i;
+        if (++i < t_input.size() && classOf(t_input[i]) != SPACE)
+            return i;
+#if defined(__SSE2__) && !defined(MAL_NO_SIMD)
+        for (; i + BLOCK <= t_input.size(); i += BLOCK) {
+            auto other = ~matches(t_input.data() + i, " \t\n\r,") & 0xffff;
+            if (other != 0)
+                return i + __builtin_ctz(other);
+        }
+#endif
+        while (i < t_input.size() && classOf(t_input[i]) == SPACE)
+            ++i;
+        return i;
+    }
+
+    // just past the " that closes the string whose contents start at i
+    size_t stringEnd(size_t i) {
+        while (true) {
+#if defined(__SSE2__) && !defined(MAL_NO_SIMD)
+            for (; i + BLOCK <= t_input.size(); i += BLOCK) {
+                auto found = matches(t_input.data() + i, "\"\\");
+                if (found != 0) {
+                    i += __builtin_ctz(found);
+                    break;
+                }
+            }
+#endif
+            while (i < t_input.size() && t_input[i] != '"' && t_input[i] != '\\')
+                ++i;
+            if (i >= t_input.size())
+                return t_input.size();
+            if (t_input[i] == '"')
+                return i + 1;
+            // skip \ and the character it escapes
+            i = min(i + 2, t_input.size());
+        }
+    }
+
+    // the first character from i on that can't be part of a symbol or a number
+    size_t atomEnd(size_t i) {
+#if defined(__SSE2__) && !defined(MAL_NO_SIMD)
+        for (; i + BLOCK <= t_input.size(); i += BLOCK) {
+            // the unusual characters still have to be looked up
+            for (auto found = unusual(t_input.data() + i); found != 0; found &= found - 1) {
+                auto at = i + __builtin_ctz(found);
+                if (classOf(t_input[at]) != ATOM_CHAR && t_input[at] != ':')
+                    return at;
+            }
+        }
+#endif
+        while (i < t_input.size()) {
+            auto cls = classOf(t_input[i]);
+            // ':' ends a token only at the start of one
+            if (cls != ATOM_CHAR && t_input[i] != ':')
+                break;
+            ++i;
+        }
+        return i;
+    }
+
+    string_view t_input;
     // default to starting at 0
     size_t t_input_index {0};
 };
 
+// pulls tokens out of the tokenizer as read_form asks for them, so nothing but the
+// token being looked at is ever held on to. call read_form on it until it returns
+// nothing to get the top level forms of the input one at a time
 class Reader {
 public:
-    Reader(vector < string_view > &tokens)
-    : r_tokens { tokens } { }
+    // constants is where the reader gets nil, true, quote... from
+    Reader(string_view input, Env &constants)
+    : r_tokenizer { input }, r_constants { constants } { }
 
-    // returns current token and increments
-    // index
+    // returns current token and moves on to the next one
     optional< string_view > next() {
-        if (!isAtEndOfTokenVector())
-            return r_tokens.at(index++);
-        return {};
+        auto token = peek();
+        r_peeked = false;
+        return token;
     }
 
-    // returns current token without incrementing
-    // index
+    // returns current token without moving on
     optional< string_view > peek() {
-        if (!isAtEndOfTokenVector())
-            return r_tokens.at(index);
-        return {};
+        if (!r_peeked) {
+            r_token = r_tokenizer.nextToken();
+            r_peeked = true;
+        }
+        return r_token;
     }
 
-    bool isAtEndOfTokenVector() {
-        return index >= r_tokens.size();
+    bool isAtEndOfInput() {
+        return !peek();
+    }
+
+    MalType * constant(const string &name) {
+        return r_constants.at(name);
     }
 
 private:
-    vector < string_view > &r_tokens;
-    size_t index { 0 };
+    Tokenizer r_tokenizer;
+    Env &r_constants;
+    // the token peek() has already taken out of the tokenizer
+    optional < string_view > r_token;
+    bool r_peeked { false };
 };
 
-vector < string_view > tokenize(string &input);
-
-optional < MalType * > read_str(string &input, Env);
+// the first form in input
+optional < MalType * > read_str(string_view input, Env &constants);
 
 optional < MalType * > read_form(Reader &reader);
 
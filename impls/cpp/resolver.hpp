@@ -0,0 +1,346 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "mal_types.hpp"
+#include "env.hpp"
+#include "core.hpp"
+
+using namespace std;
+
+// the special forms, defined in main
+extern MalSymbol *DEF, *DEFMACRO, *IF_LET, *LET, *MATCH, *DO, *IF, *COND;
+extern MalSymbol *QUOTE, *QUASIQUOTE, *QUASIQUOTEEXPAND, *FN_STAR, *TIME, *MACROEXPAND, *TRY;
+
+// when fn* creates a function, we go through its body once and replace every variable
+// it binds itself (parameters, let* bindings, the parameters of functions nested in it)
+// with a MalLocal holding the (depth, slot) of the frame it will be in at runtime.
+// if the function is created at the top level, everything else it refers to has to be
+// a global, so those get a MalLocal that goes straight to TOP_LEVEL.
+// anything we can't see the frames of (macro calls, if-let, match cases, catch*, quoted code)
+// is left alone, and keeps getting looked up by name.
+//
+// a function nested in the one being resolved becomes a flat closure when we can see every
+// name it uses: instead of holding on to the environment it gets created in (and with it
+// every frame around it), it copies the few variables it uses from the functions around it
+// into a frame of its own, sitting between its parameters and TOP_LEVEL:
+// (fn* [x] (fn* [y] (+ x y))) => the inner one captures x, and finds it at (1, 0)
+namespace Resolver {
+    // marks a fn* whose body was already resolved along with the function around it,
+    // so EVAL doesn't redo it every time it creates that closure
+    MalSymbol* RESOLVED_FN = MalSymbol::uninterned("fn*");
+
+    // what we know about one runtime frame: the symbol ids it binds, in slot order
+    struct Scope {
+        vector < size_t > ids { };
+        Scope* parent { NULL };
+        // whether the frame above the outermost scope is TOP_LEVEL
+        bool global { false };
+        // whether a function we're in can add names to its frames while it runs
+        // (def!, or a macro that expands to it), that functions nested in it would see
+        bool dynamic { false };
+        // whether this is the frame of a function's parameters
+        bool function { false };
+        // set on the parameters of a flat closure, with the variables it captures (in slot order)
+        bool flat { false };
+        vector < MalSymbol * > captures { };
+        // while a let* evaluates its values, only the first `bound` slots are there,
+        // and `binding` is the id of the one being evaluated
+        size_t bound { SIZE_MAX };
+        size_t binding { SIZE_MAX };
+    };
+
+    // whether form uses names in a way we don't follow: the forms we leave alone,
+    // or def! adding names to the frame it runs in. functions in it are only looked at
+    // when throughFns is set
+    bool opaque(MalType* form, bool throughFns) {
+        vector < MalType * > items;
+        switch (typeOf(form)) {
+            case List:
+            case Vector:
+                items = form->as_sequence()->items();
+                break;
+            case HashMap:
+                for (auto& entry : *form->as_hashmap())
+                    items.push_back(entry.value);
+                break;
+            default:
+                return false;
+        }
+
+        if (typeOf(form) == List && !items.empty() && typeOf(items[0]) == Symbol) {
+            auto head = items[0];
+            if (head == QUOTE || head == QUASIQUOTEEXPAND || head == MACROEXPAND)
+                return false;
+            if (head == FN_STAR && !throughFns)
+                return false;
+            if (head == QUASIQUOTE || head == IF_LET || head == MATCH || head == TRY
+                || head == DEF || head == DEFMACRO)
+                return true;
+            MalType* call_args[1] { form };
+            if (Core::isMacroCall(call_args, 1) == CONSTANTS["true"])
+                return true;
+        }
+        for (auto item : items) {
+            if (opaque(item, throughFns))
+                return true;
+        }
+        return false;
+    }
+
+    bool isBound(MalSymbol* sym, Scope* scope) {
+        for (; scope != NULL; scope = scope->parent) {
+            auto& ids = scope->ids;
+            if (find(ids.begin(), ids.end(), sym->id()) != ids.end())
+                return true;
+        }
+        return false;
+    }
+
+    // whether sym is a let* binding that hasn't got its (final) value yet,
+    // in the closest scope that binds it
+    bool isPending(MalSymbol* sym, Scope* scope) {
+        for (; scope != NULL; scope = scope->parent) {
+            auto& ids = scope->ids;
+            auto found = find(ids.begin(), ids.end(), sym->id());
+            if (found != ids.end())
+                return found - ids.begin() >= scope->bound || scope->binding == sym->id();
+        }
+        return false;
+    }
+
+    // the slot sym gets in the captures of a flat closure
+    size_t capture(MalSymbol* sym, Scope* fnScope) {
+        auto& captures = fnScope->captures;
+        auto found = find(captures.begin(), captures.end(), sym);
+        if (found != captures.end())
+            return found - captures.begin();
+        captures.push_back(sym);
+        return captures.size() - 1;
+    }
+
+    MalType* resolve(MalType* ast, Scope* scope);
+
+    MalType* resolveSymbol(MalSymbol* sym, Scope* scope) {
+        auto& name = sym->str();
+        // eval_ast negates these itself, by looking up the rest of the name.
+        // we still resolve that, so a flat closure captures it
+        if (name.size() > 1 && name[0] == '-') {
+            resolveSymbol(MalSymbol::intern(name.substr(1)), scope);
+            return sym;
+        }
+
+        size_t depth = 0;
+        bool global = scope->global;
+        // whether we're in a closure created inside the scope we're looking at
+        bool inClosure = false;
+        for (; scope != NULL; scope = scope->parent, ++depth) {
+            auto& ids = scope->ids;
+            auto found = find(ids.begin(), ids.end(), sym->id());
+            size_t slot = found - ids.begin();
+            // the let* bindings that come later aren't there yet,
+            // except for closures (which look them up later)
+            if (found != ids.end() && (slot < scope->bound || inClosure))
+                return new MalLocal(sym, depth, slot);
+            // past the parameters of a flat closure come its captures, then TOP_LEVEL
+            if (scope->flat) {
+                if (isBound(sym, scope->parent))
+                    return new MalLocal(sym, depth + 1, capture(sym, scope));
+                return new MalLocal(sym, depth + 2, MalLocal::GLOBAL);
+            }
+            inClosure = inClosure || scope->function;
+        }
+        if (global)
+            return new MalLocal(sym, depth, MalLocal::GLOBAL);
+        return sym;
+    }
+
+    // the ids a parameter or binding list binds, or false if EVAL would reject it anyway
+    bool collectIds(vector < MalType * >& keys, vector < size_t >& ids) {
+        for (auto key : keys) {
+            if (typeOf(key) != Symbol)
+                return false;
+            auto id = key->as_symbol()->id();
+            if (find(ids.begin(), ids.end(), id) == ids.end())
+                ids.push_back(id);
+        }
+        return true;
+    }
+
+    // (fn* params body)
+    MalType* resolveFn(vector < MalType * >& items, Scope* scope) {
+        if (items.size() != 3 || !Core::typeChecksOneOf(typeOf(items[1]), List, Vector))
+            return NULL;
+        auto params = items[1]->as_sequence()->items();
+        vector < MalType * > named;
+        for (auto param : params) {
+            if (inspectOf(param) != "&")
+                named.push_back(param);
+        }
+        // the names a flat closure doesn't capture have to be globals,
+        // and everything it captures has to be around when it gets created
+        auto body = items[2];
+        bool dynamic = scope->dynamic || opaque(body, false);
+        bool flat = scope->global && !scope->dynamic && !opaque(body, true);
+        Scope fnScope { {}, scope, scope->global, dynamic, true, flat };
+        if (!collectIds(named, fnScope.ids) || fnScope.ids.size() != named.size())
+            return NULL;
+
+        auto resolvedBody = resolve(body, &fnScope);
+        // (let* [loop (fn* [n] (loop ...))] ...) only works if the closure holds on to the
+        // let* frame, since loop gets bound after the closure is created.
+        // same for closures referring to the bindings after them
+        for (auto sym : fnScope.captures) {
+            if (isPending(sym, scope)) {
+                fnScope.flat = flat = false;
+                fnScope.captures.clear();
+                resolvedBody = resolve(body, &fnScope);
+                break;
+            }
+        }
+
+        auto res = new MalList;
+        res->append(RESOLVED_FN);
+        res->append(items[1]);
+        res->append(resolvedBody);
+        if (flat) {
+            // where to get the captured values from, when the closure gets created
+            auto captured = new MalList;
+            for (auto sym : fnScope.captures)
+                captured->append(resolveSymbol(sym, scope));
+            res->append(captured);
+        }
+        return res;
+    }
+
+    // (let* bindings body)
+    MalType* resolveLet(vector < MalType * >& items, Scope* scope) {
+        if (items.size() != 3 || !Core::typeChecksOneOf(typeOf(items[1]), List, Vector))
+            return NULL;
+        auto bindings = items[1]->as_sequence()->items();
+        if (bindings.size() % 2 != 0)
+            return NULL;
+
+        // closures in a value see all of the let*, anything else only sees the bindings before it
+        Scope letScope { {}, scope, scope->global, scope->dynamic, false, false };
+        for (int i = 0; bindings.size() > i; i += 2) {
+            vector < MalType * > key { bindings[i] };
+            if (!collectIds(key, letScope.ids))
+                return NULL;
+        }
+        MalSequence* resolved = NULL;
+        if (typeOf(items[1]) == List)
+            resolved = new MalList;
+        else
+            resolved = new MalVector;
+        vector < size_t > seen;
+        for (int i = 0; bindings.size() > i; i += 2) {
+            vector < MalType * > key { bindings[i] };
+            letScope.bound = seen.size();
+            letScope.binding = bindings[i]->as_symbol()->id();
+            resolved->append(bindings[i]);
+            resolved->append(resolve(bindings[i+1], &letScope));
+            collectIds(key, seen);
+        }
+        letScope.bound = SIZE_MAX;
+        letScope.binding = SIZE_MAX;
+
+        auto res = new MalList;
+        res->append(items[0]);
+        res->append(resolved);
+        res->append(resolve(items[2], &letScope));
+        return res;
+    }
+
+    // a copy of items as a list, with the ones from `from` on resolved
+    MalType* resolveFrom(vector < MalType * >& items, size_t from, Scope* scope) {
+        auto res = new MalList;
+        for (size_t i = 0; items.size() > i; ++i)
+            res->append(i >= from ? resolve(items[i], scope) : items[i]);
+        return res;
+    }
+
+    MalType* resolveList(MalList* list, Scope* scope) {
+        auto items = list->items();
+        if (items.empty())
+            return list;
+
+        auto head = items[0];
+        if (typeOf(head) == Symbol) {
+            // these are dispatched on by EVAL no matter what the name is bound to
+            if (head == QUOTE || head == QUASIQUOTE || head == QUASIQUOTEEXPAND
+                || head == MACROEXPAND || head == IF_LET || head == RESOLVED_FN) {
+                return list;
+            } else if (head == FN_STAR) {
+                auto res = resolveFn(items, scope);
+                return res != NULL ? res : list;
+            } else if (head == LET) {
+                auto res = resolveLet(items, scope);
+                return res != NULL ? res : list;
+            } else if (head == DEF || head == DEFMACRO) {
+                // only the value, def! adds the name to whatever frame it runs in
+                return items.size() == 3 ? resolveFrom(items, 2, scope) : list;
+            } else if (head == MATCH || head == TRY) {
+                // the cases and the catch* run in frames of their own
+                if (items.size() < 2)
+                    return list;
+                auto res = new MalList;
+                for (size_t i = 0; items.size() > i; ++i)
+                    res->append(i == 1 ? resolve(items[i], scope) : items[i]);
+                return res;
+            } else if (head == COND) {
+                auto res = new MalList;
+                res->append(head);
+                for (size_t i = 1; items.size() > i; ++i) {
+                    auto item = items[i];
+                    if (Core::typeCheck(typeOf(item), List)) {
+                        auto cases = item->as_list()->items();
+                        res->append(resolveFrom(cases, 0, scope));
+                    } else {
+                        res->append(resolve(item, scope));
+                    }
+                }
+                return res;
+            } else if (head == DO || head == IF || head == TIME) {
+                return resolveFrom(items, 1, scope);
+            }
+
+            // a macro could expand into anything, so we leave the call as it is
+            MalType* call_args[1] { list };
+            if (Core::isMacroCall(call_args, 1) == CONSTANTS["true"])
+                return list;
+        }
+        return resolveFrom(items, 0, scope);
+    }
+
+    MalType* resolve(MalType* ast, Scope* scope) {
+        switch (typeOf(ast)) {
+            case Symbol:
+                return resolveSymbol(ast->as_symbol(), scope);
+            case List:
+                return resolveList(ast->as_list(), scope);
+            case Vector: {
+                auto res = new MalVector;
+                for (auto item : *ast->as_vector())
+                    res->append(resolve(item, scope));
+                return res;
+            }
+            case HashMap: {
+                auto res = new MalHashMap;
+                for (auto& entry : *ast->as_hashmap())
+                    res->set(entry.key, resolve(entry.value, scope));
+                return res;
+            }
+            default:
+                return ast;
+        }
+    }
+
+    // resolves the body of a function being created in env, with these (already checked) parameters
+    MalType* resolveBody(vector < MalType * >& params, MalType* body, Environ* env) {
+        // this one just holds on to env
+        Scope fnScope { {}, NULL, env == TOP_LEVEL, opaque(body, false), true, false };
+        collectIds(params, fnScope.ids);
+        return resolve(body, &fnScope);
+    }
+}
@@ -13,10 +13,10 @@ using std::cout;
 using std::cin;
 using std::endl;
 
-auto NIL = new MalNil();
-auto TRUE = new MalBoolean(true);
-auto FALSE = new MalBoolean(false);
-auto VARIADIC = new MalSymbol("&");
+auto NIL = MAL_NIL;
+auto TRUE = MAL_TRUE;
+auto FALSE = MAL_FALSE;
+auto VARIADIC = MalSymbol::intern("&");
 auto SPREAD = new MalSpreader();
 
 MalType* READ(string input) {
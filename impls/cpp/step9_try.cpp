@@ -7,6 +7,12 @@
 #include "mal_types.hpp"
 #include "env.hpp"
 #include "core.hpp"
+#include "resolver.hpp"
+#include "compiler.hpp"
+#include "profile.hpp"
+#include "vm.hpp"
+#include "modules.hpp"
+#include "image.hpp"
 
 using std::string;
 using std::getline;
@@ -15,16 +21,30 @@ using std::cin;
 using std::endl;
 using namespace std::chrono;
 
-auto NIL = new MalNil();
-auto TRUE = new MalBoolean(true);
-auto FALSE = new MalBoolean(false);
-auto VARIADIC = new MalSymbol("&");
-auto QUOTE = new MalSymbol("quote");
-auto QUASIQUOTE = new MalSymbol("quasiquote");
-auto SPLICE = new MalSymbol("splice-unquote");
-auto UNQUOTE = new MalSymbol("unquote");
-auto DEREF = new MalSymbol("deref");
-auto WITHMETA = new MalSymbol("with-meta");
+auto NIL = MAL_NIL;
+auto TRUE = MAL_TRUE;
+auto FALSE = MAL_FALSE;
+auto VARIADIC = MalSymbol::intern("&");
+MalSymbol* QUOTE = MalSymbol::intern("quote");
+MalSymbol* QUASIQUOTE = MalSymbol::intern("quasiquote");
+auto SPLICE = MalSymbol::intern("splice-unquote");
+auto UNQUOTE = MalSymbol::intern("unquote");
+auto DEREF = MalSymbol::intern("deref");
+auto WITHMETA = MalSymbol::intern("with-meta");
+// the special forms, EVAL dispatches on them by comparing pointers
+MalSymbol* DEF = MalSymbol::intern("def!");
+MalSymbol* DEFMACRO = MalSymbol::intern("defmacro!");
+MalSymbol* IF_LET = MalSymbol::intern("if-let");
+MalSymbol* LET = MalSymbol::intern("let*");
+MalSymbol* MATCH = MalSymbol::intern("match");
+MalSymbol* DO = MalSymbol::intern("do");
+MalSymbol* IF = MalSymbol::intern("if");
+MalSymbol* COND = MalSymbol::intern("cond");
+MalSymbol* QUASIQUOTEEXPAND = MalSymbol::intern("quasiquoteexpand");
+MalSymbol* FN_STAR = MalSymbol::intern("fn*");
+MalSymbol* TIME = MalSymbol::intern("time");
+MalSymbol* MACROEXPAND = MalSymbol::intern("macroexpand");
+MalSymbol* TRY = MalSymbol::intern("try*");
 auto SPREAD = new MalSpreader();
 auto NEWLINE = new MalString("\n");
 // used for commandline argument
@@ -37,44 +57,68 @@ MalType * READ(string input) {
     return NIL;
 }
 
+// evaluates every item of a list or vector into results, which the caller keeps rooted
+void evalItems(MalType * ast, Environ* curEnv, vector < MalType * >& results) {
+    GCRoot envRoot(curEnv);
+    if (typeOf(ast) == List) {
+        // walk the cells, holding on to the rest of the list since it might move during an EVAL
+        auto cell = ast->as_list();
+        GCRoot cellRoot(cell);
+        results.reserve(cell->count());
+        for (; !cell->empty(); cell = cell->rest())
+            results.push_back(EVAL(cell->first(), curEnv));
+        return;
+    }
+    GCRoot astRoot(ast);
+    auto count = ast->as_sequence()->count();
+    results.reserve(count);
+    for (size_t i = 0; count > i; ++i) {
+        // read out of ast again, it might have moved during the last EVAL
+        auto val = EVAL(ast->as_sequence()->at(i), curEnv);
+        results.push_back(val);
+    }
+}
+
 MalType * eval_ast(MalType * ast, Environ* curEnv) {
-    switch (ast->type()) {
+    GCRoot envRoot(curEnv);
+    switch (typeOf(ast)) {
         case Symbol: {
             // check if we have a negated symbol
             // if we do, call MAL's - on it
             auto sym = ast->as_symbol();
-            auto symstr = sym->str();
+            auto& symstr = sym->str();
             if (symstr[0] == '-' && symstr.size() > 1) {
-                auto actual = new MalSymbol(symstr.substr(1, symstr.size()));
+                auto actual = MalSymbol::intern(symstr.substr(1, symstr.size()));
                 MalType* arg[1] { curEnv->get(actual) };
                 return Core::sub(arg, 1);
             } else {
                 return curEnv->get(sym);
             }
         }
+        case Local:
+            return curEnv->lookup(ast->as_local());
         case List: {
-            auto results = new MalList;
-            for (auto i : ast->as_list()->items()) {
-                results->append(EVAL(i, curEnv));
-            }
-            return results;
+            vector < MalType * > results;
+            GCRoot resultsRoot(results);
+            evalItems(ast, curEnv, results);
+            return new MalList(std::move(results));
         }
         case Vector: {
-            auto results = new MalVector;
-            for (auto i : ast->as_vector()->items()) {
-                results->append(EVAL(i, curEnv));
-            }
-            return results;
+            vector < MalType * > results;
+            GCRoot resultsRoot(results);
+            evalItems(ast, curEnv, results);
+            return new MalVector(std::move(results));
         }
         case HashMap: {
             auto hmap = new MalHashMap;
             auto items = ast->as_hashmap()->items();
+            GCRoot hmapRoot(hmap);
+            GCRoot itemsRoot(items);
             
-            for (auto pair : ast->as_hashmap()->items()) {
-                auto inside = pair.second->as_pair();
-                auto val = inside->items()[0];
-                auto actual = inside->items()[1];
-                hmap->set(pair.first, actual, EVAL(val, curEnv));
+            // keys and values take turns in items
+            for (size_t i = 0; items.size() > i; i += 2) {
+                auto val = EVAL(items[i + 1], curEnv);
+                hmap->set(items[i], val);
             }
             return hmap;
         }
@@ -84,32 +128,344 @@ MalType * eval_ast(MalType * ast, Environ* curEnv) {
     return ast;
 }
 
+// evaluates a part of a compiled form (see compiler.hpp).
+// variables and values that evaluate to themselves don't need to go through EVAL
+MalType * evalPart(MalType * part, Environ* curEnv) {
+    switch (typeOf(part)) {
+        case Local:
+            return curEnv->lookup(part->as_local());
+        case Symbol:
+        case Node:
+            return EVAL(part, curEnv);
+        default:
+            return part;
+    }
+}
+
+// the environment a function created in curEnv holds on to.
+// a flat closure gets a frame with just the variables it captures (see resolver.hpp)
+Environ* closureEnv(MalType * captures, Environ* curEnv) {
+    if (captures == NULL)
+        return curEnv;
+    auto env = new Environ(TOP_LEVEL);
+    for (auto captured : *captures->as_list()) {
+        auto local = captured->as_local();
+        env->bind(local->symbol(), curEnv->lookup(local));
+    }
+    return env;
+}
+
+// names the function def! (or defmacro!) binds to key, and makes it a macro for defmacro!.
+// val is what e_val was evaluated from
+void nameDefinition(MalType * key, MalType * e_val, MalType * val, bool is_macro) {
+    // set function's name to key's inspect
+    if (typeOf(e_val) == Func) {
+        auto fn = e_val->as_func();
+        // currently unnamed
+        if (fn->name() == "<~lambda~>") {
+            fn->setName(inspectOf(key));
+        }
+    } else if (typeOf(e_val) == TCOptFunc) {
+        auto fn = e_val->as_tcoptfunc();
+        // currently unnamed
+        if (fn->name() == "<~lambda~>") {
+            fn->setName(inspectOf(key));
+        }
+        if (is_macro) {
+            fn->changeMacroStatus(is_macro);
+        }                                
+    } else if (is_macro) {
+        // we don't want non-callables assigned with the defmacro! form
+        auto e = TypeException();
+        e.errMessage = "'" + inspectOf(val) + "' is not a Callable. defmacro! expects a Callable as it's second argument";
+        throw e;
+    }
+}
+
+// adds args to arguments, with any spread syntax expanded
+void spreadInto(MalType ** args, size_t argc, vector < MalType * >& arguments) {
+    for (int i = 0; argc > i; ++i) {
+        auto item = args[i];
+        // we have found an expand in args, so we need to:
+        // make sure there is an argument after it, 
+        // and it is a sequence. then we take this sequence
+        // and add it to our arguments list, and track arguments count
+        // as well
+        // allows things like:
+        // (callable 1 2 3 ... a), where a is [1 2 3] becomes:
+        // (callable 1 2 3 1 2 3)
+        if (typeOf(item) == Spreader) {
+            if (i + 1 >= argc) {
+                auto e = RuntimeException();
+                e.errMessage = "'...' must be followed by another argument.";
+                throw e;
+            }
+            auto a = args[++i];
+            // cout << inspectOf(obj) << endl;
+            if (!Core::typeChecksOneOf(typeOf(a), List, Vector)) {
+                auto e = RuntimeException();
+                e.errMessage = "'...' must be followed by Sequential type (List|Vector).";
+                throw e;
+            }
+            for (auto i : *a->as_sequence()) {
+                arguments.push_back(i);
+            }
+        } else {
+            arguments.push_back(item);
+        }
+    }
+}
+
+// the environment a call to tcofn runs its body in, with arguments bound to its parameters
+Environ* callEnv(MalTCOptFunc* tcofn, vector < MalType * >& arguments) {
+    bool variadic = tcofn->isVariad();
+    auto envAtTime = tcofn->getEnviron();
+    auto params = tcofn->getParameters();
+    Environ* newFnEnv = NULL;
+    // Environ* newFnEnv = new Environ(envAtTime, params, arguments);
+    if (variadic) {
+        if (arguments.size() < (params.size() - 1)) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "variadic function requires at least " + to_string(params.size() - 1) + " arguments.";
+            throw runExcep;
+        }
+        auto variadList = new MalVector;
+        vector < MalType* > variad_args;
+        for (int i = 0; params.size() - 1 > i; ++i) {
+            variad_args.push_back(arguments[i]);
+        }
+
+        for (int i = params.size() - 1; arguments.size() > i; ++i) {
+            variadList->append(arguments[i]);
+        } 
+
+        variad_args.push_back(variadList);
+        newFnEnv = new Environ(envAtTime, params, variad_args);
+    } else {
+        newFnEnv = new Environ(envAtTime, params, arguments);
+    }
+    return newFnEnv;
+}
+
+// calls list[0] with the rest of list as its arguments.
+// a builtin's result (or a function the VM runs) goes into result (and we return true).
+// a user function is set up as a tail call instead: ast and curEnv get pointed at its body, and a new environment
+// with the arguments bound in it. callForm is the form the list was evaluated from,
+// and profiled is where the calling EVAL keeps track of the functions it runs (see profile.hpp)
+bool apply(vector < MalType * >& list, MalType * callForm, MalType *& ast, Environ*& curEnv, MalType *& result,
+           Profile::Mark& profiled) {
+    auto callable = list[0];
+
+    // process args to find any spread syntax
+    vector < MalType * > arguments;
+    GCRoot argumentsRoot(arguments);
+    spreadInto(list.data() + 1, list.size() - 1, arguments);
+
+    // check if fn is built in or a user fn
+    if (Core::typeCheck(typeOf(callable), Func)) {
+        auto a_args = arguments.data();
+        auto fn = callable->as_func();
+        Profile::Mark builtin;
+        builtin.call(fn);
+        result = fn->callable()(a_args, arguments.size());
+        return true;
+    } else if (Core::typeCheck(typeOf(callable), TCOptFunc)) {
+        auto tcofn = callable->as_tcoptfunc();
+        // functions the VM compiled run there instead (see vm.hpp)
+        if (tcofn->getCode() != NULL) {
+            result = VM::call(tcofn, arguments);
+            return true;
+        }
+        auto newFnEnv = callEnv(tcofn, arguments);
+        ast = tcofn->getBody();
+        curEnv = newFnEnv;
+        profiled.call(tcofn);
+        return false;
+    } else if (typeOf(callable) == Keyword) {
+        size_t cached = 0;
+        result = Core::keywordGet(callable, arguments.data(), arguments.size(), cached);
+        return true;
+    }
+
+    auto nonCallable = callForm->as_list()->at(0);
+    auto typeExcept = TypeException();
+    typeExcept.errMessage = "'" + inspectOf(nonCallable) + "' is not a Callable.";
+    throw typeExcept;
+}
+
 MalType * EVAL(MalType * ast, Environ* curEnv) {
+    // ast and curEnv are all this frame needs between iterations,
+    // so they are what we keep alive across collections
+    GCRoot astRoot(ast);
+    GCRoot envRoot(curEnv);
+    // the function this frame is running, for --profile
+    Profile::Mark profiled;
     // we implement tail call optim
     while (true) { 
+        GC::safepoint();
+        // a compiled function body (see compiler.hpp).
+        // the node can move whenever we EVAL one of its parts,
+        // so we read it out of the (rooted) ast again after each one
+        if (typeOf(ast) == Node) {
+            using namespace Compiler;
+            switch (ast->as_node()->kind()) {
+                case MalNode::ConstKind:
+                    return static_cast< ConstNode* >(ast)->value;
+                case MalNode::IfKind: {
+                    auto e_cond = evalPart(static_cast< IfNode* >(ast)->cond, curEnv);
+                    auto node = static_cast< IfNode* >(ast);
+                    // nil and false are the only nontruthy values
+                    ast = e_cond == NIL || e_cond == FALSE ? node->otherwise : node->then;
+                    continue;
+                }
+                case MalNode::DoKind: {
+                    auto last = static_cast< ListNode* >(ast)->items.size() - 1;
+                    for (size_t i = 0; last > i; ++i)
+                        evalPart(static_cast< ListNode* >(ast)->items[i], curEnv);
+                    ast = static_cast< ListNode* >(ast)->items[last];
+                    continue;
+                }
+                case MalNode::LetKind: {
+                    auto letEnv = new Environ(curEnv);
+                    GCRoot letEnvRoot(letEnv);
+                    auto count = static_cast< LetNode* >(ast)->keys.size();
+                    for (size_t i = 0; count > i; ++i) {
+                        auto val = evalPart(static_cast< LetNode* >(ast)->values[i], letEnv);
+                        letEnv->bind(static_cast< LetNode* >(ast)->keys[i], val);
+                    }
+                    curEnv = letEnv;
+                    ast = static_cast< LetNode* >(ast)->body;
+                    continue;
+                }
+                case MalNode::CondKind: {
+                    auto count = static_cast< CondNode* >(ast)->conds.size();
+                    MalType* body = NIL;
+                    for (size_t i = 0; count > i; ++i) {
+                        auto cond = evalPart(static_cast< CondNode* >(ast)->conds[i], curEnv);
+                        if (cond == NIL || cond == FALSE)
+                            continue;
+                        if (cond != TRUE) {
+                            auto e = TypeException();
+                            e.errMessage = "Each cond case's condition should evaluate to Nil or Boolean.";
+                            throw e;
+                        }
+                        body = static_cast< CondNode* >(ast)->bodies[i];
+                        break;
+                    }
+                    ast = body;
+                    continue;
+                }
+                case MalNode::FnKind: {
+                    auto node = static_cast< FnNode* >(ast);
+                    auto env = closureEnv(node->captures, curEnv);
+                    return new MalTCOptFunc(node->body, node->params, env, node->variadic);
+                }
+                case MalNode::DefKind: {
+                    auto e_val = evalPart(static_cast< DefNode* >(ast)->value, curEnv);
+                    auto node = static_cast< DefNode* >(ast);
+                    nameDefinition(node->key, e_val, node->value, node->isMacro);
+                    Core::noteDefinition(curEnv, node->key, e_val);
+                    curEnv->set(node->key, e_val);
+                    return e_val;
+                }
+                case MalNode::CallKind: {
+                    auto count = static_cast< ListNode* >(ast)->items.size();
+                    vector < MalType * > list;
+                    list.reserve(count);
+                    GCRoot listRoot(list);
+                    list.push_back(evalPart(static_cast< ListNode* >(ast)->items[0], curEnv));
+                    // a macro defined after the function was compiled gets the
+                    // unevaluated forms, so check before evaluating any argument
+                    auto callForm = static_cast< ListNode* >(ast)->form();
+                    if (typeOf(list[0]) == TCOptFunc && list[0]->as_tcoptfunc()->isMacro()) {
+                        ast = callForm;
+                        continue;
+                    }
+                    for (size_t i = 1; count > i; ++i) {
+                        auto val = evalPart(static_cast< ListNode* >(ast)->items[i], curEnv);
+                        list.push_back(val);
+                    }
+                    MalType* result = NULL;
+                    if (apply(list, callForm, ast, curEnv, result, profiled))
+                        return result;
+                    continue;
+                }
+                case MalNode::KeyKind: {
+                    auto count = static_cast< KeyNode* >(ast)->args.size();
+                    MalType* args[2] { NULL, NULL };
+                    GCRoot mapRoot(args[0]);
+                    for (size_t i = 0; count > i; ++i)
+                        args[i] = evalPart(static_cast< KeyNode* >(ast)->args[i], curEnv);
+                    auto node = static_cast< KeyNode* >(ast);
+                    return Core::keywordGet(node->key, args, count, node->slot);
+                }
+                case MalNode::VectorKind: {
+                    auto results = new MalVector;
+                    GCRoot resultsRoot(results);
+                    auto count = static_cast< ListNode* >(ast)->items.size();
+                    for (size_t i = 0; count > i; ++i) {
+                        auto val = evalPart(static_cast< ListNode* >(ast)->items[i], curEnv);
+                        results->append(val);
+                    }
+                    return results;
+                }
+                case MalNode::MapKind: {
+                    auto hmap = new MalHashMap;
+                    GCRoot hmapRoot(hmap);
+                    auto count = static_cast< MapNode* >(ast)->keys.size();
+                    for (size_t i = 0; count > i; ++i) {
+                        auto val = evalPart(static_cast< MapNode* >(ast)->values[i], curEnv);
+                        hmap->set(static_cast< MapNode* >(ast)->keys[i], val);
+                    }
+                    return hmap;
+                }
+                case MalNode::MacroKind: {
+                    auto node = static_cast< MacroNode* >(ast);
+                    if (node->expansion != NULL && node->epoch == Core::macroEpoch) {
+                        ast = node->expansion;
+                        continue;
+                    }
+                    // read before expanding, so a macro that defines a macro gets expanded again next time
+                    auto epoch = Core::macroEpoch;
+                    // a macro it expands to might not have literal arguments
+                    bool fixed = true;
+                    auto expansion = Compiler::compile(Core::expandAll(node->form(), fixed));
+                    // the node might have moved while the macro ran
+                    if (fixed)
+                        static_cast< MacroNode* >(ast)->remember(expansion, epoch);
+                    ast = expansion;
+                    continue;
+                }
+                case MalNode::FormKind:
+                    // EVAL takes it from here
+                    ast = static_cast< FormNode* >(ast)->form();
+                    break;
+            }
+        }
         // not a list, call eval_ast and return its result
-        if (ast->type() != List) {
+        if (typeOf(ast) != List) {
             return eval_ast(ast, curEnv);
-        } else if (ast->type() == List && ast->as_list()->items().empty()) {
+        } else if (typeOf(ast) == List && ast->as_list()->empty()) {
             // empty list
             return ast;
         } else { // a non-empty list
             // do macro expansion
             MalType* expand[1] { ast };
             ast = Core::macroExpand(expand, 1);
-            if (!Core::typeCheck(ast->type(), List))
+            if (!Core::typeCheck(typeOf(ast), List))
                 return eval_ast(ast, curEnv);
 
             // take the first item and check if it is a symbol
             auto rawlist = ast->as_list()->items();
+            // the special forms below read their parts out of rawlist
+            // again after every EVAL, as they might have been moved
+            GCRoot rawlistRoot(rawlist);
             auto firstItem = rawlist[0];
             
-            if(firstItem->type() == Symbol) {
+            if(typeOf(firstItem) == Symbol) {
                 // if it is a Symbol, is it def! or let*?
-                auto symstr = firstItem->as_symbol()->str();
-
-                if (symstr == "def!" || symstr == "defmacro!") { // if it is a def!
-                    bool is_macro = symstr == "defmacro!" ? true : false;
+                if (firstItem == DEF || firstItem == DEFMACRO) { // if it is a def!
+                    bool is_macro = firstItem == DEFMACRO;
                     // make sure we have 3 parameters
                     if (rawlist.size() != 3) {
                         auto runExcep = RuntimeException();
@@ -120,9 +476,9 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                         throw runExcep;
                     }
                 
+                    auto e_val = EVAL(rawlist[2], curEnv);
                     auto key = rawlist[1];
                     auto val = rawlist[2];
-                    auto e_val = EVAL(val, curEnv);
                     
                     // since def! form looks like: (def! a b)
                     // where a is either 
@@ -140,30 +496,9 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     // (def! a [1 2 3]) or (def! a true) -> a is [1 2 3] or a is true
                     
                     // if we are not handling multiple bindings, 
-                    if (!Core::typeChecksOneOf(key->type(), Vector, List)) {
-                        // set function's name to key's inspect
-                        if (e_val->type() == Func) {
-                            auto fn = e_val->as_func();
-                            // currently unnamed
-                            if (fn->name() == "<~lambda~>") {
-                                fn->setName(key->inspect());
-                            }
-                        } else if (e_val->type() == TCOptFunc) {
-                            auto fn = e_val->as_tcoptfunc()->getMalFunc();
-                            // currently unnamed
-                            if (fn->name() == "<~lambda~>") {
-                                fn->setName(key->inspect());
-                            }
-                            auto outer = e_val->as_tcoptfunc();
-                            if (is_macro) {
-                                outer->changeMacroStatus(is_macro);
-                            }                                
-                        } else if (is_macro) {
-                            // we don't want non-callables assigned with the defmacro! form
-                            auto e = TypeException();
-                            e.errMessage = "'" + val->inspect() + "' is not a Callable. defmacro! expects a Callable as it's second argument";
-                            throw e;
-                        }
+                    if (!Core::typeChecksOneOf(typeOf(key), Vector, List)) {
+                        nameDefinition(key, e_val, val, is_macro);
+                        Core::noteDefinition(curEnv, key, e_val);
                         curEnv->set(key, e_val);
                     } else { // we are handling multiple bindings.
                         if (is_macro) {
@@ -176,9 +511,9 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                         // TODO: allow multiple variables to be initialized
                         // with the same value, instead of a 1 to 1 initialization
                         // with a sequence
-                        if (!Core::typeChecksOneOf(e_val->type(), List, Vector)) {
+                        if (!Core::typeChecksOneOf(typeOf(e_val), List, Vector)) {
                             auto e = TypeException();
-                            e.errMessage = "'" + val->inspect() + "' is not a sequence that can be used in multiple bindings.";
+                            e.errMessage = "'" + inspectOf(val) + "' is not a sequence that can be used in multiple bindings.";
                             throw e;
                         } else {
                             // check if we are looking at multiple bindings with a variadic end
@@ -194,23 +529,23 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                             vector < string > key_insp;
                             for (int i = 0; keys.size() > i; ++i) {
                                 auto item = keys[i];
-                                auto found = find(key_insp.begin(), key_insp.end(), item->inspect());
+                                auto found = find(key_insp.begin(), key_insp.end(), inspectOf(item));
                                 // duplicate check
                                 if (found != key_insp.end()) {
                                     auto runExcep = RuntimeException();
                                     runExcep.errMessage = "def! parameters have to be unique (";
-                                    runExcep.errMessage += item->inspect() + " has multiple references).";
+                                    runExcep.errMessage += inspectOf(item) + " has multiple references).";
                                     throw runExcep;
                                 }
                                 // type check
-                                if (!Core::typeChecksOneOf(item->type(), Symbol, Keyword)) {
+                                if (!Core::typeChecksOneOf(typeOf(item), Symbol, Keyword)) {
                                     auto runExcep = RuntimeException();
                                     runExcep.errMessage = "def! parameters have to be bindable Symbols/Keywords. ";
-                                    runExcep.errMessage += "'" + item->inspect() + "' is not.";
+                                    runExcep.errMessage += "'" + inspectOf(item) + "' is not.";
                                     throw runExcep;
                                 }
                                 // variadic check
-                                if (item->inspect() == "&") {
+                                if (inspectOf(item) == "&") {
                                     if (i + 2 != keys.size()) {
                                         auto runExcep = RuntimeException();
                                         runExcep.errMessage = "variadic binding requires 1 variadic parameter at end of parameters list.";
@@ -232,21 +567,21 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                         e.errMessage += "only if there is at least some non-variadic key occuring before it.\n";
                                         
                                         if (is_macro)
-                                            e.errMessage += "using (defmacro! " + variad_k->inspect() + " " + val->inspect() + ") ";
+                                            e.errMessage += "using (defmacro! " + inspectOf(variad_k) + " " + inspectOf(val) + ") ";
                                         else
-                                            e.errMessage += "using (def! " + variad_k->inspect() + " " + val->inspect() + ") ";
+                                            e.errMessage += "using (def! " + inspectOf(variad_k) + " " + inspectOf(val) + ") ";
                                         e.errMessage += "has a similar effect, only differing in the sequential type\n";
-                                        e.errMessage += "that " + variad_k->inspect() + " is set to.";
+                                        e.errMessage += "that " + inspectOf(variad_k) + " is set to.";
                                         throw e;
                                     }
-                                    // cout << "variad! -> " << item->inspect() << " at " + to_string(i) <<  endl;
+                                    // cout << "variad! -> " << inspectOf(item) << " at " + to_string(i) <<  endl;
                                     variadic = true;
                                     variadic_index = i;
                                     continue;
                                 }
-                                // cout << "non_variad -> " << item->inspect() << endl;
+                                // cout << "non_variad -> " << inspectOf(item) << endl;
                                 bind_keys.push_back(item);
-                                key_insp.push_back(item->inspect());
+                                key_insp.push_back(inspectOf(item));
                             }
 
                             auto bind_args = e_val->as_sequence()->items();
@@ -261,6 +596,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                 }
                                 // define non-variadic keys
                                 for (int i = 0; nonVariadLength > i; ++i) {
+                                    Core::noteDefinition(curEnv, bind_keys[i], bind_args[i]);
                                     curEnv->set(bind_keys[i], bind_args[i]);
                                 }
                                 // copy the rest of arguments from value sequence into a MalList
@@ -271,6 +607,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
 
                                 // then set the variad key to this variad arguements list
                                 auto variad_k = keys[variadic_index+1];
+                                Core::noteDefinition(curEnv, variad_k, last_variad);
                                 curEnv->set(variad_k, last_variad);
                             } else {
                                 // make sure we have enough arguments
@@ -282,13 +619,14 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                     throw e;
                                 }    
                                 for (int i = 0; bind_keys.size() > i; ++i) {
+                                    Core::noteDefinition(curEnv, bind_keys[i], bind_args[i]);
                                     curEnv->set(bind_keys[i], bind_args[i]);
                                 }
                             }
                         }
                     }
                     return e_val;
-                } else if (symstr == "if-let") { // a mix of if, and a binding let
+                } else if (firstItem == IF_LET) { // a mix of if, and a binding let
                     // if-let is used like so:
                     // (if-let [key value]
                     //      trueBody
@@ -301,16 +639,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
 
                     auto bindingList = rawlist[1];
 
-                    auto trueBody = rawlist[2];
-                    MalType* falseBody = NIL;
-                    if (rawlist.size() == 4) {
-                        falseBody = rawlist[3];
-                    }
-                    // cout << bindingList->inspect() << endl;
-                    // cout << trueBody->inspect() << endl;
-                    // cout << falseBody->inspect() << endl;
-
-                    if (!Core::typeChecksOneOf(bindingList->type(), List, Vector)) {
+                    if (!Core::typeChecksOneOf(typeOf(bindingList), List, Vector)) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "if-let form requires 2nd argument to be a sequence of a binding key and value.";
                         throw runExcep;
@@ -325,22 +654,28 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
 
                     // bind into new let environ
                     auto letEnv = new Environ(curEnv);
-                    auto k = bindings[0];
-                    auto v = bindings[1];
-                    auto res = EVAL(v, letEnv);
-                    letEnv->set(k, res);
+                    GCRoot letEnvRoot(letEnv);
+                    GCRoot bindingsRoot(bindings);
+                    auto res = EVAL(bindings[1], letEnv);
+                    letEnv->bind(bindings[0], res);
                     curEnv = letEnv;
 
-                    if (res->type() == Nil) {
+                    auto trueBody = rawlist[2];
+                    MalType* falseBody = NIL;
+                    if (rawlist.size() == 4) {
+                        falseBody = rawlist[3];
+                    }
+
+                    if (typeOf(res) == Nil) {
                         ast = falseBody;
                         continue;
-                    } else if (res->type() == Boolean && res->inspect() == "false") {
+                    } else if (res == FALSE) {
                         ast = falseBody;
                         continue;
                     }
                     ast = trueBody;
                     continue;
-                } else if (symstr == "let*") {
+                } else if (firstItem == LET) {
                     // make sure it has 3 parameters
                     if (rawlist.size() != 3) {
                         auto runExcep = RuntimeException();
@@ -349,14 +684,15 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     }
                     // get bindings and let* body
                     auto bindings = rawlist[1];
-                    auto body = rawlist[2];
                     // create let* env
                     auto letEnv = new Environ(curEnv);
+                    GCRoot letEnvRoot(letEnv);
                     // make sure bindings are in a list
-                    if (Core::typeChecksOneOf(bindings->type(), List, Vector)) {
+                    if (Core::typeChecksOneOf(typeOf(bindings), List, Vector)) {
                         // instead of doing an eval on body, we need to loop over
                         // after setting things correctly:
                         auto items = bindings->as_sequence()->items();
+                        GCRoot itemsRoot(items);
                         // make sure list has even number of elements
                         if (items.size() % 2 != 0) {
                             auto runExcep = RuntimeException();
@@ -366,23 +702,22 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
 
                         // bind each key in list to its value in let* env
                         for (int i = 0; items.size() > i; i += 2) {
-                            auto key = items[i];
-                            auto val = items[i+1];
-                            letEnv->set(key, EVAL(val, letEnv));
+                            auto val = EVAL(items[i+1], letEnv);
+                            letEnv->bind(items[i], val);
                         }
 
                         // we do tail call optimization 
                         // set ast = body
                         // set env = letEnv and then restart the loop
                         curEnv = letEnv;
-                        ast = body;
+                        ast = rawlist[2];
                         continue;
                     } else {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "let* form requires 2nd argument to be a sequence of bindings.";
                         throw runExcep;
                     }
-                } else if (symstr == "match") {
+                } else if (firstItem == MATCH) {
                     // make sure it has at least 2 extra params
                     if (rawlist.size() < 3) {
                         auto runExcep = RuntimeException();
@@ -391,44 +726,46 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     }
 
                     auto matchArg = EVAL(rawlist[1], curEnv);
-                    auto stype = matchArg->stringedType()->inspect(false);
+                    GCRoot matchArgRoot(matchArg);
+                    auto stype = stringedTypeOf(matchArg)->inspect(false);
                     bool matched = false;
                     for (int i = 2; rawlist.size() > i; ++i) {
                         auto item = rawlist[i];
                         // make sure item is a Sequence
-                        if (!Core::typeChecksOneOf(item->type(), List, Vector)) {
+                        if (!Core::typeChecksOneOf(typeOf(item), List, Vector)) {
                             auto e = TypeException();
-                            e.errMessage = "'" + item->inspect() + "' is not a Sequence. Each match case should be a Sequence.";
+                            e.errMessage = "'" + inspectOf(item) + "' is not a Sequence. Each match case should be a Sequence.";
                             throw e;
                         }
                         auto mcase = item->as_sequence()->items();
+                        GCRoot mcaseRoot(mcase);
                         if (mcase.size() != 2) {
                             auto e = RuntimeException();
                             e.errMessage = "Each match case requires a TypePattern and a body: [TypePattern body].";
                             throw e;
                         }
+                        // the body (mcase[1]) is read after any EVAL in the pattern
                         auto pattern = mcase[0];
-                        auto body = mcase[1];
 
-                        switch (pattern->type()) {
+                        switch (typeOf(pattern)) {
                             case Keyword: {
                                 // make sure it's :All, which is the catchall case.
                                 auto kw = pattern->as_keyword();
-                                auto matchT = kw->inspect();
+                                auto matchT = inspectOf(kw);
                                 
                                 if (stype == matchT.substr(1, matchT.size())) {
-                                    ast = body;
+                                    ast = mcase[1];
                                     matched = true;
                                     break;
                                 } else if (matchT == ":Func") {
                                     if (stype == matchT.substr(1, matchT.size()) 
                                         || stype == "TCOFunc") {
-                                        ast = body;
+                                        ast = mcase[1];
                                         matched = true;
                                         break;
                                     }
                                 } else if (matchT == ":All") {
-                                    ast = body;
+                                    ast = mcase[1];
                                     matched = true;
                                     break;
                                 } 
@@ -437,44 +774,45 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                             case List:
                             case Vector: {
                                 auto seq = pattern->as_sequence()->items();
+                                GCRoot seqRoot(seq);
 
                                 // make sure seq has elements and specifically, to allow some destrucuring  
                                 // of elements
                                 if (seq.size() < 2) {
                                     auto e = RuntimeException();
-                                    e.errMessage = "'" + pattern->inspect() + "' fails as a DestructurePattern.\n";
+                                    e.errMessage = "'" + inspectOf(pattern) + "' fails as a DestructurePattern.\n";
                                     e.errMessage += "A DestructurePattern should contain a TypePattern and one or \nmore Literals or a bindable Symbols.";
                                     throw e;
                                 }
 
                                 auto kw = seq[0];
-                                auto matchT = kw->inspect();
+                                auto matchT = inspectOf(kw);
                                 // [(:Pair (a 1) a]
                                 if (matchT.substr(1, matchT.size()) == stype && stype == "Pair") { // handle pair destructure
                                     // make sure seq.size is exactly 3
                                     if (seq.size() != 3) {
                                         auto e = RuntimeException();
-                                        e.errMessage = "'" + pattern->inspect() + "' fails as a :Pair DestructurePattern.\n";
+                                        e.errMessage = "'" + inspectOf(pattern) + "' fails as a :Pair DestructurePattern.\n";
                                         e.errMessage += "A :Pair DestructurePattern should contain a 2 Literals or a bindable Symbols.";
                                         throw e;
                                     }
                                     auto l = seq[1];
-                                    auto r = seq[2];
                                     
                                     auto actualItems = matchArg->as_pair()->items();
+                                    GCRoot actualItemsRoot(actualItems);
                                     auto a_l = actualItems[0];
-                                    auto a_r = actualItems[1];
 
                                     auto bindEnv = new Environ(curEnv);
+                                    GCRoot bindEnvRoot(bindEnv);
                                     bool assigned = false;
                                     // bindable Symbol
-                                    if (Core::typeCheck(l->type(), Symbol)) {
-                                        bindEnv->set(l, a_l);
+                                    if (Core::typeCheck(typeOf(l), Symbol)) {
+                                        bindEnv->bind(l, a_l);
                                         assigned = true;
                                     } else {// second item is not bindable
                                         // we have to make sure a_r is same as l
                                         auto e_l = EVAL(l, curEnv);
-                                        MalType* a[2] { e_l, a_l };
+                                        MalType* a[2] { e_l, actualItems[0] };
                                         auto res = Core::isEqual(a, 2);
                                         
                                         // not a perfect match
@@ -483,13 +821,15 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                         }
                                     }
                                     
-                                    if (Core::typeCheck(r->type(), Symbol)) {
-                                        bindEnv->set(r, a_r);
+                                    auto r = seq[2];
+                                    auto a_r = actualItems[1];
+                                    if (Core::typeCheck(typeOf(r), Symbol)) {
+                                        bindEnv->bind(r, a_r);
                                         assigned = true;
                                     } else {// second item is not bindable
                                         // we have to make sure a_r is same as l
                                         auto e_r = EVAL(r, curEnv);
-                                        MalType* a[2] { e_r, a_r };
+                                        MalType* a[2] { e_r, actualItems[1] };
                                         auto res = Core::isEqual(a, 2);
                                         
                                         // not a perfect match
@@ -500,13 +840,13 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
 
                                     if (assigned)
                                         curEnv = bindEnv;
-                                    ast = body;
+                                    ast = mcase[1];
                                     matched = true;
                                     break;
-                                } else if (matchT.substr(1, matchT.size()) == stype && Core::typeChecksOneOf(matchArg->type(), List, Vector)) { // handle Sequence destructure
+                                } else if (matchT.substr(1, matchT.size()) == stype && Core::typeChecksOneOf(typeOf(matchArg), List, Vector)) { // handle Sequence destructure
                                     if (seq.size() < 2) { // needs to have at least 1 Symbol or Literal
                                         auto e = RuntimeException();
-                                        e.errMessage = "'" + pattern->inspect() + "' fails as a SequenceDestructurePattern.\n";
+                                        e.errMessage = "'" + inspectOf(pattern) + "' fails as a SequenceDestructurePattern.\n";
                                         e.errMessage += "A SequenceDestructurePattern should contain at least 1 Literal or a bindable Symbol.";
                                         throw e;
                                     }
@@ -519,26 +859,27 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                     bool variadic = false;
                                     int v_index = -1;
                                     vector < MalType * > params;
+                                    GCRoot paramsRoot(params);
                                     vector < string > insp;
                                     for (int j = 1; seq.size() > j; ++j) {
                                         auto item = seq[j];
-                                        auto found = find(insp.begin(), insp.end(), item->inspect());
+                                        auto found = find(insp.begin(), insp.end(), inspectOf(item));
 
                                         if (found != insp.end()) {
                                             auto runExcep = RuntimeException();
                                             runExcep.errMessage = "SequenceDestructurePattern parameters have to be unique (";
-                                            runExcep.errMessage += item->inspect() + " has multiple references).";
+                                            runExcep.errMessage += inspectOf(item) + " has multiple references).";
                                             throw runExcep;
                                         }
                                         // type check
-                                        if (variadic && !Core::typeCheck(item->type(), Symbol)) {
+                                        if (variadic && !Core::typeCheck(typeOf(item), Symbol)) {
                                             auto runExcep = RuntimeException();
                                             runExcep.errMessage = "SequenceDestructurePattern variadic parameter should be bindable Symbols.";
-                                            runExcep.errMessage += "'" + item->inspect() + "' is not.";
+                                            runExcep.errMessage += "'" + inspectOf(item) + "' is not.";
                                             throw runExcep;
                                         }
                                         // variadic check
-                                        if (item->inspect() == "&") {
+                                        if (inspectOf(item) == "&") {
                                             if (j + 2 != seq.size()) {
                                                 auto runExcep = RuntimeException();
                                                 runExcep.errMessage = "variadic SequenceDestructurePattern requires 1 variadic parameter at end of list.";
@@ -549,13 +890,14 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                             continue;
                                         }
                                         params.push_back(item);
-                                        insp.push_back(item->inspect());
+                                        insp.push_back(inspectOf(item));
                                     }
                                     
                                     // if it is variadic, check that actual list 
                                     // contains at least (n - 1) parameters where n is 
                                     // total number of paramters including the spread syntax
                                     auto items = matchArg->as_sequence()->items();
+                                    GCRoot itemsRoot(items);
                                     if (variadic) {
                                         if (items.size() < (params.size() - 1)) {
                                             auto runExcep = RuntimeException();
@@ -565,17 +907,19 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
 
                                         auto vargs = new MalVector;
                                         auto seqEnv = new Environ(curEnv);
+                                        GCRoot vargsRoot(vargs);
+                                        GCRoot seqEnvRoot(seqEnv);
                                         bool assigned = false;
                                         bool failedMatch = false;
                                         for (int j = 0; (params.size() - 1) > j; ++j) {
                                             auto p = params[j];
                                             auto act = items[j];
-                                            if (Core::typeCheck(p->type(), Symbol)) {
-                                                seqEnv->set(p, act);
+                                            if (Core::typeCheck(typeOf(p), Symbol)) {
+                                                seqEnv->bind(p, act);
                                                 assigned = true;
                                             } else {
                                                 auto e_p = EVAL(p, curEnv);
-                                                MalType* a[2] = { e_p, act};
+                                                MalType* a[2] = { e_p, items[j] };
                                                 auto res = Core::isEqual(a, 2);
 
                                                 // not a match
@@ -593,9 +937,9 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                             vargs->append(item);
                                         }
                                         
-                                        seqEnv->set(params[v_index-1], vargs);
+                                        seqEnv->bind(params[v_index-1], vargs);
                                         curEnv = seqEnv;
-                                        ast = body;
+                                        ast = mcase[1];
                                         matched = true;
                                         break;
                                     } else {
@@ -609,18 +953,19 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                         // if it is a symbol, bind it
                                         // else, check param is same as item in original list
                                         auto seqEnv = new Environ(curEnv);
+                                        GCRoot seqEnvRoot(seqEnv);
                                         bool assigned = false;
                                         bool failedMatch = false;
                                         for (int j = 0; items.size() > j; ++j) {
                                             auto p = params[j];
                                             auto act = items[j];
 
-                                            if (Core::typeCheck(p->type(), Symbol)) {
-                                                seqEnv->set(p, act);
+                                            if (Core::typeCheck(typeOf(p), Symbol)) {
+                                                seqEnv->bind(p, act);
                                                 assigned = true;
                                             } else {
                                                 auto e_p = EVAL(p, curEnv);
-                                                MalType* a[2] = { e_p, act};
+                                                MalType* a[2] = { e_p, items[j] };
                                                 auto res = Core::isEqual(a, 2);
 
                                                 // not a match
@@ -634,7 +979,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                                             continue;
                                         if (assigned)
                                             curEnv = seqEnv;
-                                        ast = body;
+                                        ast = mcase[1];
                                         matched = true;
                                         break;
                                     }                                    
@@ -656,8 +1001,8 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     if (!matched)
                         ast = NIL;
                     continue;
-                } else if (symstr == "do") { // do special form
-                    MalType * _AST;
+                } else if (firstItem == DO) { // do special form
+                    MalType * _AST = NIL;
                     for (int i = 1; rawlist.size() > i; ++i) {
                         _AST = rawlist[i];
                         if(i == rawlist.size() - 1) { // final expr in list
@@ -671,7 +1016,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     ast = _AST;
                     continue;
                     // return EVAL(_AST, curEnv);
-                } else if (symstr == "if") { // if statement
+                } else if (firstItem == IF) { // if statement
                     // (if condition trueBody falseBody?)
                     // condition that isn't nil or false is truthy
                     // falseBody? can be forgone for a nil default return:
@@ -682,26 +1027,24 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                         throw runExcep;
                     }
 
-                    auto cond = rawlist[1];
+                    auto e_cond = EVAL(rawlist[1], curEnv);
                     auto trueBody = rawlist[2];
                     MalType* falseBody = NIL;
                     if (rawlist.size() == 4) { falseBody = rawlist[3]; }
-                    auto e_cond = EVAL(cond, curEnv);
                     // nil is nontruthy
-                    if (e_cond->type() == Nil) {
+                    if (typeOf(e_cond) == Nil) {
                         // we implement tail call optimization by:
                         // setting ast to falseBody in this case
                         // and restart the loop
                         ast = falseBody;
                         continue;
                         // return EVAL(falseBody, curEnv);
-                    } else if (e_cond->type() == Boolean) {
-                        auto bool_cond = e_cond->as_boolean();
+                    } else if (typeOf(e_cond) == Boolean) {
                         // false condition
                         // so we do tail call optimization by:
                         // setting ast to falseBody in this case as well
                         // and restart the loop
-                        if (bool_cond->inspect() == "false") {
+                        if (!toBool(e_cond)) {
                             ast = falseBody;
                             continue;
                             // return EVAL(falseBody, curEnv);
@@ -715,7 +1058,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     // setting ast to trueBody and then restart loop
                     ast = trueBody;
                     continue;
-                } else if (symstr == "cond") {
+                } else if (firstItem == COND) {
                     // conds are a replacement for repetitive if expressions                    
                     // instead of:
                     // (if cond a (if condB b (if condC c)))
@@ -734,13 +1077,14 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     bool matched = false;
                     for (int i = 1; rawlist.size() > i; ++i) {
                         auto item = rawlist[i];
-                        if (!Core::typeChecksOneOf(item->type(), List, Vector)) {
+                        if (!Core::typeChecksOneOf(typeOf(item), List, Vector)) {
                             auto e = TypeException();
-                            e.errMessage = "'" + item->inspect() + "' is not a Sequence. Each cond case should be a Sequence.";
+                            e.errMessage = "'" + inspectOf(item) + "' is not a Sequence. Each cond case should be a Sequence.";
                             throw e;
                         }
                         // make sure cond has 2 items in it
                         auto seq = item->as_sequence()->items();
+                        GCRoot seqRoot(seq);
                         if (seq.size() != 2) {
                             auto e = RuntimeException();
                             e.errMessage = "Each cond case requires a condition and a body: [cond body].";
@@ -753,11 +1097,11 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                         // (for now)
 
                         auto cond = EVAL(seq[0], curEnv);
-                        if (cond->type() == Nil) {
+                        if (typeOf(cond) == Nil) {
                             continue;
-                        } else if (cond->type() == Boolean && cond == FALSE) {
+                        } else if (typeOf(cond) == Boolean && cond == FALSE) {
                             continue;
-                        } else if (cond->type() == Boolean && cond == TRUE) {
+                        } else if (typeOf(cond) == Boolean && cond == TRUE) {
                             // means we have a truthy value
                             // so set ast to its body and restart loop
                             ast = seq[1];
@@ -776,7 +1120,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                         ast = NIL;
                         continue;
                     }
-                } else if (symstr == "quote") {
+                } else if (firstItem == QUOTE) {
                     if (rawlist.size() != 2) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "quote form requires 1 argument.";
@@ -784,7 +1128,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     }
 
                     return rawlist[1];
-                } else if (symstr == "quasiquote") {
+                } else if (firstItem == QUASIQUOTE) {
                     if (rawlist.size() != 2) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "quote form requires 1 argument.";
@@ -795,7 +1139,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     auto res = Core::quasiquote(args, 1);
                     ast = res;
                     continue;
-                } else if (symstr == "quasiquoteexpand") {
+                } else if (firstItem == QUASIQUOTEEXPAND) {
                     if (rawlist.size() != 2) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "quote form requires 1 argument.";
@@ -805,9 +1149,11 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     MalType *args[1] { body };
                     auto res = Core::quasiquote(args, 1);
                     return res;
-                } else if (symstr == "fn*") { // function definition
+                } else if (firstItem == FN_STAR || firstItem == Resolver::RESOLVED_FN) { // function definition
+                    // the resolver adds the variables a flat closure captures as a 4th item
+                    bool isFlat = firstItem == Resolver::RESOLVED_FN && rawlist.size() == 4;
                     // make sure it has 3 parameters
-                    if (rawlist.size() != 3) {
+                    if (rawlist.size() != 3 && !isFlat) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "fn* form requires 2 arguments (bindings and a body).";
                         throw runExcep;
@@ -817,7 +1163,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     auto body = rawlist[2];
                     vector < MalType * > fn_params;
                     // make sure bindings are in a list or vector
-                    if (Core::typeChecksOneOf(bindings->type(), List, Vector)) {
+                    if (Core::typeChecksOneOf(typeOf(bindings), List, Vector)) {
                         fn_params = bindings->as_sequence()->items();
                     } else {
                         auto runExcep = RuntimeException();
@@ -826,7 +1172,6 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     }
 
                     bool variadic = false;
-                    int variadic_index = -1;
                     vector < MalType * > var_params;
                     // used to catch duplicated parameter
                     // e.g: (fn* [a b a] ... ) is erroneous
@@ -835,91 +1180,52 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     // and also look out for variadic binding, ensure it is done properly
                     for (int i = 0; fn_params.size() > i; ++i) {
                         auto item = fn_params[i];
-                        auto found = find(params_insp.begin(), params_insp.end(), item->inspect());
+                        auto found = find(params_insp.begin(), params_insp.end(), inspectOf(item));
                         // duplicate check
                         if (found != params_insp.end()) {
                             auto runExcep = RuntimeException();
                             runExcep.errMessage = "fn* parameters have to be unique (";
-                            runExcep.errMessage += item->inspect() + " has multiple references).";
+                            runExcep.errMessage += inspectOf(item) + " has multiple references).";
                             throw runExcep;
                         }
                         // type check
-                        if (!Core::typeCheck(item->type(), Symbol)) {
+                        if (!Core::typeCheck(typeOf(item), Symbol)) {
                             auto runExcep = RuntimeException();
                             runExcep.errMessage = "fn* parameters have to be bindable Symbols.";
-                            runExcep.errMessage += "'" + item->inspect() + "' is not.";
+                            runExcep.errMessage += "'" + inspectOf(item) + "' is not.";
                             throw runExcep;
                         }
                         // variadic check
-                        if (item->inspect() == "&") {
+                        if (inspectOf(item) == "&") {
                             if (i + 2 != fn_params.size()) {
                                 auto runExcep = RuntimeException();
                                 runExcep.errMessage = "variadic function requires 1 variadic parameter at end of parameters list.";
                                 throw runExcep;
                             }
                             variadic = true;
-                            variadic_index = i;
                             continue;
                         }
                         var_params.push_back(item);
-                        params_insp.push_back(item->inspect());
+                        params_insp.push_back(inspectOf(item));
                     }
 
-                    // why does this work????
-                    // my question in particular is:
-                    // why does capturing the environment in this way work
-                    // vs what i had before (which I now cannot recall)
-                    // currently, all the code in here has been moved out 
-                    // to the apply(call) stage
-                    // TODO: unused currently. why?
-                    //*********************************************************************
-                    auto closure = [&, variadic,  variadic_index, curEnv, var_params, body]
-                                    (MalType ** args, size_t argc) {
-                        auto fn_args = vector < MalType * >(args, args + argc);
-                        Environ* fnEnv = NULL;
-
-                        // handle arguments properly
-                        if (variadic) {
-                            // this allows u to pass nothing for the variadic
-                            // parameter
-                            // handling variadic functions
-                            // (def! a (fn* [a b & rest]) (list? rest))
-                            // (a 1 2) => then rest is ()
-                            // (a 1 2 3 4 5) => then rest is (3 4 5)
-                            if (fn_args.size() < (var_params.size() - 1)) {
-                                auto runExcep = RuntimeException();
-                                runExcep.errMessage = "variadic function requires at least " + to_string(var_params.size() - 1) + " arguments.";
-                                throw runExcep;
-                            }
-                            auto v_arg = new MalVector;
-                            vector < MalType * > var_args;
-                            for (int i = 0; var_params.size() - 1 > i; ++i) {
-                                var_args.push_back(fn_args[i]);
-                            }
-
-                            for (int i = var_params.size() - 1; fn_args.size() > i; ++i) {
-                                v_arg->append(fn_args[i]);
-                            }
-
-                            var_args.push_back(v_arg);
-                            fnEnv = new Environ(curEnv, var_params, var_args);
-                        } else {
-                            fnEnv = new Environ(curEnv, var_params, fn_args);
-                        }
-                        return EVAL(body, fnEnv);
-                    };
-                    //*********************************************************************
-                    // to implement tail call recursion, we need to:
-                    // we need to capture these attributes to allow the default apply (or call stage) be
-                    // able to tail call optimize its use later down the line:
-                    // body -> code to be later run
-                    // curEnv -> track the current environment
-                    // params -> the func's parameters
-                    // fn -> original object that got returned before tco
-                    auto actualFn = new MalFunc(closure, "<~lambda~>");
-                    // return new MalFunc(closure, "<~lambda~>");
-                    return new MalTCOptFunc(body, var_params, curEnv, actualFn, variadic);
-                } else if (symstr == "time") {
+                    // a flat closure comes with the variables it uses from the functions around it
+                    // (see resolver.hpp). it only keeps those alive, not the whole environment it was created in
+                    auto env = closureEnv(isFlat ? rawlist[3] : NULL, curEnv);
+                    // nested functions come with their body resolved by the one they're in.
+                    // either way, we compile it so calls don't go through the forms again
+                    if (firstItem == FN_STAR)
+                        body = Resolver::resolveBody(var_params, body, curEnv);
+                    // with --vm, it runs as bytecode instead if the VM can compile it (see vm.hpp)
+                    GCObject* code = NULL;
+                    if (VM::enabled && (isFlat || env == TOP_LEVEL))
+                        code = VM::compile(var_params, variadic, body, isFlat ? rawlist[3] : NULL);
+                    if (code == NULL)
+                        body = Compiler::compile(body);
+                    auto fn = new MalTCOptFunc(body, var_params, env, variadic);
+                    fn->setCode(code);
+                    return fn;
+                } else if (firstItem == TIME) {
                     if (rawlist.size() != 2) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "'time' requires 1 argument.";
@@ -929,9 +1235,9 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
 
                     // since we have to avoid executing time's function
                     // we need to make sure it is an executable form, which is a List
-                    if (!Core::typeCheck(item->type(), List)) {
+                    if (!Core::typeCheck(typeOf(item), List)) {
                         auto typeExcept = TypeException();
-                        typeExcept.errMessage = "'" + item->inspect() + "' is not a callable form (List).";
+                        typeExcept.errMessage = "'" + inspectOf(item) + "' is not a callable form (List).";
                         throw typeExcept;
                     }
 
@@ -943,7 +1249,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     auto dur = duration_cast<microseconds>(end - start).count();
                     string msg = "Elapsed time: " + to_string(dur) + " microseconds. (1 microsecond == 10^-6 of 1 sec).";
                     return new MalString(msg);
-                } else if (symstr == "macroexpand") {
+                } else if (firstItem == MACROEXPAND) {
                     if (rawlist.size() != 2) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "'macroexpand' requires 1 argument.";
@@ -952,7 +1258,7 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     // do macro expansion
                     MalType* expand[1] { rawlist[1] };
                     return Core::macroExpand(expand, 1);
-                } else if (symstr == "try*") {
+                } else if (firstItem == TRY) {
                     if (rawlist.size() != 3) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "'try*' form has 2 parts: (try* Code (catch* Symbol Code2)).";
@@ -967,22 +1273,23 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     auto catcher = rawlist[2];
 
                     // make sure catcher is a list of form:
-                    if (!Core::typeCheck(catcher->type(), List)) {
+                    if (!Core::typeCheck(typeOf(catcher), List)) {
                         auto typeExcept = TypeException();
-                        typeExcept.errMessage = "'" + catcher->inspect() + "' is not a 'catch*' List.";
+                        typeExcept.errMessage = "'" + inspectOf(catcher) + "' is not a 'catch*' List.";
                         throw typeExcept;
                     }
                     
                     // make sure first item in catcher is "catcher*" and
                     // its 3 items long
                     auto clist = catcher->as_list()->items();
+                    GCRoot clistRoot(clist);
                     if (clist.size() != 3) {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "'catch*' form has 2 parts: (catch* Symbol Code2).";
                         throw runExcep;
                     }
 
-                    if (clist[0]->inspect() != "catch*") {
+                    if (inspectOf(clist[0]) != "catch*") {
                         auto runExcep = RuntimeException();
                         runExcep.errMessage = "'try*' form has 2 parts: (try* Code (catch* Symbol Code2)).";
                         runExcep.errMessage += "\n'catch*' missing.";
@@ -990,12 +1297,11 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                     }
 
                     auto catchBindable = clist[1];
-                    auto catchCode = clist[2];
 
                     // make sure catchBindable is a Symbol
-                    if (!Core::typeCheck(catchBindable->type(), Symbol)) {
+                    if (!Core::typeCheck(typeOf(catchBindable), Symbol)) {
                         auto typeExcept = TypeException();
-                        typeExcept.errMessage = "'" + catchBindable->inspect() + "' is not a Symbol.";
+                        typeExcept.errMessage = "'" + inspectOf(catchBindable) + "' is not a Symbol.";
                         throw typeExcept;
                     }
 
@@ -1003,8 +1309,8 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
                         return EVAL(tryCode, curEnv);
                     } catch (MalType* caught) {
                         auto catchEnv = new Environ(curEnv);
-                        catchEnv->set(catchBindable, caught);
-                        ast = catchCode;
+                        catchEnv->bind(clist[1], caught);
+                        ast = clist[2];
                         curEnv = catchEnv;
                         continue;
                     }
@@ -1016,100 +1322,15 @@ MalType * EVAL(MalType * ast, Environ* curEnv) {
             // evaluate with eval_ast, and get new list
             // then call list[0] as a function with 
             // rest of list as it's argument
-            auto list = eval_ast(ast, curEnv)->as_list()->items();
-            auto callable = list[0];
-
-            // process args to find any spread syntax
-            auto args = list.data() + 1; // start after fn item
-            auto argc = list.size() - 1; // count args - fn item
-            vector < MalType * > arguments;
-            for (int i = 0; argc > i; ++i) {
-                auto item = args[i];
-                // we have found an expand in args, so we need to:
-                // make sure there is an argument after it, 
-                // and it is a sequence. then we take this sequence
-                // and add it to our arguments list, and track arguments count
-                // as well
-                // allows things like:
-                // (callable 1 2 3 ... a), where a is [1 2 3] becomes:
-                // (callable 1 2 3 1 2 3)
-                if (item->type() == Spreader) {
-                    if (i + 1 >= argc) {
-                        auto e = RuntimeException();
-                        e.errMessage = "'...' must be followed by another argument.";
-                        throw e;
-                    }
-                    auto a = args[++i];
-                    // cout << obj->inspect() << endl;
-                    if (!Core::typeChecksOneOf(a->type(), List, Vector)) {
-                        auto e = RuntimeException();
-                        e.errMessage = "'...' must be followed by Sequential type (List|Vector).";
-                        throw e;
-                    }
-                    auto items = vector < MalType * >();
-                    switch(a->type()) {
-                        case List: {
-                            items = a->as_list()->items();
-                            break;
-                        }
-                        default: {
-                        // default case is for Vectors 
-                            items = a->as_vector()->items();
-                            break;
-                        }
-                    }
-                    for (auto i : items) {
-                        arguments.push_back(i);
-                    }
-                } else {
-                    arguments.push_back(item);
-                }
-            }
-
-            // check if fn is built in or a user fn
-            if (Core::typeCheck(callable->type(), Func)) {
-                auto a_args = arguments.data();
-                auto fn = callable->as_func();
-                return fn->callable()(a_args, arguments.size());
-            } else if (Core::typeCheck(callable->type(), TCOptFunc)) {
-                auto tcofn = callable->as_tcoptfunc();
-                // TODO: this is currently unused
-                auto internalFn = tcofn->getMalFunc();
-                bool variadic = tcofn->isVariad();
-                auto envAtTime = tcofn->getEnviron();
-                auto params = tcofn->getParameters();
-                Environ* newFnEnv = NULL;
-                // Environ* newFnEnv = new Environ(envAtTime, params, arguments);
-                if (variadic) {
-                    if (arguments.size() < (params.size() - 1)) {
-                        auto runExcep = RuntimeException();
-                        runExcep.errMessage = "variadic function requires at least " + to_string(params.size() - 1) + " arguments.";
-                        throw runExcep;
-                    }
-                    auto variadList = new MalVector;
-                    vector < MalType* > variad_args;
-                    for (int i = 0; params.size() - 1 > i; ++i) {
-                        variad_args.push_back(arguments[i]);
-                    }
-
-                    for (int i = params.size() - 1; arguments.size() > i; ++i) {
-                        variadList->append(arguments[i]);
-                    } 
-
-                    variad_args.push_back(variadList);
-                    newFnEnv = new Environ(envAtTime, params, variad_args);
-                } else {
-                    newFnEnv = new Environ(envAtTime, params, arguments);
-                }
-                ast = tcofn->getBody();
-                curEnv = newFnEnv;
-                continue;
-            }
-
-            auto nonCallable = ast->as_list()->items()[0];
-            auto typeExcept = TypeException();
-            typeExcept.errMessage = "'" + nonCallable->inspect() + "' is not a Callable.";
-            throw typeExcept;
+            vector < MalType * > list;
+            // builtins like map and apply call back into EVAL, so the evaluated
+            // callable and its arguments have to survive a collection in there
+            GCRoot listRoot(list);
+            evalItems(ast, curEnv, list);
+            MalType* result = NULL;
+            if (apply(list, ast, ast, curEnv, result, profiled))
+                return result;
+            continue;
         }
     }
 }
@@ -1130,6 +1351,10 @@ void loop(bool runFile=false, string filepath="") {
     linenoise::LoadHistory(historyPath.c_str());
 
     string input = "";
+    // everything allocated from here on is garbage collected
+    GC::enable();
+    GC::addRoot(TOP_LEVEL);
+    GC::addRoot(CONSTANTS);
     CONSTANTS["nil"] = NIL;
     CONSTANTS["true"] = TRUE;
     CONSTANTS["false"] = FALSE;
@@ -1142,39 +1367,53 @@ void loop(bool runFile=false, string filepath="") {
     CONSTANTS["unquote"] = UNQUOTE;
     CONSTANTS["deref"] = DEREF;
     CONSTANTS["with-meta"] = WITHMETA;
-    
-    for (auto fn : Core::getCoreBuiltins()) {
-        auto name = new MalSymbol(fn.first);
-        auto builtin = new MalFunc(fn.second, fn.first);
-        TOP_LEVEL->set(name, builtin);
+
+    // an image (see image.hpp) already has the builtins and not, and whatever else it was saved with
+    if (!Image::restoreFrom.empty()) {
+        try {
+            Image::restore(Image::restoreFrom);
+        } catch (RuntimeException &r) {
+            cerr << r.what() << endl;
+            return;
+        } catch (system_error& e) {
+            cerr << e.what() << " (" << e.code() << ")." << endl;
+            return;
+        }
+    } else {
+        for (auto fn : Core::getCoreBuiltins()) {
+            auto name = MalSymbol::intern(fn.first);
+            auto builtin = new MalFunc(fn.second, fn.first);
+            TOP_LEVEL->set(name, builtin);
+        }
+        // create not, and execute it to bind into Env
+        // C++ Raw strings require parentheses as delimiters
+        // which is ironic, so delimter for this is:
+        // code(content)code, with content being actual string
+        auto notFn = R"code(
+                    (do
+                        (def! not
+                            (fn* [a]
+                                (if a
+                                    false
+                                    true)))
+                        (def! ! not)))code";
+        Rep(notFn);
+    }
+    TOP_LEVEL->set(MalSymbol::intern("*ARGV*"), ARGS);
+
+    // without a file, --save-image just saves what every run starts with
+    if (!runFile && !Image::saveTo.empty()) {
+        try {
+            Image::save(Image::saveTo);
+        } catch (RuntimeException &r) {
+            cerr << r.what() << endl;
+        }
+        return;
     }
-    TOP_LEVEL->set(new MalSymbol("*ARGV*"), ARGS);
-    // create not, and execute it to bind into Env
-    // C++ Raw strings require parentheses as delimiters
-    // which is ironic, so delimter for this is:
-    // code(content)code, with content being actual string
-    auto notFn = R"code(
-                (do
-                    (def! not
-                        (fn* [a]
-                            (if a
-                                false
-                                true)))
-                    (def! ! not)))code";
-    Rep(notFn);
-
-    // create load-file, which takes 1 variable (which is the file path),
-    // calls slurp with this path, wraps the return of slurp in a do expression
-    // and then passes that to read-string, and then passes it to eval.
-    auto loadFile = R"code(
-                        (def! load-file
-                            (fn* [path]
-                                (eval 
-                                    (read-string 
-                                        (str "(do "
-                                             (slurp path)
-                                             "\n:success)"))))))code";
-    Rep(loadFile);
+
+    // the REPL shows each line as soon as it's printed
+    if (!runFile)
+        Core::output.lineBuffered = true;
 
     bool hasRunOnce = false;
     while(true) {   
@@ -1189,12 +1428,17 @@ void loop(bool runFile=false, string filepath="") {
         }
 
         try {
-            cout << Rep(input) << endl;
+            Core::output.write(Rep(input) + "\n");
             if (runFile) {
+                // and with one, what there is once it has run
+                if (!Image::saveTo.empty())
+                    Image::save(Image::saveTo);
                 break;
             }
             linenoise::AddHistory(input.c_str());
         } catch (ReaderException &e) {
+            // so the error comes after what was printed before it
+            Core::output.flush();
             cerr << e.what() << endl;
             if (runFile) {
                 break;
@@ -1208,6 +1452,7 @@ void loop(bool runFile=false, string filepath="") {
             linenoise::AddHistory(input.c_str());
             continue;
         } catch (RuntimeException &r) {
+            Core::output.flush();
             cerr << r.what() << endl;
             if (runFile) {
                 break;
@@ -1215,6 +1460,7 @@ void loop(bool runFile=false, string filepath="") {
             linenoise::AddHistory(input.c_str());
             continue;
         } catch (TypeException &t) {
+            Core::output.flush();
             cerr << t.what() << endl;
             if (runFile) {
                 break;
@@ -1222,6 +1468,7 @@ void loop(bool runFile=false, string filepath="") {
             linenoise::AddHistory(input.c_str());
             continue;
         } catch (system_error& e) {
+            Core::output.flush();
             cerr << e.what() << " (" << e.code() << ")." << endl;
             if (runFile) {
                 break;
@@ -1229,7 +1476,8 @@ void loop(bool runFile=false, string filepath="") {
             linenoise::AddHistory(input.c_str());
             continue;
         } catch (MalType* t) {
-            cerr << t->inspect() << endl;
+            Core::output.flush();
+            cerr << inspectOf(t) << endl;
             if (runFile)
                 break;
             linenoise::AddHistory(input.c_str());
@@ -1245,14 +1493,46 @@ void loop(bool runFile=false, string filepath="") {
 }
 
 int main(int argc, char* argv[]) {
-    if (argc > 1) {
-        string filepath(argv[1]);
+    // --vm runs functions on the bytecode VM instead of the tree walker.
+    // --image starts from an image instead of from scratch, --save-image writes one (see image.hpp).
+    // what a file prints goes out in big writes, or a line at a time with --line-buffered
+    // (or on a terminal).
+    // --profile reports how much time went into each function once it's done (see profile.hpp),
+    // --profile=<path> puts the collapsed stacks there instead of in profile.folded
+    Core::output.lineBuffered = isatty(STDOUT_FILENO);
+    int first = 1;
+    while (argc > first) {
+        string option = argv[first];
+        if (option == "--vm") {
+            VM::enabled = true;
+            ++first;
+        } else if (option == "--line-buffered") {
+            Core::output.lineBuffered = true;
+            ++first;
+        } else if (option == "--profile" || option.rfind("--profile=", 0) == 0) {
+            if (option != "--profile")
+                Profile::foldedPath = option.substr(strlen("--profile="));
+            Profile::startTiming();
+            ++first;
+        } else if ((option == "--image" || option == "--save-image") && argc > first + 1) {
+            (option == "--image" ? Image::restoreFrom : Image::saveTo) = argv[first + 1];
+            first += 2;
+        } else
+            break;
+    }
+    if (argc > first) {
+        string filepath(argv[first]);
         filepath = "\"" + filepath + "\"";
-        for (int i = 2; argc > i; ++i) {
+        for (int i = first + 1; argc > i; ++i) {
             string option = argv[i];
             ARGS->append(new MalString(option));
         }
         loop(true, filepath);
     } else
         loop();
+
+    if (Profile::timing) {
+        Core::output.flush();
+        Profile::report();
+    }
 }
\ No newline at end of file
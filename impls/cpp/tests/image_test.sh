@@ -0,0 +1,110 @@
+#!/bin/bash
+
+#
+# Usage: image_test.sh [command line to run mal]
+#
+# Checks that --save-image and --image (see image.hpp) bring back what a file
+# defined: closures, macros, collections, and values that were shared when the
+# image was written are still shared after it's restored, with or without --vm.
+#
+
+assert_equal() {
+  if [ "$1" = "$2" ] ; then
+    echo "OK: '$1'"
+  else
+    echo "FAIL: Expected '$1' but got '$2'"
+    echo
+    exit 1
+  fi
+}
+
+root="$(cd "$(dirname $0)" && pwd)"
+mal="${@:-$root/../step9_try}"
+
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+# stdout and stderr, without the :success of loading the file
+run() {
+  $mal "$@" 2>&1 | tr -d '\r' | grep -v '^:success$'
+}
+
+cat > lib.mal <<'EOF'
+;; closures over one atom, and one over a let* binding
+(def! make-counter (fn* [start]
+  (let* [n (atom start)]
+    [(fn* [] (swap! n (fn* [x] (+ x 1)))) (fn* [] @n)])))
+(def! counter (make-counter 10))
+(def! bump (nth counter 0))
+(def! peek (nth counter 1))
+(def! add-to (fn* [k] (fn* [x] (+ x k))))
+(def! add5 (add-to 5))
+
+;; a macro, and a function that expands it
+(defmacro! unless (fn* [c a b] `(if ~c ~b ~a)))
+(def! mode (atom true))
+(def! pick (fn* [] (unless @mode :no :yes)))
+
+;; one atom reached three ways
+(def! shared (atom 0))
+(def! holder {:a shared :b [shared (list shared)]})
+
+;; collections past the inline map size and the first trie level of a vector
+(def! fill (fn* [v n] (if (< (count v) n) (fill (conj v (count v)) n) v)))
+(def! big-vec (fill [] 2000))
+(def! big-map (hash-map :k0 0 :k1 1 :k2 2 :k3 3 :k4 4 :k5 5 :k6 6 :k7 7 :k8 8 :k9 9 [1 2] :pair))
+(def! big-int 9223372036854775807)
+EOF
+
+run --save-image lib.img lib.mal > /dev/null
+assert_equal "true" "$([ -s lib.img ] && echo true)"
+
+cat > use.mal <<'EOF'
+(println (bump) (bump) (peek))
+(println (add5 1) ((add-to 2) 1))
+(println (pick) (do (reset! mode false) (pick)) (unless false :a :b))
+(swap! (get holder :a) (fn* [x] (+ x 1)))
+(println @shared @(nth (get holder :b) 0) @(first (nth (get holder :b) 1)))
+(reset! shared 7)
+(println @(get holder :a))
+(println (count big-vec) (nth big-vec 0) (nth big-vec 1056) (nth big-vec 1999))
+(println (get big-map :k9) (get big-map (list 1 2)) (count (keys big-map)))
+(println big-int (+ big-int -1))
+EOF
+expected='11 12 12
+6 3
+:yes :no :a
+1 1 1
+7
+2000 0 1056 1999
+9 :pair 11
+9223372036854775807 9223372036854775806'
+assert_equal "$expected" "$(run --image lib.img use.mal)"
+assert_equal "$expected" "$(run --vm --image lib.img use.mal)"
+# the same as running the file first
+cat lib.mal use.mal > both.mal
+assert_equal "$expected" "$(run both.mal)"
+
+# an image saved from a restored one, after changing it, keeps the change
+cat > change.mal <<'EOF'
+(bump)
+(reset! shared 3)
+EOF
+run --image lib.img --save-image lib2.img change.mal > /dev/null
+cat > after.mal <<'EOF'
+(println (peek) @(nth (get holder :b) 0))
+(swap! shared (fn* [x] (* x 2)))
+(println @(get holder :a))
+EOF
+assert_equal $'11 3\n6' "$(run --image lib2.img after.mal)"
+assert_equal $'11 3\n6' "$(run --vm --image lib2.img after.mal)"
+# and the first image is as it was
+assert_equal $'10 0\n0' "$(run --image lib.img after.mal)"
+
+# an image that isn't one is refused
+echo "not an image" > bad.img
+assert_equal "true" "$(run --image bad.img use.mal | grep -qi image && echo true)"
+
+echo "Passed all image tests"
+echo
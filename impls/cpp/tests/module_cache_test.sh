@@ -0,0 +1,91 @@
+#!/bin/bash
+
+#
+# Usage: module_cache_test.sh [command line to run mal]
+#
+# Checks that load-file's caches (see modules.hpp) are only written when asked for,
+# and never replay an expansion made with a macro that isn't the one defined now.
+#
+
+assert_equal() {
+  if [ "$1" = "$2" ] ; then
+    echo "OK: '$1'"
+  else
+    echo "FAIL: Expected '$1' but got '$2'"
+    echo
+    exit 1
+  fi
+}
+
+root="$(cd "$(dirname $0)" && pwd)"
+mal="${@:-$root/../step9_try}"
+
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+# without the :success of loading the file it was given
+run() {
+  MAL_CACHE_DIR="$dir/cache" $mal "$@" | tr -d '\r' | grep -v '^:success$'
+}
+
+# the macro says when it runs, so a replayed expansion shows up as a missing "expanding"
+echo '(defmacro! m (fn* () (do (println "expanding") (list (quote println) "lib1"))))' > lib1.mal
+echo '(defmacro! m (fn* () (do (println "expanding") (list (quote println) "lib2"))))' > lib2.mal
+echo '(m)' > use.mal
+echo '(load-file "lib1.mal") (load-file "use.mal")' > with_lib1.mal
+echo '(load-file "lib2.mal") (load-file "use.mal")' > with_lib2.mal
+
+# off unless MAL_CACHE_DIR is set
+out="$( HOME="$dir" XDG_CACHE_HOME="$dir/xdg" $mal with_lib1.mal | tr -d '\r' | grep -v '^:success$' )"
+assert_equal "$(printf 'expanding\nlib1')" "$out"
+assert_equal "" "$(ls -A "$dir/xdg" "$dir/.cache" 2>/dev/null)"
+
+out="$( run with_lib1.mal )"
+assert_equal "$(printf 'expanding\nlib1')" "$out"
+[ -n "$(ls -A "$dir/cache")" ] || { echo "FAIL: no cache written"; exit 1; }
+
+# the same macro: the expansion is replayed
+out="$( run with_lib1.mal )"
+assert_equal "lib1" "$out"
+
+# a redefined macro: expanded again, with the new one
+out="$( run with_lib2.mal )"
+assert_equal "$(printf 'expanding\nlib2')" "$out"
+
+# a macro defined outside of any file, in an image: the same one replays, another doesn't
+run --save-image lib1.img lib1.mal > /dev/null
+run --save-image lib2.img lib2.mal > /dev/null
+out="$( run --image lib2.img use.mal )"
+assert_equal "lib2" "$out"
+out="$( run --image lib1.img use.mal )"
+assert_equal "$(printf 'expanding\nlib1')" "$out"
+
+# a macro that isn't defined any more: the call fails the way it would without a cache
+out="$( run use.mal 2>&1 )"
+case "$out" in
+  *"'m' not found"*) echo "OK: 'm' not found" ;;
+  *) echo "FAIL: Expected 'm' not to be found but got '$out'"; exit 1 ;;
+esac
+
+# macros get their arguments evaluated, so a call with arguments that aren't literals
+# isn't replayed: they run, and come out the way they do now, every time
+echo '(defmacro! my-when (fn* [c b] `(if ~c ~b nil)))' > when.mal
+echo '(load-file "when.mal") (my-when true (println "side")) (println (my-when (= (count *ARGV*) 2) "two args"))' > args.mal
+out="$( run args.mal )"
+assert_equal "$(printf 'side\nnil')" "$out"
+out="$( run args.mal )"
+assert_equal "$(printf 'side\nnil')" "$out"
+out="$( run args.mal a b )"
+assert_equal "$(printf 'side\ntwo args')" "$out"
+
+# a changed source (the same size, so only its contents tell)
+echo '(println "one")' > changed.mal
+out="$( run changed.mal )"
+assert_equal "one" "$out"
+echo '(println "two")' > changed.mal
+out="$( run changed.mal )"
+assert_equal "two" "$out"
+
+echo 'Passed all module cache tests'
+echo
@@ -0,0 +1,92 @@
+#!/bin/bash
+
+#
+# Usage: output_test.sh [command line to run mal]
+#
+# Checks that what prn and println buffer (see Core::Output) gets out: before an
+# error on stderr and in order with it, on (flush), and a line at a time with
+# --line-buffered, when stdout is a pipe.
+#
+
+assert_equal() {
+  if [ "$1" = "$2" ] ; then
+    echo "OK: '$1'"
+  else
+    echo "FAIL: Expected '$1' but got '$2'"
+    echo
+    exit 1
+  fi
+}
+
+root="$(cd "$(dirname $0)" && pwd)"
+mal="${@:-$root/../step9_try}"
+
+dir="$(mktemp -d)"
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir"
+
+# stdout and stderr into one pipe, without the :success of loading the file
+run() {
+  $mal "$@" 2>&1 | tr -d '\r' | grep -v '^:success$'
+}
+
+# what comes out before an error is all there, ahead of it
+cat > error.mal <<'EOF'
+(println "one")
+(prn "two")
+(throw "three")
+(println "four")
+EOF
+assert_equal $'one\n"two"\n"three"' "$(run error.mal)"
+
+cat > type-error.mal <<'EOF'
+(println "one")
+(+ 1 "two")
+EOF
+assert_equal $'one\n\'+\' not defined for operands of varying types.' "$(run type-error.mal)"
+
+# what is left in the buffer at the end goes out too
+cat > end.mal <<'EOF'
+(def! loop (fn* [i] (if (< i 3000) (do (println "line" i) (loop (+ i 1))) nil)))
+(loop 0)
+EOF
+assert_equal "3000 line 2999" "$(run end.mal | grep -c line) $(run end.mal | tail -1)"
+
+# prints "waiting", then doesn't go on until something is written to the fifo
+mkfifo go
+cat > wait.mal <<'EOF'
+(println "waiting")
+(if (= (first *ARGV*) "flush") (flush))
+(slurp "go")
+(println "done")
+EOF
+
+# the first line mal prints while it waits (giving up after $1 seconds), then lets it finish
+first_line() {
+  timeout=$1
+  shift
+  mkfifo out
+  $mal "$@" > out &
+  exec 3< out
+  line=""
+  read -t $timeout -u 3 line
+  echo > go
+  cat <&3 > /dev/null
+  exec 3<&-
+  wait
+  rm out
+  echo "$line"
+}
+
+assert_equal "waiting" "$(first_line 5 wait.mal flush)"
+assert_equal "waiting" "$(first_line 5 --line-buffered wait.mal)"
+# without either, nothing gets out until the end
+assert_equal "" "$(first_line 1 wait.mal)"
+
+cat > flush-args.mal <<'EOF'
+(flush 1)
+EOF
+assert_equal "'flush' requires no arguments." "$(run flush-args.mal)"
+
+echo "Passed all output tests"
+echo
@@ -0,0 +1,107 @@
+#!/bin/bash
+
+#
+# Usage: profile_test.sh [command line to run mal]
+#
+# Checks the sampling profiler (see profile.hpp): (profile-start) and (profile-stop)
+# write the stacks they saw in collapsed form, and complain when they're called
+# when the profiler is already running, or isn't.
+#
+
+assert_equal() {
+  if [ "$1" = "$2" ] ; then
+    echo "OK: '$1'"
+  else
+    echo "FAIL: Expected '$1' but got '$2'"
+    echo
+    exit 1
+  fi
+}
+
+root="$(cd "$(dirname $0)" && pwd)"
+mal="${@:-$root/../step9_try}"
+
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+# stdout and stderr, without the :success of loading the file
+run() {
+  $mal "$@" 2>&1 | tr -d '\r' | grep -v '^:success$'
+}
+
+cat > lib.mal <<'EOF'
+(def! busy (fn* [n acc] (if (> n 0) (busy (- n 1) (+ acc n)) acc)))
+(def! work (fn* [] (busy 300000 0)))
+EOF
+
+# sampling every 200us of CPU time, a few runs of work get a sample or more
+cat > sample.mal <<'EOF'
+(load-file "lib.mal")
+(profile-start 200)
+(work) (work) (work)
+(println (> (profile-stop "out.folded") 0))
+EOF
+assert_equal "true" "$(run sample.mal)"
+assert_equal "0" "$(grep -vc '^<top-level>' out.folded)"
+assert_equal "0" "$(grep -vc ' [0-9][0-9]*$' out.folded)"
+# (work tail calls busy, which takes its place)
+assert_equal "true" "$(grep -q '^<top-level>;busy [0-9]' out.folded && echo true)"
+
+# the samples add up to what profile-stop returned
+cat > count.mal <<'EOF'
+(load-file "lib.mal")
+(profile-start 200)
+(work) (work)
+(println (profile-stop "count.folded"))
+EOF
+taken="$(run count.mal)"
+assert_equal "$taken" "$(awk '{ sum += $NF } END { print sum }' count.folded)"
+
+# and it can be started again once stopped
+cat > again.mal <<'EOF'
+(load-file "lib.mal")
+(profile-start)
+(work)
+(profile-stop "first.folded")
+(profile-start)
+(work)
+(println (>= (profile-stop "second.folded") 0))
+EOF
+run again.mal > /dev/null
+assert_equal "true" "$([ -f first.folded ] && [ -f second.folded ] && echo true)"
+
+cat > stop-twice.mal <<'EOF'
+(profile-start)
+(profile-stop "once.folded")
+(println "stopped")
+(profile-stop "twice.folded")
+(println "stopped again")
+EOF
+assert_equal $'stopped\nthe profiler isn\'t running.' "$(run stop-twice.mal)"
+assert_equal "false" "$([ -f twice.folded ] && echo true || echo false)"
+
+cat > stop.mal <<'EOF'
+(profile-stop "never.folded")
+EOF
+assert_equal "the profiler isn't running." "$(run stop.mal)"
+
+cat > start-twice.mal <<'EOF'
+(profile-start)
+(profile-start)
+EOF
+assert_equal "the profiler is already running." "$(run start-twice.mal)"
+
+# --profile is already running one
+cat > start.mal <<'EOF'
+(profile-start)
+EOF
+assert_equal "the profiler is already running." "$(run --profile=timed.folded start.mal | grep profiler)"
+
+cat > bad-interval.mal <<'EOF'
+(profile-start 0)
+EOF
+assert_equal "'profile-start' takes an optional sampling interval (positive Int, in microseconds)." "$(run bad-interval.mal)"
+
+echo "Passed all profiler tests"
+echo
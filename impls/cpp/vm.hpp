@@ -0,0 +1,877 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "mal_types.hpp"
+#include "env.hpp"
+#include "core.hpp"
+#include "resolver.hpp"
+#include "profile.hpp"
+
+using namespace std;
+
+// defined in main, shared with the tree walker
+void spreadInto(MalType ** args, size_t argc, vector < MalType * >& arguments);
+Environ* callEnv(MalTCOptFunc* tcofn, vector < MalType * >& arguments);
+
+// a register machine that runs function bodies (the ones the resolver has been through) as bytecode.
+// it is the other engine you get with --vm, EVAL (the tree walker) is still what runs the top level.
+// a function gets compiled once, when it is created. every variable the resolver found a slot for
+// gets a register in the function's frame, so:
+// (fn* [n] (if (< n 2) n (+ n 1)))
+// becomes something like:
+//  0: GETGLOBAL  r2 <           ; the callee and its arguments sit in consecutive registers
+//  1: MOVE       r3 r0
+//  2: LOADK      r4 2
+//  3: CALL       r2 2           ; builtins get a pointer straight into the registers
+//  4: JMPIFNOT   r2 +2
+//  5: RETURN     r0
+//  ...
+// the frames live on one stack that the VM owns, so calls between compiled functions don't create
+// an Environ, don't copy their arguments around and don't nest on the C++ stack (only builtins
+// and functions the VM couldn't compile do, and they go back to EVAL).
+// bodies with forms the VM doesn't do (def!, try*, if-let, match, quasiquote, macro calls...)
+// or a variable it can't find a register for stay with the tree walker, as a whole
+namespace VM {
+    // set by --vm
+    bool enabled = false;
+
+    enum Op : uint8_t {
+        MOVE,       // R[a] = R[b]
+        LOADK,      // R[a] = K[bx]
+        GETGLOBAL,  // R[a] = the global named K[bx]
+        GETCAPTURE, // R[a] = captured variable b
+        NEG,        // R[a] = -R[b]
+        JMP,        // skip bx instructions
+        JMPIFNOT,   // skip bx instructions if R[a] is nil or false
+        TESTCOND,   // like JMPIFNOT, but anything other than true, false or nil is an error
+        CALL,       // R[a] = R[a](R[a+1], ..., R[a+b])
+        TAILCALL,   // return R[a](R[a+1], ..., R[a+b]), reusing the frame
+        RETURN,     // return R[a]
+        CLOSURE,    // R[a] = a function made from proto bx
+        VECTOR,     // R[a] = [R[a+1] ... R[a+b]]
+        HASHMAP,    // R[a] = K[bx] (a hashmap form), with its values from R[a+1]...
+        GETKEY,     // R[a] = (keys[c].key R[a+1] ... R[a+b]), a keyword looking itself up in a map
+        TESTMACRO,  // if R[a] is a macro, skip bx instructions to the call and run its form instead
+    };
+
+    // b and c together make up bx, for constants and jump offsets
+    struct Instr {
+        uint8_t op;
+        uint8_t a;
+        uint8_t b;
+        uint8_t c;
+
+        size_t bx() const {
+            return b | (c << 8);
+        }
+    };
+
+    const size_t MAX_REGISTERS = 255;
+    const size_t MAX_BX = 0xffff;
+
+    // what a call needs when it can't just go ahead: the form, to say what isn't a Callable,
+    // and the variables in scope, for a macro that got defined after the function was compiled.
+    // TESTMACRO finds that one before any argument is evaluated, and it gets expanded and run
+    // by EVAL, like the tree walker would
+    struct CallSite {
+        size_t pc;
+        MalType* form;
+        vector < pair < MalSymbol *, uint8_t > > visible;
+    };
+
+    // a (:k m) call: the keyword, and where it found itself in the last map (see Core::keywordGet)
+    struct KeySite {
+        MalType* key;
+        size_t slot;
+    };
+
+    // a compiled function body
+    class Proto : public GCObject {
+    public:
+        // where a closure gets a variable it captures from, when it gets created:
+        // a register of the function creating it, or one of that function's own captures
+        struct Capture {
+            bool fromCapture;
+            uint8_t index;
+            MalSymbol* symbol;
+        };
+
+        GCObject* relocate() {
+            return new Proto(std::move(*this));
+        }
+
+        void trace() {
+            for (auto& constant : constants)
+                GC::visit(constant);
+            for (auto& proto : protos)
+                GC::visit(proto);
+            for (auto& param : params)
+                GC::visit(param);
+            for (auto& site : calls)
+                GC::visit(site.form);
+            GC::visit(body);
+        }
+
+        vector < Instr > code;
+        vector < MalType * > constants;
+        vector < Proto * > protos;
+        vector < Capture > captures;
+        // what the MalTCOptFunc made from this gets, the resolved body isn't run by anyone
+        vector < MalType * > params;
+        MalType* body { NULL };
+        bool variadic { false };
+        size_t nregs { 0 };
+        // every call, by instruction index
+        vector < CallSite > calls;
+        // for GETKEY. keywords are interned, so these never move and need no tracing
+        vector < KeySite > keys;
+    };
+
+    // thrown while compiling a function the VM can't run
+    struct Unsupported { };
+
+    struct FuncState {
+        Proto* proto;
+        // a frame per scope (the parameters, then every let* inside), with the
+        // (symbol, register) of each variable in the slot the resolver gave it
+        vector < vector < pair < MalSymbol *, uint8_t > > > scopes;
+        // for a flat closure, the variables it captured, by slot
+        vector < MalSymbol * > captured;
+        bool flat;
+        size_t freeReg { 0 };
+    };
+
+    uint8_t reserve(FuncState& fs) {
+        if (fs.freeReg >= MAX_REGISTERS)
+            throw Unsupported();
+        auto reg = fs.freeReg++;
+        fs.proto->nregs = max(fs.proto->nregs, fs.freeReg);
+        return reg;
+    }
+
+    size_t emit(FuncState& fs, Op op, size_t a, size_t b=0, size_t c=0) {
+        fs.proto->code.push_back(Instr { op, (uint8_t) a, (uint8_t) b, (uint8_t) c });
+        return fs.proto->code.size() - 1;
+    }
+
+    size_t emitBx(FuncState& fs, Op op, size_t a, size_t bx) {
+        if (bx > MAX_BX)
+            throw Unsupported();
+        return emit(fs, op, a, bx & 0xff, bx >> 8);
+    }
+
+    // jumps only ever go forward, to the end of what is being compiled
+    void patch(FuncState& fs, size_t jump) {
+        auto& instr = fs.proto->code[jump];
+        auto offset = fs.proto->code.size() - (jump + 1);
+        if (offset > MAX_BX)
+            throw Unsupported();
+        instr.b = offset & 0xff;
+        instr.c = offset >> 8;
+    }
+
+    size_t constant(FuncState& fs, MalType* value) {
+        auto& constants = fs.proto->constants;
+        auto found = find(constants.begin(), constants.end(), value);
+        if (found != constants.end())
+            return found - constants.begin();
+        GC::writeBarrier(fs.proto, value);
+        constants.push_back(value);
+        return constants.size() - 1;
+    }
+
+    void expr(FuncState& fs, MalType* form, uint8_t dest, bool tail);
+
+    // where a variable the resolver found is: a register, a capture, or a global.
+    // returns false for a capture, with its slot in index
+    bool locate(FuncState& fs, MalLocal* local, size_t& index) {
+        auto depth = local->depth();
+        auto slot = local->slot();
+        if (depth < fs.scopes.size()) {
+            auto& scope = fs.scopes[fs.scopes.size() - 1 - depth];
+            if (slot >= scope.size())
+                throw Unsupported();
+            index = scope[slot].second;
+            return true;
+        }
+        if (!fs.flat || depth != fs.scopes.size() || slot > MAX_REGISTERS)
+            throw Unsupported();
+        index = slot;
+        return false;
+    }
+
+    void loadLocal(FuncState& fs, MalLocal* local, uint8_t dest) {
+        if (local->slot() == MalLocal::GLOBAL) {
+            emitBx(fs, GETGLOBAL, dest, constant(fs, local->symbol()));
+            return;
+        }
+        size_t index;
+        if (locate(fs, local, index))
+            emit(fs, MOVE, dest, index);
+        else
+            emit(fs, GETCAPTURE, dest, index);
+    }
+
+    // the resolver only leaves negated variables (-x) and globals as symbols
+    void loadSymbol(FuncState& fs, MalSymbol* sym, uint8_t dest) {
+        auto& name = sym->str();
+        if (name[0] != '-' || name.size() == 1) {
+            emitBx(fs, GETGLOBAL, dest, constant(fs, sym));
+            return;
+        }
+
+        auto actual = MalSymbol::intern(name.substr(1));
+        for (auto scope = fs.scopes.rbegin(); scope != fs.scopes.rend(); ++scope) {
+            for (auto& var : *scope) {
+                if (var.first == actual) {
+                    emit(fs, NEG, dest, var.second);
+                    return;
+                }
+            }
+        }
+        auto captured = find(fs.captured.begin(), fs.captured.end(), actual);
+        if (captured != fs.captured.end())
+            emit(fs, GETCAPTURE, dest, captured - fs.captured.begin());
+        else
+            emitBx(fs, GETGLOBAL, dest, constant(fs, actual));
+        emit(fs, NEG, dest, dest);
+    }
+
+    // the registers a..a+n get the items, R[a] is left for the result
+    void exprs(FuncState& fs, vector < MalType * >& items, size_t from) {
+        for (size_t i = from; items.size() > i; ++i)
+            expr(fs, items[i], reserve(fs), false);
+    }
+
+    void compileLet(FuncState& fs, vector < MalType * >& items, uint8_t dest, bool tail) {
+        if (items.size() != 3 || !Core::typeChecksOneOf(typeOf(items[1]), List, Vector))
+            throw Unsupported();
+        auto bindings = items[1]->as_sequence()->items();
+        if (bindings.size() % 2 != 0)
+            throw Unsupported();
+
+        auto saved = fs.freeReg;
+        fs.scopes.push_back({});
+        for (size_t i = 0; bindings.size() > i; i += 2) {
+            if (typeOf(bindings[i]) != Symbol)
+                throw Unsupported();
+            auto key = bindings[i]->as_symbol();
+            auto& scope = fs.scopes.back();
+            auto existing = find_if(scope.begin(), scope.end(), [key](auto& var) { return var.first == key; });
+            if (existing != scope.end()) {
+                // binding the same name again reuses its register
+                auto reg = existing->second;
+                auto temp = reserve(fs);
+                expr(fs, bindings[i+1], temp, false);
+                emit(fs, MOVE, reg, temp);
+                fs.freeReg = temp;
+                continue;
+            }
+            // the value can't see the name it is bound to yet
+            auto reg = reserve(fs);
+            expr(fs, bindings[i+1], reg, false);
+            fs.scopes.back().push_back({ key, reg });
+        }
+        expr(fs, items[2], dest, tail);
+        fs.scopes.pop_back();
+        fs.freeReg = saved;
+    }
+
+    void compileCond(FuncState& fs, vector < MalType * >& items, uint8_t dest, bool tail) {
+        if (items.size() < 2)
+            throw Unsupported();
+
+        vector < size_t > exits;
+        for (size_t i = 1; items.size() > i; ++i) {
+            if (!Core::typeChecksOneOf(typeOf(items[i]), List, Vector))
+                throw Unsupported();
+            auto seq = items[i]->as_sequence()->items();
+            if (seq.size() != 2)
+                throw Unsupported();
+            auto test = reserve(fs);
+            expr(fs, seq[0], test, false);
+            auto next = emit(fs, TESTCOND, test);
+            fs.freeReg = test;
+            expr(fs, seq[1], dest, tail);
+            if (!tail)
+                exits.push_back(emit(fs, JMP, 0));
+            patch(fs, next);
+        }
+        expr(fs, MAL_NIL, dest, tail);
+        for (auto exit : exits)
+            patch(fs, exit);
+    }
+
+    Proto* compileFn(FuncState* parent, vector < MalType * >& params, bool variadic, MalType* body, MalType* captures);
+
+    // a closure nested in the function, which becomes a proto of its own
+    void compileClosure(FuncState& fs, vector < MalType * >& items, uint8_t dest) {
+        // a closure that isn't flat needs the frames around it, which the VM doesn't make
+        if (items[0] != Resolver::RESOLVED_FN || items.size() != 4
+            || !Core::typeChecksOneOf(typeOf(items[1]), List, Vector))
+            throw Unsupported();
+
+        auto fn_params = items[1]->as_sequence()->items();
+        vector < MalType * > params;
+        bool variadic = false;
+        for (size_t i = 0; fn_params.size() > i; ++i) {
+            auto item = fn_params[i];
+            if (typeOf(item) != Symbol)
+                throw Unsupported();
+            if (inspectOf(item) == "&") {
+                if (i + 2 != fn_params.size())
+                    throw Unsupported();
+                variadic = true;
+                continue;
+            }
+            if (find(params.begin(), params.end(), item) != params.end())
+                throw Unsupported();
+            params.push_back(item);
+        }
+
+        auto proto = compileFn(&fs, params, variadic, items[2], items[3]);
+        GC::writeBarrier(fs.proto, proto);
+        fs.proto->protos.push_back(proto);
+        emitBx(fs, CLOSURE, dest, fs.proto->protos.size() - 1);
+    }
+
+    void compileList(FuncState& fs, MalList* form, uint8_t dest, bool tail) {
+        auto items = form->items();
+        if (items.empty()) {
+            emitBx(fs, LOADK, dest, constant(fs, form));
+            if (tail)
+                emit(fs, RETURN, dest);
+            return;
+        }
+
+        auto head = items[0];
+        if (typeOf(head) == Symbol) {
+            if (head == QUOTE) {
+                if (items.size() != 2)
+                    throw Unsupported();
+                emitBx(fs, LOADK, dest, constant(fs, items[1]));
+                if (tail)
+                    emit(fs, RETURN, dest);
+                return;
+            } else if (head == IF) {
+                if (items.size() < 3 || items.size() > 4)
+                    throw Unsupported();
+                auto test = reserve(fs);
+                expr(fs, items[1], test, false);
+                auto otherwise = emit(fs, JMPIFNOT, test);
+                fs.freeReg = test;
+                expr(fs, items[2], dest, tail);
+                size_t exit = 0;
+                if (!tail)
+                    exit = emit(fs, JMP, 0);
+                patch(fs, otherwise);
+                expr(fs, items.size() == 4 ? items[3] : MAL_NIL, dest, tail);
+                if (!tail)
+                    patch(fs, exit);
+                return;
+            } else if (head == DO) {
+                if (items.size() < 2)
+                    throw Unsupported();
+                auto temp = reserve(fs);
+                for (size_t i = 1; items.size() - 1 > i; ++i)
+                    expr(fs, items[i], temp, false);
+                fs.freeReg = temp;
+                expr(fs, items.back(), dest, tail);
+                return;
+            } else if (head == LET) {
+                compileLet(fs, items, dest, tail);
+                return;
+            } else if (head == COND) {
+                compileCond(fs, items, dest, tail);
+                return;
+            } else if (head == FN_STAR || head == Resolver::RESOLVED_FN) {
+                compileClosure(fs, items, dest);
+                if (tail)
+                    emit(fs, RETURN, dest);
+                return;
+            } else if (head == DEF || head == DEFMACRO || head == IF_LET || head == MATCH
+                       || head == QUASIQUOTE || head == QUASIQUOTEEXPAND || head == TIME
+                       || head == MACROEXPAND || head == TRY) {
+                throw Unsupported();
+            }
+        }
+
+        MalType* call_args[1] { form };
+        if (Core::isMacroCall(call_args, 1) == CONSTANTS["true"])
+            throw Unsupported();
+
+        if (typeOf(head) == Keyword && (items.size() == 2 || items.size() == 3)
+            && fs.proto->keys.size() <= 0xff
+            && none_of(items.begin(), items.end(), [](MalType* item) { return typeOf(item) == Spreader; })) {
+            auto base = reserve(fs);
+            exprs(fs, items, 1);
+            emit(fs, GETKEY, base, items.size() - 1, fs.proto->keys.size());
+            fs.proto->keys.push_back(KeySite { head, 0 });
+            if (dest != base)
+                emit(fs, MOVE, dest, base);
+            fs.freeReg = base;
+            if (tail)
+                emit(fs, RETURN, dest);
+            return;
+        }
+
+        auto base = reserve(fs);
+        expr(fs, head, base, false);
+        auto macro = emit(fs, TESTMACRO, base);
+        exprs(fs, items, 1);
+        patch(fs, macro);
+        CallSite site { fs.proto->code.size(), form, {} };
+        for (auto& scope : fs.scopes)
+            site.visible.insert(site.visible.end(), scope.begin(), scope.end());
+        GC::writeBarrier(fs.proto, form);
+        fs.proto->calls.push_back(site);
+        emit(fs, tail ? TAILCALL : CALL, base, items.size() - 1);
+        if (!tail && dest != base)
+            emit(fs, MOVE, dest, base);
+        fs.freeReg = base;
+    }
+
+    void expr(FuncState& fs, MalType* form, uint8_t dest, bool tail) {
+        switch (typeOf(form)) {
+            case Local:
+                loadLocal(fs, form->as_local(), dest);
+                break;
+            case Symbol:
+                loadSymbol(fs, form->as_symbol(), dest);
+                break;
+            case List:
+                compileList(fs, form->as_list(), dest, tail);
+                return;
+            case Vector: {
+                auto items = form->as_vector()->items();
+                auto base = reserve(fs);
+                exprs(fs, items, 0);
+                emit(fs, VECTOR, base, items.size());
+                if (dest != base)
+                    emit(fs, MOVE, dest, base);
+                fs.freeReg = base;
+                break;
+            }
+            case HashMap: {
+                // the values go into registers in the order the form has them in,
+                // HASHMAP goes through the form again to get the keys
+                auto base = reserve(fs);
+                for (auto& entry : *form->as_hashmap())
+                    expr(fs, entry.value, reserve(fs), false);
+                emitBx(fs, HASHMAP, base, constant(fs, form));
+                if (dest != base)
+                    emit(fs, MOVE, dest, base);
+                fs.freeReg = base;
+                break;
+            }
+            default:
+                // values that evaluate to themselves
+                emitBx(fs, LOADK, dest, constant(fs, form));
+                break;
+        }
+        if (tail)
+            emit(fs, RETURN, dest);
+    }
+
+    // params don't have the &, like MalTCOptFunc wants them.
+    // captures is the list of MalLocals a flat closure captures, found in parent (or in the
+    // environment the function gets created in, when there is no parent)
+    Proto* compileFn(FuncState* parent, vector < MalType * >& params, bool variadic, MalType* body, MalType* captures) {
+        FuncState fs;
+        fs.proto = new Proto;
+        fs.flat = captures != NULL;
+        fs.proto->params = params;
+        fs.proto->variadic = variadic;
+        fs.proto->body = body;
+        GC::writeBarrier(fs.proto, body);
+        for (auto param : params)
+            GC::writeBarrier(fs.proto, param);
+
+        if (captures != NULL) {
+            for (auto captured : *captures->as_list()) {
+                auto local = captured->as_local();
+                fs.captured.push_back(local->symbol());
+                if (parent == NULL)
+                    continue;
+                size_t index;
+                bool inRegister = locate(*parent, local, index);
+                fs.proto->captures.push_back({ !inRegister, (uint8_t) index, local->symbol() });
+            }
+        }
+
+        fs.scopes.push_back({});
+        for (auto param : params)
+            fs.scopes.back().push_back({ param->as_symbol(), reserve(fs) });
+        expr(fs, body, reserve(fs), true);
+        return fs.proto;
+    }
+
+    // the bytecode for a function the tree walker is creating, or NULL if the VM can't run it
+    GCObject* compile(vector < MalType * >& params, bool variadic, MalType* body, MalType* captures) {
+        try {
+            return compileFn(NULL, params, variadic, body, captures);
+        } catch (Unsupported&) {
+            return NULL;
+        }
+    }
+
+    // the stack all the frames keep their registers on. it never grows, so a builtin
+    // can be handed a pointer into it even while it calls back into the VM
+    const size_t STACK_SIZE = 1 << 20;
+    MalType** stack = NULL;
+    // everything below top is live
+    size_t top = 0;
+
+    struct Frame {
+        Proto* proto;
+        MalTCOptFunc* fn;
+        // where register 0 is. the function being run is right below it
+        size_t base;
+        // where to carry on from, once the frame called by this one returns
+        size_t pc;
+        // where the caller wants the result
+        size_t ret;
+        // whether returning from this frame leaves run()
+        bool entry;
+        // the profiler session it was pushed in, if it was (see profile.hpp)
+        size_t profiled;
+    };
+    vector < Frame > frames;
+
+    void init() {
+        if (stack != NULL)
+            return;
+        stack = new MalType*[STACK_SIZE];
+        GC::addRoot(GC::Root { NULL, [](void*) {
+            for (size_t i = 0; top > i; ++i)
+                GC::visit(stack[i]);
+            for (auto& frame : frames) {
+                GC::visit(frame.proto);
+                GC::visit(frame.fn);
+            }
+        } });
+    }
+
+    void overflow() {
+        auto runExcep = RuntimeException();
+        runExcep.errMessage = "stack overflow.";
+        throw runExcep;
+    }
+
+    // pushes the frame for fn, which sits at stack[slot] with its argc arguments right above it
+    void enter(MalTCOptFunc* fn, size_t slot, size_t argc, size_t ret, bool entry) {
+        auto proto = static_cast< Proto* >(fn->getCode());
+        auto base = slot + 1;
+        if (base + max(argc, proto->nregs) > STACK_SIZE)
+            overflow();
+
+        auto params = proto->params.size();
+        if (proto->variadic) {
+            if (argc < params - 1) {
+                auto runExcep = RuntimeException();
+                runExcep.errMessage = "variadic function requires at least " + to_string(params - 1) + " arguments.";
+                throw runExcep;
+            }
+            auto rest = new MalVector;
+            for (size_t i = params - 1; argc > i; ++i)
+                rest->append(stack[base + i]);
+            stack[base + params - 1] = rest;
+        } else if (argc != params) {
+            auto runExcep = RuntimeException();
+            runExcep.errMessage = "mismatched argument size. ";
+            runExcep.errMessage += "expected " + to_string(params) + " arguments.";
+            throw runExcep;
+        }
+
+        // whatever is left in the rest of the registers might not be alive anymore
+        for (size_t i = params; proto->nregs > i; ++i)
+            stack[base + i] = MAL_NIL;
+        top = base + proto->nregs;
+        auto profiled = Profile::enabled ? Profile::push(Profile::functionOf(fn)) : 0;
+        frames.push_back(Frame { proto, fn, base, 0, ret, entry, profiled });
+    }
+
+    void leaveFrame() {
+        if (frames.back().profiled != 0 && frames.back().profiled == Profile::session)
+            Profile::pop();
+        frames.pop_back();
+    }
+
+    // expands any spread syntax in the argc arguments above stack[slot], in place
+    size_t spread(size_t slot, size_t argc) {
+        auto args = stack + slot + 1;
+        if (find_if(args, args + argc, [](MalType* arg) { return typeOf(arg) == Spreader; }) == args + argc)
+            return argc;
+
+        vector < MalType * > arguments;
+        spreadInto(args, argc, arguments);
+        if (slot + 1 + arguments.size() > STACK_SIZE)
+            overflow();
+        copy(arguments.begin(), arguments.end(), args);
+        top = max(top, slot + 1 + arguments.size());
+        return arguments.size();
+    }
+
+    CallSite& callSite(Proto* proto, size_t pc) {
+        return *lower_bound(proto->calls.begin(), proto->calls.end(), pc,
+                            [](CallSite& site, size_t pc) { return site.pc < pc; });
+    }
+
+    // calls what isn't a compiled function: a builtin, or a function the tree walker runs
+    MalType* callOther(Frame* frame, size_t pc, size_t slot, size_t argc) {
+        auto callee = stack[slot];
+        Profile::Mark profiled;
+        if (typeOf(callee) == Func) {
+            profiled.call(callee->as_func());
+            return callee->as_func()->callable()(stack + slot + 1, argc);
+        }
+        if (typeOf(callee) == Keyword) {
+            size_t cached = 0;
+            return Core::keywordGet(callee, stack + slot + 1, argc, cached);
+        }
+        if (typeOf(callee) != TCOptFunc) {
+            auto callForm = callSite(frame->proto, pc).form;
+            auto typeExcept = TypeException();
+            typeExcept.errMessage = "'" + inspectOf(callForm->as_list()->at(0)) + "' is not a Callable.";
+            throw typeExcept;
+        }
+
+        auto fn = callee->as_tcoptfunc();
+        vector < MalType * > arguments(stack + slot + 1, stack + slot + 1 + argc);
+        GCRoot argumentsRoot(arguments);
+        auto env = callEnv(fn, arguments);
+        profiled.call(fn);
+        return EVAL(fn->getBody(), env);
+    }
+
+    // a macro defined after the function was compiled: the call at pc
+    // runs as its form, with the variables it can see, through EVAL
+    MalType* expandCall(Frame* frame, size_t pc) {
+        auto& site = callSite(frame->proto, pc);
+        auto env = new Environ(frame->fn->getEnviron());
+        for (auto& var : site.visible)
+            env->bind(var.first, stack[frame->base + var.second]);
+        return EVAL(site.form, env);
+    }
+
+    bool compiled(MalType* callee) {
+        if (typeOf(callee) != TCOptFunc)
+            return false;
+        auto fn = callee->as_tcoptfunc();
+        return fn->getCode() != NULL && !fn->isMacro();
+    }
+
+// computed goto (a GCC and clang extension) jumps from the end of each instruction
+// straight to the next one, instead of going back through one switch
+#if defined(__GNUC__)
+#define VM_CASE(op) op_##op
+#define VM_NEXT() goto *dispatch[(ins = *ip++).op]
+#define VM_LOOP_BEGIN VM_NEXT();
+#define VM_LOOP_END
+#else
+#define VM_CASE(op) case op
+#define VM_NEXT() continue
+#define VM_LOOP_BEGIN for (;;) { ins = *ip++; switch (ins.op) {
+#define VM_LOOP_END } }
+#endif
+// the frame, and everything that comes from it, after anything that could have collected
+#define VM_LOAD() \
+    frame = &frames.back(); \
+    proto = frame->proto; \
+    code = proto->code.data(); \
+    ip = code + frame->pc; \
+    R = stack + frame->base; \
+    K = proto->constants.data()
+
+    // runs the innermost frame until the entry frame returns
+    MalType* run() {
+#if defined(__GNUC__)
+        static void* dispatch[] = {
+            &&op_MOVE, &&op_LOADK, &&op_GETGLOBAL, &&op_GETCAPTURE, &&op_NEG,
+            &&op_JMP, &&op_JMPIFNOT, &&op_TESTCOND, &&op_CALL, &&op_TAILCALL,
+            &&op_RETURN, &&op_CLOSURE, &&op_VECTOR, &&op_HASHMAP,
+            &&op_GETKEY, &&op_TESTMACRO,
+        };
+#endif
+        Frame* frame;
+        Proto* proto;
+        const Instr* code;
+        const Instr* ip;
+        MalType** R;
+        MalType** K;
+        Instr ins;
+        MalType* result;
+        VM_LOAD();
+
+        VM_LOOP_BEGIN
+        VM_CASE(MOVE):
+            R[ins.a] = R[ins.b];
+            VM_NEXT();
+        VM_CASE(LOADK):
+            R[ins.a] = K[ins.bx()];
+            VM_NEXT();
+        VM_CASE(GETGLOBAL):
+            R[ins.a] = TOP_LEVEL->get(K[ins.bx()]);
+            VM_NEXT();
+        VM_CASE(GETCAPTURE):
+            R[ins.a] = frame->fn->getEnviron()->at(ins.b);
+            VM_NEXT();
+        VM_CASE(NEG): {
+            MalType* arg[1] { R[ins.b] };
+            R[ins.a] = Core::sub(arg, 1);
+            VM_NEXT();
+        }
+        VM_CASE(JMP):
+            ip += ins.bx();
+            VM_NEXT();
+        VM_CASE(JMPIFNOT):
+            if (R[ins.a] == MAL_NIL || R[ins.a] == MAL_FALSE)
+                ip += ins.bx();
+            VM_NEXT();
+        VM_CASE(TESTCOND): {
+            auto cond = R[ins.a];
+            if (cond == MAL_NIL || cond == MAL_FALSE) {
+                ip += ins.bx();
+            } else if (cond != MAL_TRUE) {
+                auto e = TypeException();
+                e.errMessage = "Each cond case's condition should evaluate to Nil or Boolean.";
+                throw e;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(CALL): {
+            auto pc = ip - 1 - code;
+            frame->pc = ip - code;
+            auto slot = frame->base + ins.a;
+            auto argc = spread(slot, ins.b);
+            if (compiled(stack[slot])) {
+                enter(stack[slot]->as_tcoptfunc(), slot, argc, slot, false);
+                GC::safepoint();
+                VM_LOAD();
+                VM_NEXT();
+            }
+            result = callOther(frame, pc, slot, argc);
+            VM_LOAD();
+            top = frame->base + proto->nregs;
+            R[ins.a] = result;
+            VM_NEXT();
+        }
+        VM_CASE(TAILCALL): {
+            auto pc = ip - 1 - code;
+            auto slot = frame->base + ins.a;
+            auto argc = spread(slot, ins.b);
+            if (compiled(stack[slot])) {
+                // the callee and its arguments take the place of this frame's
+                auto to = frame->base - 1;
+                copy(stack + slot, stack + slot + argc + 1, stack + to);
+                auto ret = frame->ret;
+                auto entry = frame->entry;
+                leaveFrame();
+                enter(stack[to]->as_tcoptfunc(), to, argc, ret, entry);
+                GC::safepoint();
+                VM_LOAD();
+                VM_NEXT();
+            }
+            frame->pc = ip - code;
+            result = callOther(frame, pc, slot, argc);
+            VM_LOAD();
+            goto leave;
+        }
+        VM_CASE(RETURN):
+            result = R[ins.a];
+        leave: {
+            auto ret = frame->ret;
+            auto entry = frame->entry;
+            leaveFrame();
+            stack[ret] = result;
+            if (entry)
+                return result;
+            VM_LOAD();
+            top = frame->base + proto->nregs;
+            VM_NEXT();
+        }
+        VM_CASE(CLOSURE): {
+            auto child = proto->protos[ins.bx()];
+            auto env = new Environ(TOP_LEVEL);
+            for (auto& captured : child->captures) {
+                auto value = captured.fromCapture ? frame->fn->getEnviron()->at(captured.index) : R[captured.index];
+                env->bind(captured.symbol, value);
+            }
+            auto fn = new MalTCOptFunc(child->body, child->params, env, child->variadic);
+            fn->setCode(child);
+            R[ins.a] = fn;
+            VM_NEXT();
+        }
+        VM_CASE(VECTOR): {
+            auto vec = new MalVector;
+            for (size_t i = 1; ins.b >= i; ++i)
+                vec->append(R[ins.a + i]);
+            R[ins.a] = vec;
+            VM_NEXT();
+        }
+        VM_CASE(HASHMAP): {
+            auto hmap = new MalHashMap;
+            size_t i = 1;
+            for (auto& entry : *K[ins.bx()]->as_hashmap())
+                hmap->set(entry.key, R[ins.a + i++]);
+            R[ins.a] = hmap;
+            VM_NEXT();
+        }
+        VM_CASE(GETKEY): {
+            // doesn't allocate, so nothing moves
+            auto& site = proto->keys[ins.c];
+            R[ins.a] = Core::keywordGet(site.key, R + ins.a + 1, ins.b, site.slot);
+            VM_NEXT();
+        }
+        VM_CASE(TESTMACRO): {
+            if (typeOf(R[ins.a]) != TCOptFunc || !R[ins.a]->as_tcoptfunc()->isMacro())
+                VM_NEXT();
+            // none of the arguments have been evaluated, the expansion gets them as forms
+            ip += ins.bx();
+            ins = *ip++;
+            frame->pc = ip - code;
+            result = expandCall(frame, ip - 1 - code);
+            VM_LOAD();
+            if (ins.op == TAILCALL)
+                goto leave;
+            top = frame->base + proto->nregs;
+            R[ins.a] = result;
+            VM_NEXT();
+        }
+        VM_LOOP_END
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_LOOP_BEGIN
+#undef VM_LOOP_END
+#undef VM_LOAD
+
+    // calls a function the VM compiled, from outside of it
+    MalType* call(MalTCOptFunc* fn, vector < MalType * >& arguments) {
+        init();
+        auto savedTop = top;
+        auto savedFrames = frames.size();
+        // pops what the frames an error goes through pushed (see profile.hpp)
+        Profile::Mark profiled;
+        auto slot = top;
+        if (slot + 1 + arguments.size() > STACK_SIZE)
+            overflow();
+        stack[slot] = fn;
+        copy(arguments.begin(), arguments.end(), stack + slot + 1);
+        top = slot + 1 + arguments.size();
+        try {
+            enter(fn, slot, arguments.size(), slot, true);
+            auto result = run();
+            top = savedTop;
+            return result;
+        } catch (...) {
+            // unwinds whatever the error went through
+            frames.erase(frames.begin() + savedFrames, frames.end());
+            top = savedTop;
+            throw;
+        }
+    }
+}